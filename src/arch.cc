@@ -83,6 +83,30 @@ uint64_t arch_get_memtotal()
 #endif
 }
 
+uint64_t arch_get_l2size()
+{
+  /* size of the level 2 cache in bytes, 256KB if unknown */
+
+  const uint64_t l2_default = 256 * 1024;
+  int64_t size = 0;
+
+#if defined(__APPLE__)
+
+  size_t length = sizeof(size);
+  if (sysctlbyname("hw.l2cachesize", &size, &length, nullptr, 0) == -1)
+    size = 0;
+
+#elif defined(_SC_LEVEL2_CACHE_SIZE)
+
+  size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+#endif
+
+  if (size <= 0)
+    return l2_default;
+  return static_cast<uint64_t>(size);
+}
+
 void arch_srandom(unsigned int seed)
 {
   /* initialize pseudo-random number generator */
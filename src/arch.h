@@ -23,5 +23,6 @@
 
 uint64_t arch_get_memused();
 uint64_t arch_get_memtotal();
+uint64_t arch_get_l2size();
 void arch_srandom(unsigned int seed);
 uint64_t arch_random();
@@ -33,9 +33,18 @@
 
 void bloom_patterns_generate(struct bloom_s * b);
 
+/*
+  Without a target false positive rate, k is 8. With one, k and the
+  mean number of elements per 64-bit block (the load) are chosen to
+  give the target rate in the smallest filter.
+*/
+
+static unsigned int bloom_k = 8;
+static double bloom_load = 0.0;
+
 void bloom_patterns_generate(struct bloom_s * b)
 {
-  const unsigned int k = 8;
+  const unsigned int k = bloom_k;
   for (unsigned int i = 0; i < BLOOM_PATTERN_COUNT; i++)
     {
       uint64_t pattern = 0;
@@ -53,7 +62,84 @@ void bloom_patterns_generate(struct bloom_s * b)
 
 void bloom_zap(struct bloom_s * b)
 {
-  memset(b->bitmap, 0xff, b->size);
+  threads_memset(b->bitmap, 0xff, b->size);
+}
+
+static double bloom_fpr(double load, unsigned int k)
+{
+  /*
+    Expected false positive rate of a blocked filter, with a Poisson
+    distributed number of elements in each block, each setting k of
+    its 64 bits. In addition, a lookup always passes if an element in
+    the block has the same pattern, which limits the lowest rate.
+  */
+
+  double fpr = 0.0;
+  double term = exp(- load);
+  for (unsigned int i = 0; i < 64 + 8 * load; i++)
+    {
+      double set = 1.0 - pow(1.0 - k / 64.0, i);
+      fpr += term * pow(set, k);
+      term *= load / (i + 1);
+    }
+  double same = 1.0 - exp(- load / BLOOM_PATTERN_COUNT);
+  return same + (1.0 - same) * fpr;
+}
+
+void bloom_configure(double fpr)
+{
+  /* find the k allowing the highest load for the given rate */
+
+  for (unsigned int k = 1; k <= 16; k++)
+    {
+      double lo = 0.0;
+      double hi = 64.0;
+      for (int i = 0; i < 50; i++)
+        {
+          double mid = (lo + hi) / 2;
+          if (bloom_fpr(mid, k) <= fpr)
+            lo = mid;
+          else
+            hi = mid;
+        }
+      if (lo > bloom_load)
+        {
+          bloom_load = lo;
+          bloom_k = k;
+        }
+    }
+
+  if (bloom_load <= 0.0)
+    fatal("Unable to reach the Bloom filter false positive rate");
+}
+
+unsigned int bloom_get_k()
+{
+  return bloom_k;
+}
+
+uint64_t bloom_size(uint64_t elements)
+{
+  /*
+    Suitable size in bytes for the given number of elements. Without a
+    target rate, at least about 11 bits per element, which was the
+    size used when the filter was sized after the linear probing hash
+    table filled to 70%.
+  */
+
+  uint64_t size = 8;
+  if (bloom_load > 0.0)
+    {
+      double blocks = ceil(elements / bloom_load);
+      while (size < 8 * blocks)
+        size <<= 1;
+    }
+  else
+    {
+      while (7 * size < 10 * elements)
+        size <<= 1;
+    }
+  return size;
 }
 
 struct bloom_s * bloom_init(uint64_t size)
@@ -68,7 +154,7 @@ struct bloom_s * bloom_init(uint64_t size)
 
   b->mask = (size >> 3) - 1;
 
-  b->bitmap = static_cast<uint64_t *>(xmalloc(size));
+  b->bitmap = static_cast<uint64_t *>(xmalloc_huge(size));
 
   bloom_zap(b);
 
@@ -79,6 +165,42 @@ struct bloom_s * bloom_init(uint64_t size)
 
 void bloom_exit(struct bloom_s * b)
 {
-  xfree(b->bitmap);
+  xfree_huge(b->bitmap);
   xfree(b);
 }
+
+void bloom_stats_sample(struct bloom_stats_s * s)
+{
+  /* bypass the filter for a while if most of the sample passed */
+
+  if (4 * s->sample_passed > 3 * s->sample_queries)
+    s->bypass_left = BLOOM_BYPASS;
+  s->sample_queries = 0;
+  s->sample_passed = 0;
+}
+
+void bloom_stats_init(struct bloom_stats_s * s)
+{
+  memset(s, 0, sizeof(struct bloom_stats_s));
+}
+
+void bloom_stats_add(struct bloom_stats_s * total, struct bloom_stats_s * s)
+{
+  total->queries += s->queries;
+  total->passed += s->passed;
+  total->present += s->present;
+  total->bypassed += s->bypassed;
+}
+
+void bloom_stats_report(struct bloom_stats_s * s)
+{
+  uint64_t lookups = s->queries + s->bypassed;
+  uint64_t absent = s->queries - s->present;
+  uint64_t false_positives = s->passed - s->present;
+
+  fprintf(logfile, "Filter lookups:    %" PRIu64 " (%.1f%% bypassed)\n",
+          lookups, lookups ? 100.0 * s->bypassed / lookups : 0.0);
+  fprintf(logfile, "Filter FP rate:    %.4f%% (%" PRIu64 " of %" PRIu64 ")\n",
+          absent ? 100.0 * false_positives / absent : 0.0,
+          false_positives, absent);
+}
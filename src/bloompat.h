@@ -23,6 +23,13 @@
 #define BLOOM_PATTERN_COUNT (1 << BLOOM_PATTERN_SHIFT)
 #define BLOOM_PATTERN_MASK (BLOOM_PATTERN_COUNT - 1)
 
+/* lookups checked at once by bloom_get_batch */
+#define BLOOM_BATCH 8
+
+/* lookups per sample of the pass rate, and skipped when bypassing */
+#define BLOOM_SAMPLE 4096
+#define BLOOM_BYPASS (64 * BLOOM_SAMPLE)
+
 struct bloom_s
 {
   uint64_t size;
@@ -31,8 +38,37 @@ struct bloom_s
   uint64_t patterns[BLOOM_PATTERN_COUNT];
 };
 
+/*
+  Lookup statistics, one per thread, also used with the binary fuse
+  filter. The filter only saves time when it rejects a good part of
+  the lookups, as each lookup passing it is also looked up in the
+  table. When more than 3/4 of a sample of lookups pass, as with d=0
+  or repertoires compared to themselves, the filter is bypassed for a
+  while, and then sampled again. The false positive rate is measured
+  on the lookups checked by the filter, using the number of those
+  passing lookups present in the table.
+*/
+
+struct bloom_stats_s
+{
+  uint64_t queries;
+  uint64_t passed;
+  uint64_t present;
+  uint64_t bypassed;
+  uint64_t sample_queries;
+  uint64_t sample_passed;
+  uint64_t bypass_left;
+  bool filtered;
+};
+
 void bloom_zap(struct bloom_s * b);
 
+void bloom_configure(double fpr);
+
+unsigned int bloom_get_k();
+
+uint64_t bloom_size(uint64_t elements);
+
 struct bloom_s * bloom_init(uint64_t size);
 
 void bloom_exit(struct bloom_s * b);
@@ -52,7 +88,123 @@ inline void bloom_set(struct bloom_s * b, uint64_t h)
   * bloom_adr(b, h) &= ~ bloom_pat(b, h);
 }
 
+inline void bloom_set_atomic(struct bloom_s * b, uint64_t h)
+{
+  /* like bloom_set, but safe with other threads setting bits */
+
+  __atomic_fetch_and(bloom_adr(b, h), ~ bloom_pat(b, h), __ATOMIC_RELAXED);
+}
+
 inline bool bloom_get(struct bloom_s * b, uint64_t h)
 {
   return ! (* bloom_adr(b, h) & bloom_pat(b, h));
 }
+
+#ifdef __AVX2__
+
+inline unsigned int bloom_get4(struct bloom_s * b, uint64_t * h)
+{
+  /* bit i of the result is set if lookup i passes, using gathers */
+
+  __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i *>(h));
+  __m256i adr = _mm256_and_si256
+    (_mm256_srli_epi64(x, BLOOM_PATTERN_SHIFT),
+     _mm256_set1_epi64x(static_cast<long long>(b->mask)));
+  __m256i pat = _mm256_and_si256
+    (x, _mm256_set1_epi64x(BLOOM_PATTERN_MASK));
+  __m256i words = _mm256_i64gather_epi64
+    (reinterpret_cast<const long long *>(b->bitmap), adr, 8);
+  __m256i patterns = _mm256_i64gather_epi64
+    (reinterpret_cast<const long long *>(b->patterns), pat, 8);
+  __m256i clear = _mm256_cmpeq_epi64(_mm256_and_si256(words, patterns),
+                                     _mm256_setzero_si256());
+  return static_cast<unsigned int>
+    (_mm256_movemask_pd(_mm256_castsi256_pd(clear)));
+}
+
+#endif
+
+void bloom_stats_sample(struct bloom_stats_s * s);
+
+inline bool bloom_stats_bypass(struct bloom_stats_s * s, unsigned int n)
+{
+  /* true if a batch of n lookups should skip the filter */
+
+  if (s->bypass_left)
+    {
+      s->bypass_left -= MIN(n, s->bypass_left);
+      s->bypassed += n;
+      s->filtered = false;
+      return true;
+    }
+  return false;
+}
+
+inline void bloom_stats_count(struct bloom_stats_s * s,
+                              unsigned int n,
+                              unsigned int passed)
+{
+  /* a batch of n lookups was checked by the filter */
+
+  s->filtered = true;
+  s->queries += n;
+  s->passed += passed;
+  s->sample_queries += n;
+  s->sample_passed += passed;
+  if (s->sample_queries >= BLOOM_SAMPLE)
+    bloom_stats_sample(s);
+}
+
+inline unsigned int bloom_get_batch(struct bloom_s * b,
+                                    struct bloom_stats_s * s,
+                                    uint64_t * h,
+                                    unsigned int n)
+{
+  /*
+    Check up to BLOOM_BATCH lookups at once. Bit i of the result is
+    set if lookup i passed the filter, or if the filter is bypassed.
+    Gathers are only used when compiled for AVX2, as they were slower
+    than plain loads on some CPUs.
+  */
+
+  if (bloom_stats_bypass(s, n))
+    return (1U << n) - 1;
+
+  unsigned int pass = 0;
+  unsigned int passed = 0;
+  unsigned int i = 0;
+
+#ifdef __AVX2__
+  for (; i + 4 <= n; i += 4)
+    {
+      unsigned int p = bloom_get4(b, h + i);
+      pass |= p << i;
+      passed += __builtin_popcount(p);
+    }
+#endif
+
+  for (; i < n; i++)
+    if (bloom_get(b, h[i]))
+      {
+        pass |= 1U << i;
+        passed++;
+      }
+
+  bloom_stats_count(s, n, passed);
+
+  return pass;
+}
+
+inline void bloom_stats_found(struct bloom_stats_s * s)
+{
+  /* a lookup passing the last batch was present in the table */
+
+  if (s->filtered)
+    s->present++;
+}
+
+void bloom_stats_init(struct bloom_stats_s * s);
+
+void bloom_stats_add(struct bloom_stats_s * total, struct bloom_stats_s * s);
+
+void bloom_stats_report(struct bloom_stats_s * s);
@@ -43,12 +43,21 @@ static pthread_mutex_t network_mutex;
 static unsigned int * network = 0;
 static unsigned int network_count = 0;
 static unsigned int network_seq = 0;
+static uint64_t * network_order = 0;
 static uint64_t network_alloc = 0;
 static uint64_t seqcount = 0;
 
 static struct db * d;
 static struct bloom_s * bloom = 0;
+static struct fuse_s * fuse = 0;
+static struct bloom_stats_s bloom_total;
 static hashtable_s * hashtable = 0;
+static struct hash_owners_s * row_owners = 0;
+static struct pigeonhole_s * pigeonhole = 0;
+static struct masked_s * masked = 0;
+static struct deletion_s * deletions = 0;
+static struct trie_s * trie = 0;
+static struct postings_s * queries = 0;
 
 static int compare_cluster(const void * a, const void * b)
 {
@@ -62,35 +71,60 @@ static int compare_cluster(const void * a, const void * b)
     return 0;
 }
 
-static inline void hash_insert_cluster(uint64_t seq)
+static void hash_insert_thread(int64_t t)
 {
-  /* find the first empty bucket */
-  uint64_t hash = db_gethash(d, seq);
-  uint64_t j = hash_getindex(hashtable, hash);
-  while (hash_is_occupied(hashtable, j))
-    j = hash_getnextindex(hashtable, j);
-
-  hash_set_occupied(hashtable, j);
-  hash_set_value(hashtable, j, hash);
-  hash_set_data(hashtable, j, seq);
-  bloom_set(bloom, hash);
+  /*
+    Insert the sequences with hashes owned by this thread into the
+    hash table and Bloom filter, in input order.
+  */
+
+  uint64_t owners = static_cast<uint64_t>(opt_threads);
+
+  for (uint64_t k = hash_owners_first(row_owners, t);
+       k < hash_owners_last(row_owners, t); k++)
+    {
+      uint64_t seq = hash_owners_get(row_owners, k);
+      uint64_t hash = db_gethash(d, seq);
+
+      if (t == 0)
+        progress_update(k * owners);
+
+      uint64_t j = hash_claim_empty(hashtable, hash);
+      hash_set_value(hashtable, j, hash);
+      hash_set_data(hashtable, j, seq);
+      hash_set_info(hashtable, j,
+                    db_getsequencelen(d, seq),
+                    hash_gene_tag(db_get_v_gene(d, seq),
+                                  db_get_j_gene(d, seq)));
+      hash_publish(hashtable, j, hash);
+      if (bloom)
+        bloom_set_atomic(bloom, hash);
+    }
 }
 
-static void find_variant_matches(uint64_t seed,
+static bool find_variant_matches(uint64_t seed,
                                  var_s * var,
+                                 unsigned int seed_seqlen,
+                                 uint16_t tag,
                                  unsigned int * * hits_data,
                                  unsigned int * hits_count,
                                  uint64_t * hits_alloc)
 {
-  /* compute hash table index */
+  /* returns true if the hash value of the variant is present */
 
-  uint64_t j = hash_getindex(hashtable, var->hash);
+  unsigned int length = variant_length(var, seed_seqlen);
+  struct hash_probe_s probe;
+  uint64_t j;
+  bool present = false;
 
   /* find matching buckets */
 
-  while (hash_is_occupied(hashtable, j))
+  hash_probe_init(hashtable, var->hash, & probe);
+  while (hash_probe_next(hashtable, & probe, & j))
     {
       if (hash_compare_value(hashtable, j, var->hash))
+        present = true;
+      if (hash_compare_bucket(hashtable, j, var->hash, length, tag))
         {
           uint64_t hit = hash_get_data(hashtable, j);
 
@@ -102,15 +136,11 @@ static void find_variant_matches(uint64_t seed,
           unsigned int hit_v_gene = db_get_v_gene(d, hit);
           unsigned int hit_j_gene = db_get_j_gene(d, hit);
 
-          if ((seed != hit) &&
-              (opt_ignore_genes ||
-               ((seed_v_gene == hit_v_gene) &&
-                (seed_j_gene == hit_j_gene))))
+          if (opt_ignore_genes ||
+              ((seed_v_gene == hit_v_gene) && (seed_j_gene == hit_j_gene)))
             {
               unsigned char * seed_sequence
                 = (unsigned char *) db_getsequence(d, seed);
-              unsigned int seed_seqlen
-                = db_getsequencelen(d, seed);
               unsigned char * hit_sequence
                 = (unsigned char *) db_getsequence(d, hit);
               unsigned int hit_seqlen
@@ -131,18 +161,18 @@ static void find_variant_matches(uint64_t seed,
                 }
             }
         }
-      j = hash_getnextindex(hashtable, j);
     }
+  return present;
 }
 
 static void process_variants(uint64_t seed,
                              var_s * variant_list,
+                             struct bloom_stats_s * stats,
                              unsigned int * * hits_data,
                              unsigned int * hits_count,
                              uint64_t * hits_alloc)
 {
   unsigned int variant_count = 0;
-  * hits_count = 0;
 
   unsigned char * sequence = (unsigned char *) db_getsequence(d, seed);
   unsigned int seqlen = db_getsequencelen(d, seed);
@@ -150,76 +180,201 @@ static void process_variants(uint64_t seed,
   uint64_t v_gene = db_get_v_gene(d, seed);
   uint64_t j_gene = db_get_j_gene(d, seed);
 
+  uint16_t tag = hash_gene_tag(v_gene, j_gene);
+
   generate_variants(hash,
                     sequence, seqlen, v_gene, j_gene,
                     variant_list, & variant_count);
 
-  for(unsigned int i = 0; i < variant_count; i++)
+  /* check the variants against the filter in batches */
+
+  for (unsigned int i = 0; i < variant_count; i += BLOOM_BATCH)
     {
-      var_s * var = variant_list + i;
-      if (bloom_get(bloom, var->hash))
-        find_variant_matches(seed, var, hits_data, hits_count, hits_alloc);
+      unsigned int n = MIN(BLOOM_BATCH, variant_count - i);
+      uint64_t h[BLOOM_BATCH];
+      for (unsigned int k = 0; k < n; k++)
+        h[k] = variant_list[i + k].hash;
+
+      unsigned int pass = fuse ?
+        fuse_get_batch(fuse, stats, h, n) :
+        bloom_get_batch(bloom, stats, h, n);
+      while (pass)
+        {
+          var_s * var = variant_list + i + __builtin_ctz(pass);
+          pass &= pass - 1;
+          if (find_variant_matches(seed, var, seqlen, tag,
+                                   hits_data, hits_count, hits_alloc))
+            bloom_stats_found(stats);
+        }
     }
 }
 
-static void process_trad(uint64_t seed,
-                         unsigned int * * hits_data,
-                         unsigned int * hits_count,
-                         uint64_t * hits_alloc)
+static void process_index(uint64_t seed,
+                          uint64_t * * found_data,
+                          uint64_t * found_alloc,
+                          unsigned int * * hits_data,
+                          unsigned int * hits_count,
+                          uint64_t * hits_alloc)
 {
-  /* Only to be used with no indels (and d >= 3) */
-
-  for (uint64_t hit = 0; hit < seqcount; hit++)
-    if (seed != hit)
-      {
-        /* check if everything matches */
-
-        unsigned int seed_v_gene = db_get_v_gene(d, seed);
-        unsigned int seed_j_gene = db_get_j_gene(d, seed);
-
-        unsigned int hit_v_gene = db_get_v_gene(d, hit);
-        unsigned int hit_j_gene = db_get_j_gene(d, hit);
-
-        if (opt_ignore_genes ||
-            ((seed_v_gene == hit_v_gene) && (seed_j_gene == hit_j_gene)))
-          {
-            unsigned int seed_seqlen = db_getsequencelen(d, seed);
-            unsigned int hit_seqlen = db_getsequencelen(d, hit);
-
-            if (seed_seqlen == hit_seqlen)
-              {
-                unsigned char * seed_sequence
-                  = (unsigned char *) db_getsequence(d, seed);
-                unsigned char * hit_sequence
-                  = (unsigned char *) db_getsequence(d, hit);
-
-                if (seq_diff(seed_sequence, hit_sequence, seed_seqlen)
-                    <= opt_differences)
-                  {
-                    if (*hits_alloc <= *hits_count)
-                      {
-                        *hits_alloc += 1024;
-                        *hits_data = static_cast<unsigned int *>
-                          (xrealloc((*hits_data),
-                                    (*hits_alloc) * sizeof(unsigned int)));
-                      }
-                    (*hits_data)[(*hits_count)++] = hit;
-                  }
-              }
-          }
-      }
+  /* Only the deletion and trie indices may be used with indels */
+
+  uint64_t found_count = 0;
+
+  switch (opt_index_int)
+    {
+    case index_masked:
+      masked_search(masked, d, seed, nullptr,
+                    found_data, & found_count, found_alloc);
+      break;
+
+    case index_trie:
+      trie_search(trie, d, seed,
+                  found_data, & found_count, found_alloc);
+      break;
+
+    case index_deletion:
+      deletion_search(deletions, d, seed, nullptr,
+                      found_data, & found_count, found_alloc);
+      break;
+
+    default:
+      pigeonhole_search(pigeonhole, d, seed, nullptr,
+                        found_data, & found_count, found_alloc);
+      break;
+    }
+
+  for (uint64_t k = 0; k < found_count; k++)
+    {
+      if (*hits_alloc <= *hits_count)
+        {
+          *hits_alloc += 1024;
+          *hits_data = static_cast<unsigned int *>
+            (xrealloc((*hits_data),
+                      (*hits_alloc) * sizeof(unsigned int)));
+        }
+      (*hits_data)[(*hits_count)++] = (*found_data)[k];
+    }
 }
 
 static void process_seq(uint64_t seed,
                         var_s * variant_list,
+                        struct bloom_stats_s * stats,
+                        uint64_t * * found_data,
+                        uint64_t * found_alloc,
                         unsigned int * * hits_data,
                         unsigned int * hits_count,
                         uint64_t * hits_alloc)
 {
-  if (opt_differences <= MAXDIFF_HASH)
-    process_variants(seed, variant_list, hits_data, hits_count, hits_alloc);
+  if (opt_index_int == index_variants)
+    process_variants(seed, variant_list, stats,
+                     hits_data, hits_count, hits_alloc);
   else
-    process_trad(seed, hits_data, hits_count, hits_alloc);
+    process_index(seed, found_data, found_alloc,
+                  hits_data, hits_count, hits_alloc);
+}
+
+struct group_cost_s
+{
+  uint64_t cost;
+  uint64_t group;
+};
+
+static int compare_group_cost(const void * a, const void * b)
+{
+  /* most expensive first, otherwise in order */
+
+  const struct group_cost_s * x = static_cast<const struct group_cost_s *>(a);
+  const struct group_cost_s * y = static_cast<const struct group_cost_s *>(b);
+
+  if (x->cost != y->cost)
+    return x->cost > y->cost ? -1 : +1;
+  if (x->group != y->group)
+    return x->group < y->group ? -1 : +1;
+  return 0;
+}
+
+static uint64_t * network_schedule()
+{
+  /*
+    Order the groups by the estimated cost of their search, largest
+    first: the number of variants of the length, or just the length
+    with the other indices, plus the size of the group, which are
+    among the hits.
+  */
+
+  uint64_t count = queries->group_count;
+
+  struct group_cost_s * costs = static_cast<struct group_cost_s *>
+    (xmalloc(MAX(count, 1) * sizeof(struct group_cost_s)));
+
+  for (uint64_t g = 0; g < count; g++)
+    {
+      uint64_t first = postings_get_first(queries, g);
+      uint64_t last = postings_get_last(queries, g);
+      uint64_t seed = postings_get(queries, first).seq;
+      unsigned int seqlen = db_getsequencelen(d, seed);
+
+      uint64_t cost = seqlen + 1;
+      if (opt_index_int == index_variants)
+        cost = max_variants(seqlen);
+
+      costs[g].cost = cost + (last - first);
+      costs[g].group = g;
+    }
+
+  qsort(costs, count, sizeof(struct group_cost_s), compare_group_cost);
+
+  uint64_t * order = static_cast<uint64_t *>
+    (xmalloc(MAX(count, 1) * sizeof(uint64_t)));
+  for (uint64_t k = 0; k < count; k++)
+    order[k] = costs[k].group;
+
+  xfree(costs);
+
+  return order;
+}
+
+struct network_batch_s
+{
+  unsigned int group;
+  unsigned int start;
+  unsigned int count;
+};
+
+const unsigned int network_batch_size = 256;
+
+static void network_add(struct network_batch_s * batch,
+                        unsigned int batch_count,
+                        unsigned int * hits_data,
+                        unsigned int hits_count)
+{
+  /* add the hits of a batch of groups to the network, mutex locked */
+
+  if (network_count + hits_count > network_alloc)
+    {
+      while (network_count + hits_count > network_alloc)
+        network_alloc += 1024 * 1024;
+
+      network = static_cast<unsigned int*>
+        (xrealloc(network, network_alloc * sizeof(unsigned int)));
+    }
+
+  for (unsigned int b = 0; b < batch_count; b++)
+    {
+      uint64_t first = postings_get_first(queries, batch[b].group);
+      uint64_t last = postings_get_last(queries, batch[b].group);
+
+      for (uint64_t m = first; m < last; m++)
+        {
+          uint64_t member = postings_get(queries, m).seq;
+          iteminfo[member].network_start = network_count + batch[b].start;
+          iteminfo[member].network_count = batch[b].count;
+        }
+    }
+
+  for (unsigned int k = 0; k < hits_count; k++)
+    network[network_count + k] = hits_data[k];
+  network_count += hits_count;
 }
 
 static void network_thread(int64_t t)
@@ -227,49 +382,82 @@ static void network_thread(int64_t t)
   (void) t;
 
   unsigned int longest = db_getlongestsequence(d);
-  uint64_t maxvar = max_variants(longest);
 
   uint64_t hits_alloc = 1024;
   auto * hits_data = static_cast<unsigned int *>
     (xmalloc(hits_alloc * sizeof(unsigned int)));
 
-  auto * variant_list = static_cast<struct var_s *>
-    (xmalloc(maxvar * sizeof(struct var_s)));
-
-  pthread_mutex_lock(&network_mutex);
-
-  while (network_seq < seqcount)
-    {
-      unsigned int seed = network_seq++;
-      progress_update(seed);
-
-      pthread_mutex_unlock(&network_mutex);
+  struct var_s * variant_list = nullptr;
+  if (opt_index_int == index_variants)
+    variant_list = static_cast<struct var_s *>
+      (xmalloc(max_variants(longest) * sizeof(struct var_s)));
 
-      unsigned int hits_count = 0;
-      process_seq(seed, variant_list,
-                  & hits_data, & hits_count, & hits_alloc);
+  uint64_t found_alloc = 1024;
+  auto * found_data = static_cast<uint64_t *>
+    (xmalloc(found_alloc * sizeof(uint64_t)));
 
-      pthread_mutex_lock(&network_mutex);
+  struct bloom_stats_s stats;
+  bloom_stats_init(& stats);
 
-      iteminfo[seed].network_start = network_count;
-      iteminfo[seed].network_count = hits_count;
+  struct network_batch_s batch[network_batch_size];
+  unsigned int batch_count = 0;
+  unsigned int hits_count = 0;
 
-      if (network_count + hits_count > network_alloc)
+  while (true)
+    {
+      /*
+        Search for the first sequence of a group of identical
+        sequences. The hits include the sequence itself and the rest
+        of the group, and are shared by all members of the group.
+        The groups are claimed one by one without locking, and the
+        hits of a batch of groups are added to the network at once.
+      */
+
+      unsigned int k = __atomic_fetch_add(& network_seq, 1, __ATOMIC_RELAXED);
+      bool done = k >= queries->group_count;
+
+      if (! done)
         {
-          while (network_count + hits_count > network_alloc)
-            network_alloc += 1024 * 1024;
+          unsigned int group = network_order ?
+            static_cast<unsigned int>(network_order[k]) : k;
+          uint64_t seed = postings_get(queries,
+                                       postings_get_first(queries, group)).seq;
+
+          unsigned int start = hits_count;
+          process_seq(seed, variant_list, & stats, & found_data, & found_alloc,
+                      & hits_data, & hits_count, & hits_alloc);
+
+          batch[batch_count].group = group;
+          batch[batch_count].start = start;
+          batch[batch_count].count = hits_count - start;
+          batch_count++;
+        }
 
-          network = static_cast<unsigned int*>
-            (xrealloc(network, network_alloc * sizeof(unsigned int)));
+      if (batch_count && (done || (batch_count == network_batch_size)))
+        {
+          if (opt_threads > 1)
+            pthread_mutex_lock(&network_mutex);
+          network_add(batch, batch_count, hits_data, hits_count);
+          progress_update(MIN(k, queries->group_count));
+          if (opt_threads > 1)
+            pthread_mutex_unlock(&network_mutex);
+          batch_count = 0;
+          hits_count = 0;
         }
 
-      for(unsigned int k = 0; k < hits_count; k++)
-        network[network_count++] = hits_data[k];
+      if (done)
+        break;
     }
 
-  pthread_mutex_unlock(&network_mutex);
+  if (opt_threads > 1)
+    pthread_mutex_lock(&network_mutex);
+  bloom_stats_add(& bloom_total, & stats);
+  if (opt_threads > 1)
+    pthread_mutex_unlock(&network_mutex);
 
-  xfree(variant_list);
+  xfree(found_data);
+  if (variant_list)
+    xfree(variant_list);
   xfree(hits_data);
 }
 
@@ -317,55 +505,115 @@ void cluster(char * filename)
           db_get_j_gene_count());
   fprintf(logfile, "\n");
 
-  if (opt_differences <= MAXDIFF_HASH)
-    {
-      zobrist_init(longest + MAX_INSERTS,
-                   db_get_v_gene_count(),
-                   db_get_j_gene_count());
+  zobrist_init(opt_index_int == index_pigeonhole ?
+               longest : longest + MAX_INSERTS,
+               db_get_v_gene_count(),
+               db_get_j_gene_count());
 
-      db_hash(d);
+  db_hash(d);
 
-      hashtable = hash_init(seqcount);
-      bloom = bloom_init(hash_get_tablesize(hashtable) * 2);
+  /* group identical sequences, they are searched only once */
+
+  uint64_t duplicates = 0;
+  queries = postings_init(d, & duplicates);
+
+  if (opt_index_int == index_pigeonhole)
+    {
+      pigeonhole = pigeonhole_init(d, longest, opt_differences + 1);
+    }
+  else
+    {
+      if (opt_index_int == index_variants)
+        {
+          hashtable = hash_init(seqcount, seqcount);
+          if (opt_filter_int == filter_bloom)
+            {
+              /* twice the usual size, unless sized by a target rate */
+              uint64_t size = bloom_size(seqcount);
+              if (opt_bloom_fpr == 0.0)
+                size *= 2;
+              bloom = bloom_init(size);
+            }
+        }
+      else if (opt_index_int == index_masked)
+        {
+          masked = masked_init(d);
+        }
+      else if (opt_index_int == index_deletion)
+        {
+          deletions = deletion_init(d);
+        }
+      else
+        {
+          trie = trie_init(d);
+        }
     }
 
   iteminfo = static_cast<struct iteminfo_s *>
     (xmalloc(seqcount * sizeof(struct iteminfo_s)));
 
-  progress_init("Hashing sequences:", seqcount);
-  for(uint64_t i=0; i < seqcount; i++)
+  threads_parallel_for(0, seqcount, 0,
+                       [](int64_t t, uint64_t first, uint64_t last)
+                       {
+                         (void) t;
+                         for (uint64_t i = first; i < last; i++)
+                           {
+                             iteminfo[i].clusterid = no_cluster;
+                             iteminfo[i].next = no_cluster;
+                           }
+                       });
+
+  if (opt_index_int == index_variants)
     {
-      iteminfo[i].clusterid = no_cluster;
-      iteminfo[i].next = no_cluster;
-      if (opt_differences <= MAXDIFF_HASH)
-        hash_insert_cluster(i);
-      progress_update(i);
+      row_owners = hash_owners_init(d);
+      progress_init("Hashing sequences:", seqcount);
+      threads_run(hash_insert_thread);
+      progress_done();
+      hash_owners_exit(row_owners);
+      row_owners = 0;
+
+      if (opt_filter_int == filter_fuse)
+        {
+          /* the filter is built from the hashes of all sequences */
+
+          uint64_t * keys = static_cast<uint64_t *>
+            (xmalloc(MAX(seqcount, 1) * sizeof(uint64_t)));
+          for (uint64_t seq = 0; seq < seqcount; seq++)
+            keys[seq] = db_gethash(d, seq);
+          fuse = fuse_init(keys, seqcount);
+          xfree(keys);
+        }
     }
-  progress_done();
+
+  if (opt_huge_pages)
+    huge_report();
 
   network = static_cast<unsigned int*>
     (xmalloc(network_alloc * sizeof(unsigned int)));
   network_count = 0;
   network_seq = 0;
 
+  if (opt_threads > 1)
+    network_order = network_schedule();
+
   pthread_mutex_init(&network_mutex, nullptr);
-  progress_init("Building network: ", seqcount);
+  bloom_stats_init(& bloom_total);
+  progress_init("Building network: ", queries->group_count);
 
-  if (opt_threads == 1)
-    {
-      network_thread(0);
-    }
-  else
-    {
-      ThreadRunner * sim_tr = new ThreadRunner(static_cast<int>(opt_threads),
-                                               network_thread);
-      sim_tr->run();
-      delete sim_tr;
-    }
+  threads_run(network_thread);
 
   progress_done();
   pthread_mutex_destroy(&network_mutex);
 
+  if (network_order)
+    {
+      xfree(network_order);
+      network_order = nullptr;
+    }
+
+  if (bloom || fuse)
+    bloom_stats_report(& bloom_total);
+
 
   unsigned int clustercount = 0;
 
@@ -463,13 +711,45 @@ void cluster(char * filename)
   if (iteminfo)
     xfree(iteminfo);
 
-  if (opt_differences <= MAXDIFF_HASH)
+  switch (opt_index_int)
     {
-      bloom_exit(bloom);
+    case index_variants:
+      if (bloom)
+        bloom_exit(bloom);
+      bloom = 0;
+      if (fuse)
+        fuse_exit(fuse);
+      fuse = 0;
       hash_exit(hashtable);
-      zobrist_exit();
+      hashtable = 0;
+      break;
+
+    case index_pigeonhole:
+      pigeonhole_exit(pigeonhole);
+      pigeonhole = 0;
+      break;
+
+    case index_masked:
+      masked_exit(masked);
+      masked = 0;
+      break;
+
+    case index_deletion:
+      deletion_exit(deletions);
+      deletions = 0;
+      break;
+
+    case index_trie:
+      trie_exit(trie);
+      trie = 0;
+      break;
     }
 
+  postings_exit(queries);
+  queries = 0;
+
+  zobrist_exit();
+
   db_free(d);
   db_exit();
 }
@@ -52,6 +52,7 @@ bool opt_cluster;
 bool opt_distance;
 bool opt_existence;
 bool opt_help;
+bool opt_huge_pages;
 bool opt_ignore_counts;
 bool opt_ignore_empty;
 bool opt_ignore_genes;
@@ -60,16 +61,29 @@ bool opt_indels;
 bool opt_matrix;
 bool opt_nucleotides;
 bool opt_no_matrix;
+bool opt_numa;
+bool opt_perfect_hash;
+bool opt_pin_threads;
+bool opt_sparse;
 bool opt_version;
+bool opt_wide_rows;
 bool opt_deduplicate;
 char * opt_keep_columns;
 char * opt_log;
 char * opt_output;
 char * opt_pairs;
 char * opt_score_string;
+char * opt_index_string;
+char * opt_filter_string;
+char * opt_pairs_mode_string;
+double opt_bloom_fpr;
 int64_t opt_differences;
+int64_t opt_filter_int;
+int64_t opt_index_int;
+int64_t opt_pairs_mode_int;
 int64_t opt_score_int;
 int64_t opt_threads;
+int64_t opt_tile;
 
 /* Other variables */
 
@@ -103,7 +117,42 @@ static const char * score_descr[] =
     "Jaccard index"
   };
 
+static const char * index_options[] =
+  { "variants", "pigeonhole", "masked", "deletion", "trie", "join",
+    "partition" };
+
+static const char * index_descr[] =
+  {
+    "Variants",
+    "Pigeonhole segments",
+    "Masked neighbourhood",
+    "Symmetric deletions",
+    "Prefix trie",
+    "Sorted hash join",
+    "Partitioned variants"
+  };
+
+static const char * filter_options[] =
+  { "bloom", "fuse" };
+
+static const char * filter_descr[] =
+  {
+    "Bloom filter",
+    "Binary fuse filter"
+  };
+
+static const char * pairs_mode_options[] =
+  { "unordered", "ordered", "shards" };
+
+static const char * pairs_mode_descr[] =
+  {
+    "",
+    " (ordered)",
+    " (one file per thread)"
+  };
+
 int64_t args_long(char * str, const char * option);
+double args_double(char * str, const char * option);
 void args_show();
 void args_usage();
 void show_header();
@@ -184,6 +233,18 @@ int64_t args_long(char * str, const char * option)
   return temp;
 }
 
+double args_double(char * str, const char * option)
+{
+  char * endptr;
+  double temp = strtod(str, & endptr);
+  if (*endptr)
+    {
+      fprintf(stderr, "\nInvalid numeric argument for option %s\n", option);
+      exit(1);
+    }
+  return temp;
+}
+
 void show_time(const char * prompt)
 {
   const int time_string_max = 100;
@@ -220,6 +281,15 @@ void args_show()
   fprintf(logfile, "Nucleotides (n):   %s\n", opt_nucleotides ? "Yes" : "No");
   fprintf(logfile, "Differences (d):   %" PRId64 "\n", opt_differences);
   fprintf(logfile, "Indels (i):        %s\n", opt_indels ? "Yes" : "No");
+  if (! opt_deduplicate)
+    fprintf(logfile, "Index:             %s%s\n", index_descr[opt_index_int],
+            opt_perfect_hash ? " (perfect hash)" : "");
+  if ((! opt_deduplicate) &&
+      ((opt_index_int == index_variants) || (opt_index_int == index_join)))
+    fprintf(logfile, "Prefilter:         %s\n", filter_descr[opt_filter_int]);
+  if (opt_bloom_fpr > 0.0)
+    fprintf(logfile, "Bloom filter FPR:  %g (k=%u)\n",
+            opt_bloom_fpr, bloom_get_k());
   fprintf(logfile, "Ignore counts (f): %s\n",
           opt_ignore_counts ? "Yes" : "No");
   fprintf(logfile, "Ignore genes (g):  %s\n",
@@ -231,15 +301,21 @@ void args_show()
   fprintf(logfile, "Use cdr3 column:   %s\n",
           opt_cdr3 ? "Yes" : "No");
   fprintf(logfile, "Threads (t):       %" PRId64 "\n", opt_threads);
+  if (opt_tile)
+    fprintf(logfile, "Tile rows:         %" PRId64 "\n", opt_tile);
+  if (opt_pin_threads)
+    fprintf(logfile, "Pin threads:       Yes\n");
   if (opt_no_matrix)
     fprintf(logfile, "Output file (o):   (none)\n");
   else
     fprintf(logfile, "Output file (o):   %s\n", opt_output);
   if (opt_matrix || opt_existence)
     {
-      fprintf(logfile, "Output format (a): %s\n", opt_alternative ? "Column" : "Matrix");
+      fprintf(logfile, "Output format (a): %s\n", opt_alternative ?
+              (opt_sparse ? "Column (sparse)" : "Column") : "Matrix");
       fprintf(logfile, "Score (s):         %s\n", score_descr[opt_score_int]);
-      fprintf(logfile, "Pairs file (p):    %s\n", opt_pairs ? opt_pairs : "(none)");
+      fprintf(logfile, "Pairs file (p):    %s%s\n", opt_pairs ? opt_pairs : "(none)",
+              opt_pairs ? pairs_mode_descr[opt_pairs_mode_int] : "");
       fprintf(logfile, "Keep columns:      %s\n", opt_keep_columns ? opt_keep_columns : "");
     }
   fprintf(logfile, "Log file (l):      %s\n", opt_log ? opt_log : "(stderr)");
@@ -258,15 +334,25 @@ void args_usage()
   fprintf(stderr, " -z, --deduplicate           deduplicate sequences in repertoires\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "General options:\n");
+  fprintf(stderr, "     --bloom-fpr REAL        target Bloom filter false positive rate\n");
   fprintf(stderr, " -d, --differences INTEGER   number of differences accepted (0*)\n");
-  fprintf(stderr, " -i, --indels                allow insertions or deletions when d=1\n");
+  fprintf(stderr, " -i, --indels                allow insertions or deletions\n");
+  fprintf(stderr, "     --index STRING          variants*, join, partition, masked, deletion,\n");
+  fprintf(stderr, "                             pigeonhole, or trie\n");
+  fprintf(stderr, "     --filter STRING         prefilter: bloom* or fuse\n");
   fprintf(stderr, " -f, --ignore-counts         ignore duplicate_count information\n");
   fprintf(stderr, " -g, --ignore-genes          ignore V and J gene information\n");
+  fprintf(stderr, "     --huge-pages            use and populate huge pages for large tables\n");
   fprintf(stderr, " -n, --nucleotides           compare nucleotides, not amino acids\n");
+  fprintf(stderr, "     --numa                  spread tables and threads over NUMA nodes\n");
+  fprintf(stderr, "     --perfect-hash          use a minimal perfect hash for set 2\n");
+  fprintf(stderr, "     --pin-threads           pin each thread to its own CPU\n");
   fprintf(stderr, " -s, --score STRING          MH, Jaccard, product*, ratio, min, max, or mean\n");
   fprintf(stderr, " -t, --threads INTEGER       number of threads to use (1*-256)\n");
+  fprintf(stderr, "     --tile INTEGER          set 1 repertoires per tile of the matrix (all*)\n");
   fprintf(stderr, " -u, --ignore-unknown        ignore sequences with unknown symbols\n");
   fprintf(stderr, " -e, --ignore-empty          ignore empty sequences\n");
+  fprintf(stderr, "     --wide-rows             store row numbers in 64 bits (for testing)\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Input/output options:\n");
   fprintf(stderr, " -a, --alternative           output results in three-column format, not matrix\n");
@@ -277,6 +363,8 @@ void args_usage()
   fprintf(stderr, " -o, --output FILENAME       output results to file (stdout*)\n");
   fprintf(stderr, "     --no-matrix             do not keep or output any matrix\n");
   fprintf(stderr, " -p, --pairs FILENAME        output matching pairs to file (none*)\n");
+  fprintf(stderr, "     --pairs-mode STRING     unordered*, ordered, or shards (file per thread)\n");
+  fprintf(stderr, "     --sparse                output only non-zero results with -a\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "                             * default value\n");
   fprintf(stderr, "\n");
@@ -298,29 +386,43 @@ void args_init(int argc, char **argv)
   input2_filename = nullptr;
 
   opt_alternative = false;
+  opt_bloom_fpr = 0.0;
   opt_cdr3 = false;
   opt_cluster = false;
   opt_deduplicate = false;
   opt_distance = false;
   opt_differences = 0;
   opt_existence = false;
+  opt_filter_int = filter_bloom;
+  opt_filter_string = nullptr;
   opt_help = false;
+  opt_huge_pages = false;
   opt_ignore_counts = false;
   opt_ignore_genes = false;
   opt_ignore_unknown = false;
   opt_ignore_empty = false;
   opt_indels = false;
+  opt_index_int = -1;
+  opt_index_string = nullptr;
   opt_keep_columns = nullptr;
   opt_log = nullptr;
   opt_matrix = false;
   opt_nucleotides = false;
   opt_no_matrix = false;
+  opt_numa = false;
   opt_output = DASH_FILENAME;
   opt_pairs = nullptr;
+  opt_pairs_mode_int = pairs_unordered;
+  opt_pairs_mode_string = nullptr;
+  opt_perfect_hash = false;
+  opt_pin_threads = false;
+  opt_sparse = false;
   opt_score_int = 0;
   opt_score_string = NULL;
   opt_threads = 1;
+  opt_tile = 0;
   opt_version = false;
+  opt_wide_rows = false;
 
   opterr = 1;
 
@@ -331,6 +433,7 @@ void args_init(int argc, char **argv)
   static struct option long_options[] =
   {
     {"alternative",      no_argument,       nullptr, 'a' },
+    {"bloom-fpr",        required_argument, nullptr, 0   },
     {"cdr3",             no_argument,       nullptr, 0   },
     {"cluster",          no_argument,       nullptr, 'c' },
     {"differences",      required_argument, nullptr, 'd' },
@@ -339,20 +442,30 @@ void args_init(int argc, char **argv)
     {"ignore-counts",    no_argument,       nullptr, 'f' },
     {"ignore-genes",     no_argument,       nullptr, 'g' },
     {"help",             no_argument,       nullptr, 'h' },
+    {"huge-pages",       no_argument,       nullptr, 0   },
     {"indels",           no_argument,       nullptr, 'i' },
+    {"index",            required_argument, nullptr, 0   },
     {"keep-columns",     required_argument, nullptr, 'k' },
     {"log",              required_argument, nullptr, 'l' },
     {"matrix",           no_argument,       nullptr, 'm' },
     {"nucleotides",      no_argument,       nullptr, 'n' },
     {"no-matrix",        no_argument,       nullptr, 0   },
+    {"numa",             no_argument,       nullptr, 0   },
     {"output",           required_argument, nullptr, 'o' },
     {"pairs",            required_argument, nullptr, 'p' },
+    {"pairs-mode",       required_argument, nullptr, 0   },
+    {"perfect-hash",     no_argument,       nullptr, 0   },
+    {"pin-threads",      no_argument,       nullptr, 0   },
     {"score",            required_argument, nullptr, 's' },
+    {"sparse",           no_argument,       nullptr, 0   },
     {"summands",         required_argument, nullptr, 's' },
     {"threads",          required_argument, nullptr, 't' },
+    {"tile",             required_argument, nullptr, 0   },
     {"ignore-unknown",   no_argument,       nullptr, 'u' },
     {"version",          no_argument,       nullptr, 'v' },
+    {"wide-rows",        no_argument,       nullptr, 0   },
     {"existence",        no_argument,       nullptr, 'x' },
+    {"filter",           required_argument, nullptr, 0   },
     {"deduplicate",      no_argument,       nullptr, 'z' },
     {nullptr,            0,                 nullptr, 0   }
   };
@@ -360,6 +473,7 @@ void args_init(int argc, char **argv)
   enum
     {
       option_alternative,
+      option_bloom_fpr,
       option_cdr3,
       option_cluster,
       option_differences,
@@ -368,20 +482,30 @@ void args_init(int argc, char **argv)
       option_ignore_counts,
       option_ignore_genes,
       option_help,
+      option_huge_pages,
       option_indels,
+      option_index_type,
       option_keep_columns,
       option_log,
       option_matrix,
       option_nucleotides,
       option_no_matrix,
+      option_numa,
       option_output,
       option_pairs,
+      option_pairs_mode,
+      option_perfect_hash,
+      option_pin_threads,
       option_score,
+      option_sparse,
       option_summands,
       option_threads,
+      option_tile,
       option_ignore_unknown,
       option_version,
+      option_wide_rows,
       option_existence,
+      option_filter,
       option_deduplicate
     };
 
@@ -529,6 +653,11 @@ void args_init(int argc, char **argv)
 
         switch (option_index)
           {
+          case option_bloom_fpr:
+            /* bloom-fpr */
+            opt_bloom_fpr = args_double(optarg, "--bloom-fpr");
+            break;
+
           case option_cdr3:
             /* cdr3 */
             opt_cdr3 = true;
@@ -539,11 +668,61 @@ void args_init(int argc, char **argv)
             opt_distance = true;
             break;
 
+          case option_filter:
+            /* filter */
+            opt_filter_string = optarg;
+            break;
+
+          case option_huge_pages:
+            /* huge_pages */
+            opt_huge_pages = true;
+            break;
+
+          case option_index_type:
+            /* index */
+            opt_index_string = optarg;
+            break;
+
           case option_no_matrix:
             /* no_matrix */
             opt_no_matrix = true;
             break;
 
+          case option_numa:
+            /* numa */
+            opt_numa = true;
+            break;
+
+          case option_pairs_mode:
+            /* pairs_mode */
+            opt_pairs_mode_string = optarg;
+            break;
+
+          case option_perfect_hash:
+            /* perfect_hash */
+            opt_perfect_hash = true;
+            break;
+
+          case option_pin_threads:
+            /* pin_threads */
+            opt_pin_threads = true;
+            break;
+
+          case option_sparse:
+            /* sparse */
+            opt_sparse = true;
+            break;
+
+          case option_tile:
+            /* tile */
+            opt_tile = args_long(optarg, "--tile");
+            break;
+
+          case option_wide_rows:
+            /* wide_rows */
+            opt_wide_rows = true;
+            break;
+
           default:
             show_header();
             args_usage();
@@ -616,6 +795,8 @@ void args_init(int argc, char **argv)
         fatal("Option -d or --differences must be 0 for deduplication.");
       if (opt_indels)
         fatal("Option -i or --indels is not allowed for deduplication.");
+      if (opt_index_string)
+        fatal("Option --index is not allowed for deduplication.");
     }
 
   if (opt_keep_columns)
@@ -636,8 +817,8 @@ void args_init(int argc, char **argv)
   if (opt_differences < 0)
     fatal("Differences specified with -d or -differences cannot be negative.");
 
-  if (opt_indels && (opt_differences != 1))
-    fatal("Indels are only allowed when d=1");
+  if (opt_indels && (opt_differences < 1))
+    fatal("Indels are only allowed when d>0");
 
   if (opt_cluster)
     {
@@ -664,6 +845,132 @@ void args_init(int argc, char **argv)
         }
     }
 
+  if (opt_index_string)
+    {
+      for(int i = 0; i < index_end; i++)
+        if (strcasecmp(opt_index_string, index_options[i]) == 0)
+          {
+            opt_index_int = i;
+            break;
+          }
+      if (opt_index_int < 0)
+        fatal("Argument to --index must be variants, join, partition, pigeonhole, masked, deletion or trie");
+    }
+  else if (opt_indels && (opt_differences > MAXDIFF_HASH))
+    opt_index_int = index_trie;
+  else if (opt_indels && (opt_differences > 1))
+    opt_index_int = index_deletion;
+  else if (opt_differences <= MAXDIFF_HASH)
+    opt_index_int = index_variants;
+  else
+    opt_index_int = index_pigeonhole;
+
+  if ((opt_index_int == index_variants) && (opt_differences > MAXDIFF_HASH))
+    fatal("The variants index is only allowed when d<=2");
+
+  if ((opt_index_int == index_join) && (opt_differences > MAXDIFF_HASH))
+    fatal("The join index is only allowed when d<=2");
+
+  if ((opt_index_int == index_join) && ! (opt_matrix || opt_existence))
+    fatal("The join index is only allowed with -m or -x");
+
+  if ((opt_index_int == index_partition) && (opt_differences > MAXDIFF_HASH))
+    fatal("The partition index is only allowed when d<=2");
+
+  if ((opt_index_int == index_partition) && ! (opt_matrix || opt_existence))
+    fatal("The partition index is only allowed with -m or -x");
+
+  if ((opt_index_int == index_masked) && (opt_differences > MAXDIFF_HASH))
+    fatal("The masked index is only allowed when d<=2");
+
+  if ((opt_index_int == index_deletion) && (opt_differences > MAXDIFF_HASH))
+    fatal("The deletion index is only allowed when d<=2");
+
+  if (opt_perfect_hash)
+    {
+      if (! (opt_matrix || opt_existence))
+        fatal("Option --perfect-hash is only allowed with -m or -x");
+      if (opt_index_int != index_variants)
+        fatal("Option --perfect-hash is only allowed with the variants index");
+    }
+
+  if (opt_tile)
+    {
+      if (opt_tile < 0)
+        fatal("The number of repertoires per tile given with --tile cannot be negative.");
+      if (! opt_matrix)
+        fatal("Option --tile is only allowed with -m or --matrix");
+      if (opt_index_int == index_partition)
+        fatal("Option --tile is not allowed with the partition index");
+    }
+
+  if (opt_sparse)
+    {
+      if (! (opt_matrix || opt_existence))
+        fatal("Option --sparse is only allowed with -m or -x");
+      if (! opt_alternative)
+        fatal("Option --sparse is only allowed with -a or --alternative");
+      if (opt_no_matrix)
+        fatal("Option --sparse is not allowed with --no-matrix");
+    }
+
+  if (opt_filter_string)
+    {
+      opt_filter_int = -1;
+      for(int i = 0; i < filter_end; i++)
+        if (strcasecmp(opt_filter_string, filter_options[i]) == 0)
+          {
+            opt_filter_int = i;
+            break;
+          }
+      if (opt_filter_int < 0)
+        fatal("Argument to --filter must be bloom or fuse");
+      if (opt_deduplicate)
+        fatal("Option --filter is not allowed for deduplication.");
+      if ((opt_index_int != index_variants) && (opt_index_int != index_join))
+        fatal("Option --filter is only allowed with the variants or join index");
+    }
+
+  if (opt_pairs_mode_string)
+    {
+      opt_pairs_mode_int = -1;
+      for(int i = 0; i < pairs_end; i++)
+        if (strcasecmp(opt_pairs_mode_string, pairs_mode_options[i]) == 0)
+          {
+            opt_pairs_mode_int = i;
+            break;
+          }
+      if (opt_pairs_mode_int < 0)
+        fatal("Argument to --pairs-mode must be unordered, ordered or shards");
+      if (! opt_pairs)
+        fatal("Option --pairs-mode is only allowed with -p or --pairs");
+      if ((opt_pairs_mode_int == pairs_shards) &&
+          (strcmp(opt_pairs, DASH_FILENAME) == 0))
+        fatal("Pairs cannot be written to stdout with --pairs-mode shards");
+    }
+
+  if (opt_bloom_fpr != 0.0)
+    {
+      if ((opt_bloom_fpr <= 0.0) || (opt_bloom_fpr >= 1.0))
+        fatal("Option --bloom-fpr must be above 0 and below 1");
+      if (opt_deduplicate)
+        fatal("Option --bloom-fpr is not allowed for deduplication.");
+      if (opt_filter_int != filter_bloom)
+        fatal("Option --bloom-fpr is only allowed with the Bloom filter");
+      bloom_configure(opt_bloom_fpr);
+    }
+
+  if (opt_indels)
+    {
+      if (((opt_index_int == index_variants) ||
+           (opt_index_int == index_join) ||
+           (opt_index_int == index_partition)) && (opt_differences > 1))
+        fatal("Indels are only allowed with the variants, join or partition index when d=1");
+      if ((opt_index_int == index_masked) ||
+          (opt_index_int == index_pigeonhole))
+        fatal("Indels are only allowed with the variants, join, partition, deletion or trie index");
+    }
+
   if (! opt_matrix)
     {
       if (opt_score_int == score_mh)
@@ -720,7 +1027,9 @@ void open_files()
   if (! outfile)
     fatal("Unable to open output file for writing.");
 
-  if (opt_pairs)
+  /* with shards, the pairs files are opened later, one per thread */
+
+  if (opt_pairs && (opt_pairs_mode_int != pairs_shards))
     {
       pairsfile = fopen_output(opt_pairs);
       if (! pairsfile)
@@ -765,8 +1074,12 @@ int main(int argc, char** argv)
 
   args_show();
 
+  numa_init(opt_numa);
+
   fprintf(logfile, "\n");
 
+  threads_init(opt_threads, opt_pin_threads || opt_numa);
+
   if (opt_matrix || opt_existence)
     overlap(input1_filename, input2_filename);
   else if (opt_deduplicate)
@@ -774,6 +1087,10 @@ int main(int argc, char** argv)
   else
     cluster(input1_filename);
 
+  threads_exit();
+
+  numa_exit();
+
   show_time("End time:          ");
 
   if (keep_columns_no)
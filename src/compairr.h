@@ -53,6 +53,7 @@
 #include <sys/stat.h>
 
 #include <chrono>
+#include <functional>
 #include <string>
 #include <vector>
 #include <map>
@@ -66,6 +67,7 @@
 #else
 #include <sys/resource.h>
 #include <sys/sysinfo.h>
+#include <sys/mman.h>
 #endif
 
 #ifdef __aarch64__
@@ -82,6 +84,10 @@
 #include <tmmintrin.h>
 #endif
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #define CAST_m128i_ptr(x) (reinterpret_cast<__m128i*>(x))
 
 #elif defined __PPC__
@@ -134,6 +140,33 @@ enum
     score_end
   };
 
+enum
+  {
+    index_variants,
+    index_pigeonhole,
+    index_masked,
+    index_deletion,
+    index_trie,
+    index_join,
+    index_partition,
+    index_end
+  };
+
+enum
+  {
+    filter_bloom,
+    filter_fuse,
+    filter_end
+  };
+
+enum
+  {
+    pairs_unordered,
+    pairs_ordered,
+    pairs_shards,
+    pairs_end
+  };
+
 /* common data */
 
 extern bool opt_alternative;
@@ -142,6 +175,7 @@ extern bool opt_cdr3;
 extern bool opt_distance;
 extern bool opt_existence;
 extern bool opt_help;
+extern bool opt_huge_pages;
 extern bool opt_ignore_counts;
 extern bool opt_ignore_genes;
 extern bool opt_ignore_unknown;
@@ -150,16 +184,29 @@ extern bool opt_indels;
 extern bool opt_matrix;
 extern bool opt_nucleotides;
 extern bool opt_no_matrix;
+extern bool opt_numa;
+extern bool opt_perfect_hash;
+extern bool opt_pin_threads;
+extern bool opt_sparse;
 extern bool opt_version;
+extern bool opt_wide_rows;
 extern bool opt_deduplicate;
 extern char * opt_keep_columns;
 extern char * opt_log;
 extern char * opt_output_file;
 extern char * opt_pairs;
 extern char * opt_score_string;
+extern char * opt_index_string;
+extern char * opt_filter_string;
+extern char * opt_pairs_mode_string;
+extern double opt_bloom_fpr;
 extern int64_t opt_differences;
+extern int64_t opt_filter_int;
+extern int64_t opt_index_int;
+extern int64_t opt_pairs_mode_int;
 extern int64_t opt_score_int;
 extern int64_t opt_threads;
+extern int64_t opt_tile;
 
 extern const char * seq_header;
 
@@ -179,9 +226,22 @@ extern char ** keep_columns_strings;
 #include "bloompat.h"
 #include "cluster.h"
 #include "db.h"
+#include "deletion.h"
+#include "fuse.h"
 #include "hashtable.h"
+#include "join.h"
+#include "masked.h"
+#include "mphf.h"
+#include "multimap.h"
+#include "numa.h"
 #include "overlap.h"
+#include "partition.h"
+#include "pigeonhole.h"
+#include "postings.h"
+#include "sparse.h"
 #include "threads.h"
+#include "trie.h"
 #include "variants.h"
+#include "writer.h"
 #include "zobrist.h"
 #include "dedup.h"
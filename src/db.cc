@@ -99,6 +99,7 @@ struct db
   char * residues_p;
   uint64_t residues_alloc;
   uint64_t residues_count;
+  char * rendered_p;
   uint64_t total_duplicate_count;
   uint64_t repertoire_count;
   uint64_t ignored_unknown;
@@ -152,6 +153,7 @@ struct db * db_create()
   d->residues_p = nullptr;
   d->residues_alloc = 0;
   d->residues_count = 0;
+  d->rendered_p = nullptr;
   d->total_duplicate_count = 0;
   d->repertoire_count = 0;
   d->repertoire_id_vector.clear();
@@ -886,6 +888,13 @@ void db_read(struct db * d,
               d->total_duplicate_count);
     }
 
+  /* the sequences are read by all threads, spread them over the nodes */
+
+  numa_interleave(d->seqindex, d->sequences * sizeof(seqinfo_s), true);
+  numa_interleave(d->residues_p, d->residues_count, true);
+  huge_advise(d->seqindex, d->sequences * sizeof(seqinfo_s));
+  huge_advise(d->residues_p, d->residues_count);
+
   /* add sequence pointers to index table */
 
   progress_init("Indexing:         ", d->sequences);
@@ -902,16 +911,23 @@ void db_read(struct db * d,
 
 void db_hash(struct db * d)
 {
+  /* the sequences are hashed in parallel, thread 0 shows the progress */
+
   progress_init("Computing hashes: ", d->sequences);
-  for(uint64_t i = 0; i < d->sequences; i++)
-    {
-      seqinfo_s * p = d->seqindex + i;
-      d->seqindex[i].hash = zobrist_hash((unsigned char *)(p->seq),
-                                         p->seqlen,
-                                         p->v_gene_no,
-                                         p->j_gene_no);
-      progress_update(i+1);
-    }
+  threads_parallel_for(0, d->sequences, 16384,
+                       [d](int64_t t, uint64_t first, uint64_t last)
+                       {
+                         for (uint64_t i = first; i < last; i++)
+                           {
+                             seqinfo_s * p = d->seqindex + i;
+                             p->hash = zobrist_hash((unsigned char *)(p->seq),
+                                                    p->seqlen,
+                                                    p->v_gene_no,
+                                                    p->j_gene_no);
+                           }
+                         if (t == 0)
+                           progress_update(last);
+                       });
   progress_done();
 }
 
@@ -919,6 +935,8 @@ void db_free(struct db * d)
 {
   if (d->residues_p)
     xfree(d->residues_p);
+  if (d->rendered_p)
+    xfree(d->rendered_p);
   if (d->seqindex)
     {
       for (uint64_t i = 0; i < d->sequences; i++)
@@ -1048,6 +1066,36 @@ void db_fprint_sequence(FILE * f, struct db * d, uint64_t seqno)
     }
 }
 
+void db_render(struct db * d)
+{
+  /*
+    Convert all sequences to their symbols once, in parallel, so that
+    they can be copied directly to the output. They are stored at the
+    same offsets as the residues.
+  */
+
+  if (d->rendered_p)
+    return;
+
+  d->rendered_p = static_cast<char *>(xmalloc(MAX(d->residues_count, 1)));
+
+  const char * chars = opt_nucleotides ? nt_chars : aa_chars;
+
+  threads_parallel_for(0, d->residues_count, 0,
+                       [d, chars](int64_t t, uint64_t first, uint64_t last)
+                       {
+                         (void) t;
+                         for (uint64_t i = first; i < last; i++)
+                           d->rendered_p[i] =
+                             chars[static_cast<int>(d->residues_p[i])];
+                       });
+}
+
+const char * db_get_rendered_sequence(struct db * d, uint64_t seqno)
+{
+  return d->rendered_p + (d->seqindex[seqno].seq - d->residues_p);
+}
+
 char * db_get_keep_columns(struct db * d, uint64_t seqno)
 {
   char * keep = d->seqindex[seqno].keep;
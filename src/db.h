@@ -78,4 +78,8 @@ const char * db_get_j_gene_name(struct db * d, uint64_t seqno);
 
 void db_fprint_sequence(FILE * f, struct db * d, uint64_t seqno);
 
+void db_render(struct db * d);
+
+const char * db_get_rendered_sequence(struct db * d, uint64_t seqno);
+
 char * db_get_keep_columns(struct db * d, uint64_t seqno);
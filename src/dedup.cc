@@ -21,23 +21,37 @@
 
 #include "compairr.h"
 
-const uint64_t terminal = -1;
-const uint64_t done = -2;
+/*
+  The sequences with the same hash are chained through next_seq, with
+  32-bit row numbers whenever there are few enough sequences. The two
+  largest values of row_t mark the end of a chain and reported rows.
+*/
+
+template <typename row_t>
+struct chain_s
+{
+  static const row_t terminal = static_cast<row_t>(-1);
+  static const row_t done = static_cast<row_t>(-2);
+};
 
+template <typename row_t>
 static void report(struct db * d,
                    uint64_t seed,
-                   uint64_t * next_seq)
+                   row_t * next_seq)
 {
+  const row_t terminal = chain_s<row_t>::terminal;
+  const row_t done = chain_s<row_t>::done;
+
   if (next_seq[seed] == done)
     return;
 
   uint64_t count = opt_ignore_counts ? 1 : db_get_count(d, seed);
-  uint64_t link = next_seq[seed];
+  row_t link = next_seq[seed];
   next_seq[seed] = done;
   while (link != terminal)
     {
       count += opt_ignore_counts ? 1 : db_get_count(d, link);
-      uint64_t temp = next_seq[link];
+      row_t temp = next_seq[link];
       next_seq[link] = done;
       link = temp;
     }
@@ -57,78 +71,81 @@ static void report(struct db * d,
 }
 
 
-static bool process(struct db * d,
-                    hashtable_s * ht,
-                    struct bloom_s * b,
-                    uint64_t seed,
-                    uint64_t * next_seq)
+template <typename row_t>
+static void link_duplicates(struct db * d,
+                            struct postings_s * pl,
+                            row_t * next_seq)
 {
-  unsigned int seed_rep_id_no = db_get_repertoire_id_no(d, seed);
-  uint64_t seed_v_gene = db_get_v_gene(d, seed);
-  uint64_t seed_j_gene = db_get_j_gene(d, seed);
-  unsigned char * seed_sequence
-    = (unsigned char *) db_getsequence(d, seed);
-  unsigned int seed_seqlen
-    = db_getsequencelen(d, seed);
-
-  uint64_t last = terminal;
-
-  /* find the first empty bucket */
-  uint64_t hash = db_gethash(d, seed);
-  uint64_t j = hash_getindex(ht, hash);
-  while (hash_is_occupied(ht, j))
+  /*
+    Link each sequence to the next identical sequence in the same
+    repertoire, using the groups of identical sequences.
+  */
+
+  const uint64_t none = -1;
+
+  uint64_t repertoires = db_get_repertoire_count(d);
+  uint64_t * last_group = static_cast<uint64_t *>
+    (xmalloc(MAX(repertoires, 1) * sizeof(uint64_t)));
+  uint64_t * last_seq = static_cast<uint64_t *>
+    (xmalloc(MAX(repertoires, 1) * sizeof(uint64_t)));
+  for (uint64_t r = 0; r < repertoires; r++)
+    last_group[r] = none;
+
+  progress_init("Deduplicating:    ", pl->group_count);
+  for (uint64_t g = 0; g < pl->group_count; g++)
     {
-#if 1
-      if (((b == nullptr) || bloom_get(b, hash)) &&
-          (hash_compare_value(ht, j, hash)))
-#else
-      if (hash_compare_value(ht, j, hash))
-#endif
+      for (uint64_t k = postings_get_first(pl, g);
+           k < postings_get_last(pl, g); k++)
         {
-          uint64_t hit = hash_get_data(ht, j);
-
-          /* check repertoire id match */
-          unsigned int hit_rep_id_no = db_get_repertoire_id_no(d, hit);
-
-          if (seed_rep_id_no == hit_rep_id_no)
-            {
-              /* double check that everything matches */
-              unsigned int hit_v_gene = db_get_v_gene(d, hit);
-              unsigned int hit_j_gene = db_get_j_gene(d, hit);
-
-              if (opt_ignore_genes ||
-                  ((seed_v_gene == hit_v_gene) && (seed_j_gene == hit_j_gene)))
-                {
-                  unsigned char * hit_sequence
-                    = (unsigned char *) db_getsequence(d, hit);
-                  unsigned int hit_seqlen
-                    = db_getsequencelen(d, hit);
-
-                  if ((seed_seqlen == hit_seqlen) &&
-                      ! memcmp(seed_sequence, hit_sequence, seed_seqlen))
-                    {
-                      last = hit;
-                    }
-                }
-            }
+          struct posting_s p = postings_get(pl, k);
+          if (last_group[p.repertoire] == g)
+            next_seq[last_seq[p.repertoire]] = static_cast<row_t>(p.seq);
+          else
+            last_group[p.repertoire] = g;
+          last_seq[p.repertoire] = p.seq;
         }
-      j = hash_getnextindex(ht, j);
+      progress_update(g);
     }
+  progress_done();
+
+  xfree(last_seq);
+  xfree(last_group);
+}
+
+template <typename row_t>
+static void dedup_rows(struct db * d1,
+                       struct postings_s * pl,
+                       uint64_t duplicates)
+{
+  uint64_t sequences = db_getsequencecount(d1);
+
+  /* alloc and init array of links between identical sequences */
+
+  row_t * next_seq = static_cast<row_t *>
+    (xmalloc(MAX(sequences, 1) * sizeof(row_t)));
+  for (uint64_t i = 0; i < sequences; i++)
+    next_seq[i] = chain_s<row_t>::terminal;
+
+  fprintf(outfile, "repertoire_id");
+  fprintf(outfile, "\tduplicate_count");
+  if (! opt_ignore_genes)
+    fprintf(outfile, "\tv_call\tj_call");
+  fprintf(outfile, "\t%s\n", seq_header);
 
-  hash_set_occupied(ht, j);
-  hash_set_value(ht, j, hash);
-  hash_set_data(ht, j, seed);
+  link_duplicates(d1, pl, next_seq);
+  postings_exit(pl);
 
-  if (b)
-    bloom_set(b, hash);
+  fprintf(logfile, "Duplicates merged: %" PRIu64 "\n", duplicates);
 
-  if (last != terminal)
+  progress_init("Writing output:   ", sequences);
+  for(uint64_t i=0; i < sequences; i++)
     {
-      next_seq[last] = seed;
-      return true;
+      report(d1, i, next_seq);
+      progress_update(i);
     }
-  else
-    return false;
+  progress_done();
+
+  xfree(next_seq);
 }
 
 void dedup(char * filename)
@@ -159,55 +176,20 @@ void dedup(char * filename)
 
   db_hash(d1);
 
-  /* store sequences in a hash table */
-  /* use an additional bloom filter for increased speed */
-  /* hashing into hash table & bloom filter */
-
-  /* alloc and init array of flags indicating processed sequences */
-
-  uint64_t * next_seq = (uint64_t *) xmalloc(sequences * sizeof(uint64_t));
-  for (uint64_t i = 0; i < sequences; i++)
-    next_seq[i] = terminal;
-
-  uint64_t dup_seq = 0;
-
-  hashtable_s * hashtable = hash_init(sequences);
-  struct bloom_s * bloom = bloom_init(hash_get_tablesize(hashtable));
-
-  fprintf(outfile, "repertoire_id");
-  fprintf(outfile, "\tduplicate_count");
-  if (! opt_ignore_genes)
-    fprintf(outfile, "\tv_call\tj_call");
-  fprintf(outfile, "\t%s\n", seq_header);
+  /* group identical sequences in parallel */
 
-  progress_init("Deduplicating:    ", sequences);
-  for(uint64_t i=0; i < sequences; i++)
-    {
-      if (process(d1, hashtable, bloom, i, next_seq))
-        dup_seq++;
-      progress_update(i);
-    }
-  progress_done();
+  uint64_t duplicates = 0;
+  struct postings_s * pl = postings_init(d1, & duplicates);
 
-  fprintf(logfile, "Duplicates merged: %" PRIu64 "\n", dup_seq);
+  /* use 32-bit row numbers in the chains whenever possible */
 
-  progress_init("Writing output:   ", sequences);
-  for(uint64_t i=0; i < sequences; i++)
-    {
-      report(d1, i, next_seq);
-      progress_update(i);
-    }
-  progress_done();
+  if (rows_fit_32(sequences))
+    dedup_rows<uint32_t>(d1, pl, duplicates);
+  else
+    dedup_rows<uint64_t>(d1, pl, duplicates);
 
   fprintf(logfile, "\n");
 
-  bloom_exit(bloom);
-  hash_exit(hashtable);
-  hashtable = nullptr;
-
-  xfree(next_seq);
-  next_seq = nullptr;
-
   zobrist_exit();
 
   db_free(d1);
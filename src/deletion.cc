@@ -0,0 +1,267 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  The symmetric deletion strategy is described in
+
+  Garbe W (2012)
+  1000x Faster Spelling Correction algorithm
+  https://seekstorm.com/blog/1000x-spelling-correction/
+*/
+
+#include "compairr.h"
+
+#include <algorithm>
+
+struct deletion_s
+{
+  struct db * d;
+  struct multimap_s * mm;
+};
+
+static const uint64_t stack_keys = 2048;
+
+static uint64_t deletion_count(unsigned int len)
+{
+  /* maximum number of keys generated for a sequence of length len */
+
+  uint64_t count = 1;
+  if (opt_differences >= 1)
+    count += len;
+  if (opt_differences >= 2)
+    count += static_cast<uint64_t>(len) * (len - 1) / 2;
+  return count;
+}
+
+static inline unsigned char residue_after_deletion(unsigned char * seq,
+                                                   unsigned int del,
+                                                   unsigned int pos)
+{
+  /* residue in position pos of seq after deleting position del */
+  return pos < del ? seq[pos] : seq[pos + 1];
+}
+
+static uint64_t deletion_keys(unsigned char * seq,
+                              unsigned int len,
+                              int v_gene,
+                              int j_gene,
+                              uint64_t * keys)
+{
+  /*
+    Compute the hashes of the sequence itself and of all sequences
+    with one (d>=1) or two (d>=2) residues deleted. The keys array
+    must have room for deletion_count(len) values. Returns the number
+    of keys.
+  */
+
+  uint64_t count = 0;
+
+  keys[count++] = zobrist_hash(seq, len, v_gene, j_gene);
+
+  if ((opt_differences < 1) || (len == 0))
+    return count;
+
+  uint64_t genes = zobrist_hash_segment(seq, 0, 0, v_gene, j_gene);
+
+  /* single deletions, moving the deleted position to the right */
+
+  uint64_t hash = zobrist_hash_delete_first(seq, len, v_gene, j_gene);
+  for (unsigned int p = 0; p < len; p++)
+    {
+      if (p > 0)
+        hash ^= zobrist_value(p - 1, seq[p]) ^ zobrist_value(p - 1, seq[p - 1]);
+
+      keys[count++] = hash;
+
+      if ((opt_differences < 2) || (len < 2))
+        continue;
+
+      /*
+        double deletions: delete position p, then position q >= p of
+        the shorter sequence (i.e. position q + 1 of the original)
+      */
+
+      uint64_t hash2 = genes;
+      for (unsigned int r = 0; r < p; r++)
+        hash2 ^= zobrist_value(r, seq[r]);
+      for (unsigned int r = p + 1; r < len - 1; r++)
+        hash2 ^= zobrist_value(r - 1, residue_after_deletion(seq, p, r));
+
+      for (unsigned int q = p; q < len - 1; q++)
+        {
+          if (q > p)
+            hash2 ^= zobrist_value(q - 1, residue_after_deletion(seq, p, q))
+              ^ zobrist_value(q - 1, residue_after_deletion(seq, p, q - 1));
+          keys[count++] = hash2;
+        }
+    }
+
+  return count;
+}
+
+struct deletion_s * deletion_init(struct db * d)
+{
+  /* Index the sequences in d by their deletion neighbourhoods. */
+
+  struct deletion_s * dl = static_cast<struct deletion_s *>
+    (xmalloc(sizeof(struct deletion_s)));
+
+  dl->d = d;
+
+  uint64_t sequences = db_getsequencecount(d);
+
+  uint64_t entry_count = 0;
+  for (uint64_t i = 0; i < sequences; i++)
+    entry_count += deletion_count(db_getsequencelen(d, i));
+
+  struct multimap_entry_s * entries = static_cast<struct multimap_entry_s *>
+    (xmalloc(entry_count * sizeof(struct multimap_entry_s)));
+
+  uint64_t * keys = static_cast<uint64_t *>
+    (xmalloc(deletion_count(db_getlongestsequence(d)) * sizeof(uint64_t)));
+
+  uint64_t k = 0;
+  progress_init("Deleting residues:", sequences);
+  for (uint64_t i = 0; i < sequences; i++)
+    {
+      uint64_t count = deletion_keys((unsigned char *) db_getsequence(d, i),
+                                     db_getsequencelen(d, i),
+                                     db_get_v_gene(d, i),
+                                     db_get_j_gene(d, i),
+                                     keys);
+      for (uint64_t x = 0; x < count; x++)
+        {
+          entries[k].key = keys[x];
+          entries[k].seq = i;
+          k++;
+        }
+      progress_update(i);
+    }
+  progress_done();
+
+  xfree(keys);
+
+  dl->mm = multimap_init(entries, k);
+
+  return dl;
+}
+
+void deletion_exit(struct deletion_s * dl)
+{
+  multimap_exit(dl->mm);
+  xfree(dl);
+}
+
+void deletion_search(struct deletion_s * dl,
+                     struct db * d,
+                     uint64_t seed,
+                     const uint64_t * group_first,
+                     uint64_t * * hits_data,
+                     uint64_t * hits_count,
+                     uint64_t * hits_alloc)
+{
+  /*
+    Find all sequences in the index within opt_differences of
+    sequence seed in d. The candidates are collected after the
+    existing hits, sorted, deduplicated and verified in place. If
+    group_first is given, sequences whose group starts before seed
+    are not candidates.
+  */
+
+  unsigned char * seed_sequence = (unsigned char *) db_getsequence(d, seed);
+  unsigned int seed_seqlen = db_getsequencelen(d, seed);
+  uint64_t seed_v_gene = db_get_v_gene(d, seed);
+  uint64_t seed_j_gene = db_get_j_gene(d, seed);
+
+  uint64_t stack_array[stack_keys];
+  uint64_t * keys = stack_array;
+  uint64_t max_keys = deletion_count(seed_seqlen);
+  if (max_keys > stack_keys)
+    keys = static_cast<uint64_t *>(xmalloc(max_keys * sizeof(uint64_t)));
+
+  uint64_t key_count = deletion_keys(seed_sequence, seed_seqlen,
+                                     seed_v_gene, seed_j_gene, keys);
+
+  /* collect candidates */
+
+  uint64_t first_candidate = *hits_count;
+  uint64_t candidates_end = first_candidate;
+
+  for (uint64_t x = 0; x < key_count; x++)
+    {
+      uint64_t first;
+      if (! multimap_find(dl->mm, keys[x], & first))
+        continue;
+
+      for (uint64_t k = first; multimap_match(dl->mm, k, keys[x]); k++)
+        {
+          if (group_first && (group_first[multimap_get_seq(dl->mm, k)] < seed))
+            continue;
+          if (*hits_alloc <= candidates_end)
+            {
+              *hits_alloc += 1024;
+              *hits_data = static_cast<uint64_t *>
+                (xrealloc((*hits_data),
+                          (*hits_alloc) * sizeof(uint64_t)));
+            }
+          (*hits_data)[candidates_end++] = multimap_get_seq(dl->mm, k);
+        }
+    }
+
+  if (keys != stack_array)
+    xfree(keys);
+
+  /* sort and verify unique candidates */
+
+  uint64_t * candidates = *hits_data;
+  std::sort(candidates + first_candidate, candidates + candidates_end);
+
+  for (uint64_t c = first_candidate; c < candidates_end; c++)
+    {
+      uint64_t hit = candidates[c];
+
+      if ((c > first_candidate) && (hit == candidates[c - 1]))
+        continue;
+
+      /* double check that everything matches */
+
+      if ((! opt_ignore_genes) &&
+          ((db_get_v_gene(dl->d, hit) != seed_v_gene) ||
+           (db_get_j_gene(dl->d, hit) != seed_j_gene)))
+        continue;
+
+      unsigned char * hit_sequence
+        = (unsigned char *) db_getsequence(dl->d, hit);
+      unsigned int hit_seqlen = db_getsequencelen(dl->d, hit);
+
+      int64_t diff;
+      if (opt_indels)
+        diff = seq_edit_diff(seed_sequence, seed_seqlen,
+                             hit_sequence, hit_seqlen);
+      else if (seed_seqlen == hit_seqlen)
+        diff = seq_diff(seed_sequence, hit_sequence, seed_seqlen);
+      else
+        continue;
+
+      if (diff <= opt_differences)
+        candidates[(*hits_count)++] = hit;
+    }
+}
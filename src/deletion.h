@@ -0,0 +1,46 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Symmetric-deletion index for d=1 and d=2, with or without indels.
+
+  Each sequence is stored under the hashes of all the sequences that
+  can be obtained by deleting up to d of its residues. A query
+  sequence generates its own deletion neighbourhood in the same way.
+  Two sequences within an edit distance of d will have at least one
+  such hash in common. Candidates are verified by computing the
+  Hamming distance, or the banded edit distance when indels are
+  allowed.
+*/
+
+struct deletion_s;
+
+struct deletion_s * deletion_init(struct db * d);
+
+void deletion_exit(struct deletion_s * dl);
+
+void deletion_search(struct deletion_s * dl,
+                     struct db * d,
+                     uint64_t seed,
+                     const uint64_t * group_first,
+                     uint64_t * * hits_data,
+                     uint64_t * hits_count,
+                     uint64_t * hits_alloc);
@@ -0,0 +1,246 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+const unsigned int fuse_max_iterations = 100;
+
+static uint64_t fuse_next_seed(uint64_t seed)
+{
+  /* splitmix64 step */
+
+  uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static int compare_keys(const void * a, const void * b)
+{
+  uint64_t x = * static_cast<const uint64_t *>(a);
+  uint64_t y = * static_cast<const uint64_t *>(b);
+  if (x < y)
+    return -1;
+  if (x > y)
+    return +1;
+  return 0;
+}
+
+static void fuse_dimensions(struct fuse_s * f, uint64_t count)
+{
+  /* segment length and count for the given number of keys */
+
+  double n = MAX(count, 2);
+
+  f->segment_length = 1ULL << static_cast<int>(floor(log(n) / log(3.33) + 2.25));
+  if (f->segment_length > 262144)
+    f->segment_length = 262144;
+  f->segment_mask = f->segment_length - 1;
+
+  double size_factor = MAX(1.125, 0.875 + 0.25 * log(1000000.0) / log(n));
+  uint64_t capacity = count > 1 ? static_cast<uint64_t>(round(n * size_factor)) : 0;
+  uint64_t segments
+    = (capacity + f->segment_length - 1) / f->segment_length;
+
+  f->segment_count = segments <= 2 ? 1 : segments - 2;
+  f->array_length = (f->segment_count + 2) * f->segment_length;
+  f->segment_count_length = f->segment_count * f->segment_length;
+}
+
+struct fuse_s * fuse_init(uint64_t * keys, uint64_t count)
+{
+  /*
+    Build the filter by peeling: positions used by a single remaining
+    key are assigned to it and removed repeatedly, and the fingerprints
+    are then set in the reverse order. Sorting the hashes by segment
+    first keeps the memory accesses local. The keys are sorted and
+    their duplicates removed in place, as identical keys cannot be
+    peeled.
+  */
+
+  qsort(keys, count, sizeof(uint64_t), compare_keys);
+  uint64_t unique = 0;
+  for (uint64_t i = 0; i < count; i++)
+    if ((i == 0) || (keys[i] != keys[i - 1]))
+      keys[unique++] = keys[i];
+  count = unique;
+
+  struct fuse_s * f = static_cast<struct fuse_s *>
+    (xmalloc(sizeof(struct fuse_s)));
+
+  fuse_dimensions(f, count);
+
+  uint64_t length = f->array_length;
+
+  f->fingerprints = static_cast<uint16_t *>
+    (xmalloc(length * sizeof(uint16_t)));
+  memset(f->fingerprints, 0, length * sizeof(uint16_t));
+
+  uint64_t * reverse_order = static_cast<uint64_t *>
+    (xmalloc((count + 1) * sizeof(uint64_t)));
+  unsigned char * reverse_h = static_cast<unsigned char *>
+    (xmalloc(MAX(count, 1)));
+  uint64_t * alone = static_cast<uint64_t *>
+    (xmalloc(length * sizeof(uint64_t)));
+  unsigned char * t2count = static_cast<unsigned char *>
+    (xmalloc(length));
+  uint64_t * t2hash = static_cast<uint64_t *>
+    (xmalloc(length * sizeof(uint64_t)));
+
+  unsigned int block_bits = 1;
+  while ((1ULL << block_bits) < f->segment_count)
+    block_bits++;
+  uint64_t block = 1ULL << block_bits;
+  uint64_t * start = static_cast<uint64_t *>
+    (xmalloc(block * sizeof(uint64_t)));
+
+  progress_init("Building filter:  ", count);
+
+  f->seed = 0x726b2b9d438b9d4dULL;
+  uint64_t stack_size = 0;
+
+  for (unsigned int iteration = 0; ; iteration++)
+    {
+      if (iteration >= fuse_max_iterations)
+        fatal("Unable to build the binary fuse filter");
+
+      memset(reverse_order, 0, count * sizeof(uint64_t));
+      reverse_order[count] = 1;
+      memset(t2count, 0, length);
+      memset(t2hash, 0, length * sizeof(uint64_t));
+
+      /* sort the hashes by segment, a zero marks a free place */
+
+      for (uint64_t i = 0; i < block; i++)
+        start[i] = (i * count) >> block_bits;
+
+      for (uint64_t i = 0; i < count; i++)
+        {
+          uint64_t hash = fuse_mix(keys[i], f->seed);
+          uint64_t segment = hash >> (64 - block_bits);
+          while (reverse_order[start[segment]] != 0)
+            segment = (segment + 1) & (block - 1);
+          reverse_order[start[segment]] = hash;
+          start[segment]++;
+        }
+
+      /* count the keys using each position, and xor their hashes */
+
+      bool error = false;
+      for (uint64_t i = 0; i < count; i++)
+        {
+          uint64_t hash = reverse_order[i];
+          uint64_t h[3];
+          fuse_positions(f, hash, h);
+
+          for (unsigned int k = 0; k < 3; k++)
+            {
+              t2count[h[k]] += 4;
+              t2count[h[k]] ^= k;
+              t2hash[h[k]] ^= hash;
+            }
+
+          for (unsigned int k = 0; k < 3; k++)
+            if (t2count[h[k]] < 4)
+              error = true;
+        }
+
+      if (error)
+        {
+          f->seed = fuse_next_seed(f->seed);
+          continue;
+        }
+
+      /* peel the positions used by a single key */
+
+      uint64_t queue_size = 0;
+      for (uint64_t i = 0; i < length; i++)
+        {
+          alone[queue_size] = i;
+          if ((t2count[i] >> 2) == 1)
+            queue_size++;
+        }
+
+      stack_size = 0;
+      while (queue_size > 0)
+        {
+          uint64_t index = alone[--queue_size];
+          if ((t2count[index] >> 2) == 1)
+            {
+              uint64_t hash = t2hash[index];
+              uint64_t h[3];
+              fuse_positions(f, hash, h);
+              unsigned int found = t2count[index] & 3;
+              reverse_h[stack_size] = static_cast<unsigned char>(found);
+              reverse_order[stack_size] = hash;
+              stack_size++;
+
+              for (unsigned int k = 1; k <= 2; k++)
+                {
+                  unsigned int other = (found + k) % 3;
+                  uint64_t other_index = h[other];
+                  alone[queue_size] = other_index;
+                  if ((t2count[other_index] >> 2) == 2)
+                    queue_size++;
+                  t2count[other_index] -= 4;
+                  t2count[other_index] ^= other;
+                  t2hash[other_index] ^= hash;
+                }
+            }
+        }
+
+      if (stack_size == count)
+        break;
+
+      f->seed = fuse_next_seed(f->seed);
+    }
+
+  /* assign the fingerprints in the reverse order of peeling */
+
+  for (uint64_t i = stack_size; i > 0; i--)
+    {
+      uint64_t hash = reverse_order[i - 1];
+      uint64_t h[3];
+      fuse_positions(f, hash, h);
+      unsigned int found = reverse_h[i - 1];
+      f->fingerprints[h[found]] = fuse_fingerprint(hash) ^
+        f->fingerprints[h[(found + 1) % 3]] ^
+        f->fingerprints[h[(found + 2) % 3]];
+      progress_update(stack_size - i + 1);
+    }
+
+  progress_done();
+
+  xfree(start);
+  xfree(t2hash);
+  xfree(t2count);
+  xfree(alone);
+  xfree(reverse_h);
+  xfree(reverse_order);
+
+  return f;
+}
+
+void fuse_exit(struct fuse_s * f)
+{
+  xfree(f->fingerprints);
+  xfree(f);
+}
@@ -0,0 +1,112 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Static binary fuse filter with 16-bit fingerprints, as described in
+
+  Graf TM, Lemire D (2022)
+  Binary Fuse Filters: Fast and Smaller Than Xor Filters
+  ACM Journal of Experimental Algorithmics, 27, 1-15
+  https://doi.org/10.1145/3510449
+
+  Each key is mapped to three fingerprints in consecutive segments of
+  the array, and is present if the xor of them equals its own
+  fingerprint. It uses about 18 bits per key, with a false positive
+  rate of about 1/65536.
+*/
+
+struct fuse_s
+{
+  uint64_t seed;
+  uint64_t segment_length;
+  uint64_t segment_mask;
+  uint64_t segment_count;
+  uint64_t segment_count_length;
+  uint64_t array_length;
+  uint16_t * fingerprints;
+};
+
+struct fuse_s * fuse_init(uint64_t * keys, uint64_t count);
+
+void fuse_exit(struct fuse_s * f);
+
+inline uint64_t fuse_mix(uint64_t key, uint64_t seed)
+{
+  /* murmur64 finalizer */
+
+  uint64_t h = key + seed;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+inline uint16_t fuse_fingerprint(uint64_t hash)
+{
+  return static_cast<uint16_t>(hash ^ (hash >> 32));
+}
+
+inline void fuse_positions(struct fuse_s * f,
+                           uint64_t hash,
+                           uint64_t * h)
+{
+  /* the three positions of a hash, one in each of three segments */
+
+  h[0] = ((hash >> 32) * f->segment_count_length) >> 32;
+  h[1] = (h[0] + f->segment_length) ^ ((hash >> 18) & f->segment_mask);
+  h[2] = (h[0] + 2 * f->segment_length) ^ (hash & f->segment_mask);
+}
+
+inline bool fuse_get(struct fuse_s * f, uint64_t key)
+{
+  uint64_t hash = fuse_mix(key, f->seed);
+  uint64_t h[3];
+  fuse_positions(f, hash, h);
+  return (fuse_fingerprint(hash) ^ f->fingerprints[h[0]] ^
+          f->fingerprints[h[1]] ^ f->fingerprints[h[2]]) == 0;
+}
+
+inline unsigned int fuse_get_batch(struct fuse_s * f,
+                                   struct bloom_stats_s * s,
+                                   uint64_t * h,
+                                   unsigned int n)
+{
+  /* like bloom_get_batch */
+
+  if (bloom_stats_bypass(s, n))
+    return (1U << n) - 1;
+
+  unsigned int pass = 0;
+  unsigned int passed = 0;
+
+  for (unsigned int i = 0; i < n; i++)
+    if (fuse_get(f, h[i]))
+      {
+        pass |= 1U << i;
+        passed++;
+      }
+
+  bloom_stats_count(s, n, passed);
+
+  return pass;
+}
@@ -21,42 +21,131 @@
 
 #include "compairr.h"
 
-#define HASHFILLPCT 70
+/* maximum fill, in eighths of the table */
+#define HASHFILLEIGHTHS 7
 
 void hash_zap(struct hashtable_s * ht)
 {
-  memset(ht->hash_occupied, 0, (ht->hash_tablesize + 63) / 8);
+  threads_memset(ht->hash_control, hash_empty, ht->hash_tablesize);
 }
 
-struct hashtable_s * hash_init(uint64_t sequences)
+struct hashtable_s * hash_init(uint64_t sequences, uint64_t rows)
 {
+  /*
+    Room for the given number of sequences, with data values below
+    rows stored in 32 bits whenever possible.
+  */
+
   struct hashtable_s * ht = (struct hashtable_s *)
     xmalloc(sizeof(struct hashtable_s));
 
-  ht->hash_tablesize = 1;
-  while (HASHFILLPCT * ht->hash_tablesize < 100 * sequences)
+  ht->hash_tablesize = hash_group_size;
+  while (HASHFILLEIGHTHS * ht->hash_tablesize < 8 * sequences)
     ht->hash_tablesize <<= 1;
 
-  ht->hash_mask = ht->hash_tablesize - 1;
-
-  ht->hash_occupied = static_cast<unsigned char *>
-    (xmalloc((ht->hash_tablesize + 63) / 8));
+  ht->hash_group_mask = ht->hash_tablesize / hash_group_size - 1;
 
-  hash_zap(ht);
+  ht->hash_control = static_cast<unsigned char *>
+    (xmalloc_huge(ht->hash_tablesize));
 
-  ht->hash_values = static_cast<uint64_t *>
-    (xmalloc(ht->hash_tablesize * sizeof(uint64_t)));
+  ht->hash_wide = ! rows_fit_32(rows);
+  uint64_t bucket_size = ht->hash_wide ?
+    sizeof(hash_bucket_s<uint64_t>) : sizeof(hash_bucket_s<uint32_t>);
+  ht->hash_buckets = xmalloc_huge(ht->hash_tablesize * bucket_size);
 
-  ht->hash_data = static_cast<uint64_t *>
-    (xmalloc(ht->hash_tablesize * sizeof(uint64_t)));
+  hash_zap(ht);
 
   return ht;
 }
 
 void hash_exit(struct hashtable_s * ht)
 {
-  xfree(ht->hash_occupied);
-  xfree(ht->hash_values);
-  xfree(ht->hash_data);
+  xfree_huge(ht->hash_control);
+  xfree_huge(ht->hash_buckets);
   xfree(ht);
 }
+
+struct hash_owners_s * hash_owners_init(struct db * d)
+{
+  /*
+    Sort the rows of d by the thread owning their hash, keeping the
+    input order for each thread, with a counting sort over chunks of
+    rows in parallel.
+  */
+
+  struct hash_owners_s * ho = static_cast<struct hash_owners_s *>
+    (xmalloc(sizeof(struct hash_owners_s)));
+
+  uint64_t rows = db_getsequencecount(d);
+  uint64_t owners = static_cast<uint64_t>(opt_threads);
+
+  ho->first = static_cast<uint64_t *>
+    (xmalloc((owners + 1) * sizeof(uint64_t)));
+
+  if (owners == 1)
+    {
+      ho->rows = nullptr;
+      ho->first[0] = 0;
+      ho->first[1] = rows;
+      return ho;
+    }
+
+  uint64_t chunk = MAX(1, rows / (4 * owners));
+  uint64_t chunks = (rows + chunk - 1) / chunk;
+
+  /* number of rows of each owner in each chunk */
+
+  uint64_t * next = static_cast<uint64_t *>
+    (xmalloc(MAX(chunks * owners, 1) * sizeof(uint64_t)));
+  memset(next, 0, MAX(chunks * owners, 1) * sizeof(uint64_t));
+
+  threads_parallel_for(0, rows, chunk,
+                       [&](int64_t t, uint64_t first, uint64_t last)
+                       {
+                         (void) t;
+                         uint64_t * count = next + (first / chunk) * owners;
+                         for (uint64_t i = first; i < last; i++)
+                           count[hash_owner(db_gethash(d, i))]++;
+                       });
+
+  /* turn the counts into positions, by owner and then by chunk */
+
+  uint64_t sum = 0;
+  for (uint64_t o = 0; o < owners; o++)
+    {
+      ho->first[o] = sum;
+      for (uint64_t c = 0; c < chunks; c++)
+        {
+          uint64_t size = next[c * owners + o];
+          next[c * owners + o] = sum;
+          sum += size;
+        }
+    }
+  ho->first[owners] = sum;
+
+  /* the chunks are the same in both passes */
+
+  ho->rows = static_cast<uint64_t *>
+    (xmalloc(MAX(rows, 1) * sizeof(uint64_t)));
+
+  threads_parallel_for(0, rows, chunk,
+                       [&](int64_t t, uint64_t first, uint64_t last)
+                       {
+                         (void) t;
+                         uint64_t * pos = next + (first / chunk) * owners;
+                         for (uint64_t i = first; i < last; i++)
+                           ho->rows[pos[hash_owner(db_gethash(d, i))]++] = i;
+                       });
+
+  xfree(next);
+
+  return ho;
+}
+
+void hash_owners_exit(struct hash_owners_s * ho)
+{
+  if (ho->rows)
+    xfree(ho->rows);
+  xfree(ho->first);
+  xfree(ho);
+}
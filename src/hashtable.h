@@ -19,13 +19,66 @@
     PO Box 1080 Blindern, NO-0316 Oslo, Norway
 */
 
+/*
+  Hash table with group probing, similar to the Swiss tables described
+  by Kulukundis M (2017) Designing a fast, efficient, cache-friendly
+  hash table, step by step. CppCon 2017.
+
+  The slots are divided into groups of 16. For each slot there is a
+  control byte that is either empty (0x80) or holds a 7-bit tag taken
+  from the top bits of the hash. A probe compares the control bytes of
+  a whole group with the tag using a single SIMD instruction, and only
+  the buckets of matching slots are examined. Groups are probed in
+  order until a group with an empty slot is found. There are no
+  deletions, so the table may be filled to 87.5%.
+
+  Several threads may insert into the table at the same time. A slot
+  is claimed by atomically changing its control byte from empty to
+  busy, and the tag is stored with release semantics when the bucket
+  has been filled in. While inserting, the control bytes are read one
+  by one with acquire semantics instead of with SIMD loads, so that a
+  bucket is only read after it is complete. If each thread only
+  inserts and looks up the hashes it owns, identical keys are always
+  handled by the same thread, in order. The rows of a set are sorted
+  by owner first, so that each thread only visits its own.
+
+  Each bucket holds the hash value, the data (usually a row or group
+  number), the sequence length and a tag derived from the V and J
+  genes. The data is stored in 32 bits, giving 16-byte buckets, unless
+  the table may hold numbers too large for that (see rows_fit_32), in
+  which case 64 bits are used. A probe can thereby reject most
+  candidates with a different length or genes without looking up the
+  sequence itself.
+*/
+
+const unsigned int hash_group_size = 16;
+const unsigned char hash_empty = 0x80;
+const unsigned char hash_busy = 0xfe;
+
+template <typename data_t>
+struct hash_bucket_s
+{
+  uint64_t value;
+  data_t data;
+  uint16_t length;
+  uint16_t tag;
+};
+
 struct hashtable_s
 {
-  uint64_t hash_mask;
-  uint64_t * hash_values;
-  uint64_t * hash_data;
+  uint64_t hash_group_mask;
+  unsigned char * hash_control;
+  void * hash_buckets;
   uint64_t hash_tablesize;
-  unsigned char * hash_occupied;
+  bool hash_wide;
+};
+
+struct hash_probe_s
+{
+  uint64_t group;
+  unsigned int match;
+  bool last;
+  unsigned char tag;
 };
 
 inline uint64_t hash_get_tablesize(struct hashtable_s * ht)
@@ -33,51 +86,297 @@ inline uint64_t hash_get_tablesize(struct hashtable_s * ht)
   return ht->hash_tablesize;
 }
 
-inline uint64_t hash_getindex(struct hashtable_s * ht, uint64_t hash)
+template <typename data_t>
+inline hash_bucket_s<data_t> * hash_bucket(struct hashtable_s * ht,
+                                           uint64_t j)
+{
+  return static_cast<hash_bucket_s<data_t> *>(ht->hash_buckets) + j;
+}
+
+inline unsigned char hash_control_tag(uint64_t hash)
+{
+  return static_cast<unsigned char>(hash >> 57);
+}
+
+inline uint64_t hash_getgroup(struct hashtable_s * ht, uint64_t hash)
 {
   // Shift bits right to get independence from the simple Bloom filter hash
   hash = hash >> 32;
-  return hash & ht->hash_mask;
+  return hash & ht->hash_group_mask;
+}
+
+inline unsigned int hash_group_match(unsigned char * control,
+                                     unsigned char x)
+{
+  /* bit i is set if control byte i of the group equals x */
+
+#if defined __x86_64__ && defined __SSE2__
+
+  __m128i c = _mm_loadu_si128(CAST_m128i_ptr(control));
+  return static_cast<unsigned int>
+    (_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(static_cast<char>(x)))));
+
+#elif defined __aarch64__
+
+  static const uint8_t bits[16] =
+    { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+  uint8x16_t eq = vceqq_u8(vld1q_u8(control), vdupq_n_u8(x));
+  uint8x16_t m = vandq_u8(eq, vld1q_u8(bits));
+  return vaddv_u8(vget_low_u8(m)) |
+    (static_cast<unsigned int>(vaddv_u8(vget_high_u8(m))) << 8);
+
+#else
+
+  unsigned int mask = 0;
+  for (unsigned int i = 0; i < hash_group_size; i++)
+    if (control[i] == x)
+      mask |= 1U << i;
+  return mask;
+
+#endif
+}
+
+inline unsigned int hash_group_match_acquire(unsigned char * control,
+                                             unsigned char x)
+{
+  /* like hash_group_match, while other threads may be inserting */
+
+  unsigned int mask = 0;
+  for (unsigned int i = 0; i < hash_group_size; i++)
+    if (__atomic_load_n(control + i, __ATOMIC_ACQUIRE) == x)
+      mask |= 1U << i;
+  return mask;
+}
+
+template <bool concurrent>
+inline void hash_probe_group(struct hashtable_s * ht, struct hash_probe_s * p)
+{
+  unsigned char * control = ht->hash_control + hash_group_size * p->group;
+  if (concurrent)
+    {
+      p->match = hash_group_match_acquire(control, p->tag);
+      p->last = hash_group_match_acquire(control, hash_empty) != 0;
+    }
+  else
+    {
+      p->match = hash_group_match(control, p->tag);
+      p->last = hash_group_match(control, hash_empty) != 0;
+    }
+}
+
+template <bool concurrent = false>
+inline void hash_probe_init(struct hashtable_s * ht,
+                            uint64_t hash,
+                            struct hash_probe_s * p)
+{
+  /*
+    Start looking for the slots that may hold the given hash. Use
+    concurrent probes while other threads insert into the table.
+  */
+
+  p->group = hash_getgroup(ht, hash);
+  p->tag = hash_control_tag(hash);
+  hash_probe_group<concurrent>(ht, p);
+}
+
+template <bool concurrent = false>
+inline bool hash_probe_next(struct hashtable_s * ht,
+                            struct hash_probe_s * p,
+                            uint64_t * j)
+{
+  /* find the next slot with a matching tag, in order of insertion */
+
+  while (p->match == 0)
+    {
+      if (p->last)
+        return false;
+      p->group = (p->group + 1) & ht->hash_group_mask;
+      hash_probe_group<concurrent>(ht, p);
+    }
+
+  *j = hash_group_size * p->group + __builtin_ctz(p->match);
+  p->match &= p->match - 1;
+  return true;
+}
+
+inline uint64_t hash_find_empty(struct hashtable_s * ht, uint64_t hash)
+{
+  /* find the first empty slot for the given hash */
+
+  uint64_t g = hash_getgroup(ht, hash);
+  while (true)
+    {
+      unsigned int empty = hash_group_match
+        (ht->hash_control + hash_group_size * g, hash_empty);
+      if (empty)
+        return hash_group_size * g + __builtin_ctz(empty);
+      g = (g + 1) & ht->hash_group_mask;
+    }
+}
+
+inline void hash_set_occupied(struct hashtable_s * ht,
+                              uint64_t j,
+                              uint64_t hash)
+{
+  ht->hash_control[j] = hash_control_tag(hash);
+}
+
+inline uint64_t hash_claim_empty(struct hashtable_s * ht, uint64_t hash)
+{
+  /* find and claim the first empty slot, with other threads inserting */
+
+  uint64_t g = hash_getgroup(ht, hash);
+  while (true)
+    {
+      unsigned char * control = ht->hash_control + hash_group_size * g;
+      unsigned int empty = hash_group_match_acquire(control, hash_empty);
+      while (empty)
+        {
+          unsigned int k = __builtin_ctz(empty);
+          unsigned char expected = hash_empty;
+          if (__atomic_compare_exchange_n(control + k, & expected, hash_busy,
+                                          false, __ATOMIC_ACQUIRE,
+                                          __ATOMIC_RELAXED))
+            return hash_group_size * g + k;
+          empty &= empty - 1;
+        }
+      g = (g + 1) & ht->hash_group_mask;
+    }
 }
 
-inline uint64_t hash_getnextindex(struct hashtable_s * ht, uint64_t j)
+inline void hash_publish(struct hashtable_s * ht, uint64_t j, uint64_t hash)
 {
-  return (j+1) & ht->hash_mask;
+  /* store the tag of a claimed slot after its bucket is filled in */
+
+  __atomic_store_n(ht->hash_control + j, hash_control_tag(hash),
+                   __ATOMIC_RELEASE);
 }
 
-inline void hash_set_occupied(struct hashtable_s * ht, uint64_t j)
+inline uint64_t hash_owner(uint64_t hash)
 {
-  ht->hash_occupied[j >> 3] |= (1 << (j & 7));
+  /* the thread responsible for the given hash */
+
+  return (hash >> 48) % static_cast<uint64_t>(opt_threads);
 }
 
-inline bool hash_is_occupied(struct hashtable_s * ht, uint64_t j)
+struct hash_owners_s
 {
-  return ht->hash_occupied[j >> 3] & (1 << (j & 7));
+  uint64_t * rows;
+  uint64_t * first;
+};
+
+struct hash_owners_s * hash_owners_init(struct db * d);
+
+void hash_owners_exit(struct hash_owners_s * ho);
+
+inline uint64_t hash_owners_first(struct hash_owners_s * ho, int64_t t)
+{
+  return ho->first[t];
+}
+
+inline uint64_t hash_owners_last(struct hash_owners_s * ho, int64_t t)
+{
+  /* one past the last position of thread t */
+  return ho->first[t + 1];
+}
+
+inline uint64_t hash_owners_get(struct hash_owners_s * ho, uint64_t k)
+{
+  /* the row at position k, the rows are in order with one thread */
+  return ho->rows ? ho->rows[k] : k;
 }
 
 inline void hash_set_value(struct hashtable_s * ht, uint64_t j, uint64_t hash)
 {
-  ht->hash_values[j] = hash;
+  if (ht->hash_wide)
+    hash_bucket<uint64_t>(ht, j)->value = hash;
+  else
+    hash_bucket<uint32_t>(ht, j)->value = hash;
 }
 
 inline bool hash_compare_value(struct hashtable_s * ht,
                                uint64_t j, uint64_t hash)
 {
-  return (ht->hash_values[j] == hash);
+  if (ht->hash_wide)
+    return (hash_bucket<uint64_t>(ht, j)->value == hash);
+  else
+    return (hash_bucket<uint32_t>(ht, j)->value == hash);
 }
 
 inline uint64_t hash_get_data(struct hashtable_s * ht, uint64_t j)
 {
-  return ht->hash_data[j];
+  if (ht->hash_wide)
+    return hash_bucket<uint64_t>(ht, j)->data;
+  else
+    return hash_bucket<uint32_t>(ht, j)->data;
 }
 
 inline void hash_set_data(struct hashtable_s * ht, uint64_t j, uint64_t x)
 {
-  ht->hash_data[j] = x;
+  if (ht->hash_wide)
+    hash_bucket<uint64_t>(ht, j)->data = x;
+  else
+    hash_bucket<uint32_t>(ht, j)->data = static_cast<uint32_t>(x);
+}
+
+inline uint16_t hash_gene_tag(uint64_t v_gene, uint64_t j_gene)
+{
+  /* compact tag for a pair of genes, zero if genes are ignored */
+
+  if (opt_ignore_genes)
+    return 0;
+  return static_cast<uint16_t>((v_gene << 5) ^ j_gene);
+}
+
+template <typename data_t>
+inline void hash_set_info_bucket(hash_bucket_s<data_t> * b,
+                                 unsigned int length,
+                                 uint16_t tag)
+{
+  b->length = static_cast<uint16_t>(length);
+  b->tag = tag;
+}
+
+inline void hash_set_info(struct hashtable_s * ht,
+                          uint64_t j,
+                          unsigned int length,
+                          uint16_t tag)
+{
+  if (ht->hash_wide)
+    hash_set_info_bucket(hash_bucket<uint64_t>(ht, j), length, tag);
+  else
+    hash_set_info_bucket(hash_bucket<uint32_t>(ht, j), length, tag);
+}
+
+template <typename data_t>
+inline bool hash_compare_bucket_data(hash_bucket_s<data_t> * b,
+                                     uint64_t hash,
+                                     unsigned int length,
+                                     uint16_t tag)
+{
+  return (b->value == hash) &&
+    (b->length == static_cast<uint16_t>(length)) &&
+    (b->tag == tag);
+}
+
+inline bool hash_compare_bucket(struct hashtable_s * ht,
+                                uint64_t j,
+                                uint64_t hash,
+                                unsigned int length,
+                                uint16_t tag)
+{
+  /* compare hash, length and gene tag of an occupied bucket */
+
+  if (ht->hash_wide)
+    return hash_compare_bucket_data(hash_bucket<uint64_t>(ht, j),
+                                    hash, length, tag);
+  else
+    return hash_compare_bucket_data(hash_bucket<uint32_t>(ht, j),
+                                    hash, length, tag);
 }
 
 void hash_zap(struct hashtable_s * ht);
 
-struct hashtable_s * hash_init(uint64_t sequences);
+struct hashtable_s * hash_init(uint64_t sequences, uint64_t rows);
 
 void hash_exit(struct hashtable_s * ht);
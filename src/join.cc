@@ -0,0 +1,258 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+void join_sort(struct join_key_s * keys,
+               struct join_key_s * temp,
+               uint64_t n)
+{
+  /*
+    Least significant digit radix sort on the key, 8 bits at a time,
+    stable. Passes where all keys have the same digit are skipped.
+    The temp array must have room for n keys.
+  */
+
+  const unsigned int radix_bits = 8;
+  const unsigned int radix_size = 1 << radix_bits;
+
+  uint64_t counts[radix_size];
+  struct join_key_s * src = keys;
+  struct join_key_s * dst = temp;
+
+  for (unsigned int shift = 0; shift < 64; shift += radix_bits)
+    {
+      memset(counts, 0, sizeof(counts));
+      for (uint64_t i = 0; i < n; i++)
+        counts[(src[i].key >> shift) & (radix_size - 1)]++;
+
+      if ((n == 0) || (counts[(src[0].key >> shift) & (radix_size - 1)] == n))
+        continue;
+
+      uint64_t sum = 0;
+      for (unsigned int r = 0; r < radix_size; r++)
+        {
+          uint64_t c = counts[r];
+          counts[r] = sum;
+          sum += c;
+        }
+
+      for (uint64_t i = 0; i < n; i++)
+        dst[counts[(src[i].key >> shift) & (radix_size - 1)]++] = src[i];
+
+      struct join_key_s * swap = src;
+      src = dst;
+      dst = swap;
+    }
+
+  if (src != keys)
+    memcpy(keys, src, n * sizeof(struct join_key_s));
+}
+
+struct join_s * join_init(struct postings_s * pl, struct db * d)
+{
+  /* sort the hash values of the first sequence of each group */
+
+  struct join_s * j = static_cast<struct join_s *>
+    (xmalloc(sizeof(struct join_s)));
+
+  uint64_t n = pl->group_count;
+  j->count = n;
+
+  struct join_key_s * keys = static_cast<struct join_key_s *>
+    (xmalloc(MAX(n, 1) * sizeof(struct join_key_s)));
+  struct join_key_s * temp = static_cast<struct join_key_s *>
+    (xmalloc(MAX(n, 1) * sizeof(struct join_key_s)));
+
+  progress_init("Sorting hashes:   ", n);
+
+  for (uint64_t g = 0; g < n; g++)
+    {
+      keys[g].key = db_gethash(d, postings_get(pl, postings_get_first(pl, g)).seq);
+      keys[g].value = g;
+    }
+
+  join_sort(keys, temp, n);
+
+  xfree(temp);
+
+  j->hash = static_cast<uint64_t *>(xmalloc(MAX(n, 1) * sizeof(uint64_t)));
+  j->group = static_cast<uint64_t *>(xmalloc(MAX(n, 1) * sizeof(uint64_t)));
+
+  for (uint64_t i = 0; i < n; i++)
+    {
+      j->hash[i] = keys[i].key;
+      j->group[i] = keys[i].value;
+    }
+
+  xfree(keys);
+
+  progress_update(n);
+  progress_done();
+
+  return j;
+}
+
+void join_exit(struct join_s * j)
+{
+  xfree(j->hash);
+  xfree(j->group);
+  xfree(j);
+}
+
+struct join_batch_s * join_batch_init()
+{
+  struct join_batch_s * b = static_cast<struct join_batch_s *>
+    (xmalloc(sizeof(struct join_batch_s)));
+
+  b->count = 0;
+  b->alloc = 1024;
+  b->vars = static_cast<struct var_s *>
+    (xmalloc(b->alloc * sizeof(struct var_s)));
+  b->query = static_cast<uint64_t *>
+    (xmalloc(b->alloc * sizeof(uint64_t)));
+  b->filtered = static_cast<bool *>
+    (xmalloc(b->alloc * sizeof(bool)));
+  b->keys = static_cast<struct join_key_s *>
+    (xmalloc(b->alloc * sizeof(struct join_key_s)));
+  b->temp = static_cast<struct join_key_s *>
+    (xmalloc(b->alloc * sizeof(struct join_key_s)));
+  b->match_count = 0;
+  b->match_alloc = 1024;
+  b->matches = static_cast<struct join_key_s *>
+    (xmalloc(b->match_alloc * sizeof(struct join_key_s)));
+
+  return b;
+}
+
+void join_batch_exit(struct join_batch_s * b)
+{
+  xfree(b->vars);
+  xfree(b->query);
+  xfree(b->filtered);
+  xfree(b->keys);
+  xfree(b->temp);
+  xfree(b->matches);
+  xfree(b);
+}
+
+void join_batch_add(struct join_batch_s * b,
+                    struct var_s * var,
+                    uint64_t query,
+                    bool filtered)
+{
+  /* filtered tells if the variant was checked by a Bloom filter */
+
+  if (b->count >= b->alloc)
+    {
+      b->alloc *= 2;
+      b->vars = static_cast<struct var_s *>
+        (xrealloc(b->vars, b->alloc * sizeof(struct var_s)));
+      b->query = static_cast<uint64_t *>
+        (xrealloc(b->query, b->alloc * sizeof(uint64_t)));
+      b->filtered = static_cast<bool *>
+        (xrealloc(b->filtered, b->alloc * sizeof(bool)));
+      b->keys = static_cast<struct join_key_s *>
+        (xrealloc(b->keys, b->alloc * sizeof(struct join_key_s)));
+      b->temp = static_cast<struct join_key_s *>
+        (xrealloc(b->temp,
+                  MAX(b->alloc, b->match_alloc) * sizeof(struct join_key_s)));
+    }
+
+  b->vars[b->count] = *var;
+  b->query[b->count] = query;
+  b->filtered[b->count] = filtered;
+  b->count++;
+}
+
+static void add_match(struct join_batch_s * b, uint64_t var, uint64_t group)
+{
+  if (b->match_count >= b->match_alloc)
+    {
+      b->match_alloc *= 2;
+      b->matches = static_cast<struct join_key_s *>
+        (xrealloc(b->matches, b->match_alloc * sizeof(struct join_key_s)));
+      b->temp = static_cast<struct join_key_s *>
+        (xrealloc(b->temp,
+                  MAX(b->alloc, b->match_alloc) * sizeof(struct join_key_s)));
+    }
+
+  b->matches[b->match_count].key = var;
+  b->matches[b->match_count].value = group;
+  b->match_count++;
+}
+
+void join_batch_run(struct join_s * j, struct join_batch_s * b)
+{
+  /*
+    Find the groups in set 2 with the same hash as each variant in the
+    batch. The matches are returned as pairs of variant number (key)
+    and group (value), ordered by variant number.
+  */
+
+  for (uint64_t i = 0; i < b->count; i++)
+    {
+      b->keys[i].key = b->vars[i].hash;
+      b->keys[i].value = i;
+    }
+
+  join_sort(b->keys, b->temp, b->count);
+
+  uint64_t pos = 0;
+  uint64_t n = j->count;
+
+  for (uint64_t i = 0; i < b->count; i++)
+    {
+      uint64_t h = b->keys[i].key;
+
+      if ((pos < n) && (j->hash[pos] < h))
+        {
+          /* exponential search for the first hash not below h */
+
+          uint64_t lo = pos;
+          uint64_t step = 1;
+          while ((pos + step < n) && (j->hash[pos + step] < h))
+            {
+              lo = pos + step;
+              step *= 2;
+            }
+          uint64_t hi = MIN(pos + step, n);
+          lo++;
+          while (lo < hi)
+            {
+              uint64_t mid = lo + (hi - lo) / 2;
+              if (j->hash[mid] < h)
+                lo = mid + 1;
+              else
+                hi = mid;
+            }
+          pos = lo;
+        }
+
+      if (pos >= n)
+        break;
+
+      for (uint64_t k = pos; (k < n) && (j->hash[k] == h); k++)
+        add_match(b, b->keys[i].value, j->group[k]);
+    }
+
+  join_sort(b->matches, b->temp, b->match_count);
+}
@@ -0,0 +1,85 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Sorted hash join for the variants strategy.
+
+  The hash values of the distinct sequences in set 2 are stored in a
+  sorted array. Instead of looking up each variant in a hash table,
+  the variants of a batch of query sequences that pass the Bloom
+  filter are collected, radix sorted on their hash values, and merged
+  with the sorted array. The array is thereby read in increasing
+  order, skipping ahead with an exponential search, rather than at
+  random. The matches are finally sorted by the number of the variant,
+  so that they are reported in the same order as by the hash table.
+*/
+
+struct join_key_s
+{
+  uint64_t key;
+  uint64_t value;
+};
+
+struct join_s
+{
+  uint64_t count;
+  uint64_t * hash;
+  uint64_t * group;
+};
+
+struct join_batch_s
+{
+  uint64_t count;
+  uint64_t alloc;
+  struct var_s * vars;
+  uint64_t * query;
+  bool * filtered;
+  struct join_key_s * keys;
+  struct join_key_s * temp;
+  uint64_t match_count;
+  uint64_t match_alloc;
+  struct join_key_s * matches;
+};
+
+void join_sort(struct join_key_s * keys,
+               struct join_key_s * temp,
+               uint64_t n);
+
+struct join_s * join_init(struct postings_s * pl, struct db * d);
+
+void join_exit(struct join_s * j);
+
+struct join_batch_s * join_batch_init();
+
+void join_batch_exit(struct join_batch_s * b);
+
+void join_batch_add(struct join_batch_s * b,
+                    struct var_s * var,
+                    uint64_t query,
+                    bool filtered);
+
+void join_batch_run(struct join_s * j, struct join_batch_s * b);
+
+inline void join_batch_clear(struct join_batch_s * b)
+{
+  b->count = 0;
+  b->match_count = 0;
+}
@@ -0,0 +1,238 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+struct masked_s
+{
+  struct db * d;
+  struct multimap_s * mm;
+};
+
+static uint64_t masked_count(unsigned int len)
+{
+  /* number of keys stored for a sequence of length len */
+
+  uint64_t count = 1;
+  if (opt_differences >= 1)
+    count += len;
+  if (opt_differences >= 2)
+    count += static_cast<uint64_t>(len) * (len - 1) / 2;
+  return count;
+}
+
+static inline uint64_t mask(uint64_t hash, unsigned int pos, unsigned char x)
+{
+  /* replace residue x in position pos with a wildcard */
+  return hash ^ zobrist_value(pos, x) ^ zobrist_wildcard(pos);
+}
+
+struct masked_s * masked_init(struct db * d)
+{
+  /*
+    Index the sequences in d by their hash and their masked hashes.
+    The Zobrist hashes of the sequences must have been computed.
+  */
+
+  struct masked_s * mi = static_cast<struct masked_s *>
+    (xmalloc(sizeof(struct masked_s)));
+
+  mi->d = d;
+
+  uint64_t sequences = db_getsequencecount(d);
+
+  uint64_t entry_count = 0;
+  for (uint64_t i = 0; i < sequences; i++)
+    entry_count += masked_count(db_getsequencelen(d, i));
+
+  struct multimap_entry_s * entries = static_cast<struct multimap_entry_s *>
+    (xmalloc(entry_count * sizeof(struct multimap_entry_s)));
+
+  uint64_t k = 0;
+  progress_init("Masking sequences:", sequences);
+  for (uint64_t i = 0; i < sequences; i++)
+    {
+      unsigned char * seq = (unsigned char *) db_getsequence(d, i);
+      unsigned int len = db_getsequencelen(d, i);
+      uint64_t hash = db_gethash(d, i);
+
+      entries[k].key = hash;
+      entries[k].seq = i;
+      k++;
+
+      if (opt_differences >= 1)
+        for (unsigned int p = 0; p < len; p++)
+          {
+            uint64_t hash1 = mask(hash, p, seq[p]);
+            entries[k].key = hash1;
+            entries[k].seq = i;
+            k++;
+
+            if (opt_differences >= 2)
+              for (unsigned int q = p + 1; q < len; q++)
+                {
+                  entries[k].key = mask(hash1, q, seq[q]);
+                  entries[k].seq = i;
+                  k++;
+                }
+          }
+      progress_update(i);
+    }
+  progress_done();
+
+  mi->mm = multimap_init(entries, entry_count);
+
+  return mi;
+}
+
+void masked_exit(struct masked_s * mi)
+{
+  multimap_exit(mi->mm);
+  xfree(mi);
+}
+
+static void find_masked_matches(struct masked_s * mi,
+                                struct db * d,
+                                uint64_t seed,
+                                const uint64_t * group_first,
+                                uint64_t key,
+                                struct var_s * var,
+                                uint64_t * * hits_data,
+                                uint64_t * hits_count,
+                                uint64_t * hits_alloc)
+{
+  /*
+    Find the sequences stored under the given key. The variant var
+    describes which positions are masked. Only sequences that differ
+    from the seed in exactly those positions are reported, so that
+    each hit is reported once.
+  */
+
+  uint64_t first;
+  if (! multimap_find(mi->mm, key, & first))
+    return;
+
+  unsigned char * seed_sequence = (unsigned char *) db_getsequence(d, seed);
+  unsigned int seed_seqlen = db_getsequencelen(d, seed);
+  uint64_t seed_v_gene = db_get_v_gene(d, seed);
+  uint64_t seed_j_gene = db_get_j_gene(d, seed);
+
+  for (uint64_t k = first; multimap_match(mi->mm, k, key); k++)
+    {
+      uint64_t hit = multimap_get_seq(mi->mm, k);
+
+      if (group_first && (group_first[hit] < seed))
+        continue;
+
+      /* double check that everything matches */
+
+      if ((! opt_ignore_genes) &&
+          ((db_get_v_gene(mi->d, hit) != seed_v_gene) ||
+           (db_get_j_gene(mi->d, hit) != seed_j_gene)))
+        continue;
+
+      unsigned char * hit_sequence
+        = (unsigned char *) db_getsequence(mi->d, hit);
+      unsigned int hit_seqlen = db_getsequencelen(mi->d, hit);
+
+      if (hit_seqlen != seed_seqlen)
+        continue;
+
+      /* the hit must have other residues in the masked positions */
+
+      if (var->kind != identical)
+        {
+          var->residue1 = hit_sequence[var->pos1];
+          if (var->residue1 == seed_sequence[var->pos1])
+            continue;
+        }
+
+      if (var->kind == sub_sub)
+        {
+          var->residue2 = hit_sequence[var->pos2];
+          if (var->residue2 == seed_sequence[var->pos2])
+            continue;
+        }
+
+      if (check_variant(seed_sequence, seed_seqlen,
+                        var,
+                        hit_sequence, hit_seqlen))
+        {
+          if (*hits_alloc <= *hits_count)
+            {
+              *hits_alloc += 1024;
+              *hits_data = static_cast<uint64_t *>
+                (xrealloc((*hits_data),
+                          (*hits_alloc) * sizeof(uint64_t)));
+            }
+          (*hits_data)[(*hits_count)++] = hit;
+        }
+    }
+}
+
+void masked_search(struct masked_s * mi,
+                   struct db * d,
+                   uint64_t seed,
+                   const uint64_t * group_first,
+                   uint64_t * * hits_data,
+                   uint64_t * hits_count,
+                   uint64_t * hits_alloc)
+{
+  /*
+    Find all sequences in the index with at most opt_differences
+    substitutions compared to sequence seed in d. If group_first is
+    given, sequences whose group starts before seed are skipped.
+  */
+
+  unsigned char * sequence = (unsigned char *) db_getsequence(d, seed);
+  unsigned int seqlen = db_getsequencelen(d, seed);
+  uint64_t hash = db_gethash(d, seed);
+
+  struct var_s var = { hash, identical, 0, 0, 0, 0 };
+
+  find_masked_matches(mi, d, seed, group_first, hash, & var,
+                      hits_data, hits_count, hits_alloc);
+
+  if (opt_differences >= 1)
+    for (unsigned int p = 0; p < seqlen; p++)
+      {
+        uint64_t hash1 = mask(hash, p, sequence[p]);
+
+        var.hash = hash1;
+        var.kind = substitution;
+        var.pos1 = p;
+        find_masked_matches(mi, d, seed, group_first, hash1, & var,
+                            hits_data, hits_count, hits_alloc);
+
+        if (opt_differences >= 2)
+          for (unsigned int q = p + 1; q < seqlen; q++)
+            {
+              uint64_t hash2 = mask(hash1, q, sequence[q]);
+
+              var.hash = hash2;
+              var.kind = sub_sub;
+              var.pos1 = p;
+              var.pos2 = q;
+              find_masked_matches(mi, d, seed, group_first, hash2, & var,
+                                  hits_data, hits_count, hits_alloc);
+            }
+      }
+}
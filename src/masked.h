@@ -0,0 +1,45 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Wildcard-masked neighbourhood index for d=1 and d=2 without indels.
+
+  Each sequence is stored under its own hash, and under the hashes of
+  all the variants where one (d=1), or one or two (d=2), of its
+  positions are replaced by a wildcard. A query sequence generates the
+  same masked hashes, so that all sequences with at most d
+  substitutions are found without enumerating the substituted
+  residues.
+*/
+
+struct masked_s;
+
+struct masked_s * masked_init(struct db * d);
+
+void masked_exit(struct masked_s * mi);
+
+void masked_search(struct masked_s * mi,
+                   struct db * d,
+                   uint64_t seed,
+                   const uint64_t * group_first,
+                   uint64_t * * hits_data,
+                   uint64_t * hits_count,
+                   uint64_t * hits_alloc);
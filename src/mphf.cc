@@ -0,0 +1,234 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+/* the size of each level in bits relative to the number of keys */
+
+const uint64_t mphf_gamma = 2;
+
+/* state shared by the threads while building a level */
+
+static uint64_t * build_keys = nullptr;
+static uint64_t build_count = 0;
+static uint64_t * build_kept = nullptr;
+static uint64_t * build_bits = nullptr;
+static uint64_t * build_collisions = nullptr;
+static uint64_t build_words = 0;
+static unsigned int build_level = 0;
+
+static void thread_range(int64_t t, uint64_t n, uint64_t * first, uint64_t * last)
+{
+  uint64_t threads = static_cast<uint64_t>(opt_threads);
+  uint64_t u = static_cast<uint64_t>(t);
+  *first = n * u / threads;
+  *last = n * (u + 1) / threads;
+}
+
+static void mark_thread(int64_t t)
+{
+  /* mark the bit of each key, and the bits hit by more than one key */
+
+  uint64_t first, last;
+  thread_range(t, build_count, & first, & last);
+
+  for (uint64_t i = first; i < last; i++)
+    {
+      uint64_t pos = mphf_position(mphf_hash(build_keys[i], build_level),
+                                   build_words);
+      uint64_t bit = 1ULL << (pos & 63);
+      uint64_t old = __atomic_fetch_or(build_bits + pos / 64, bit,
+                                       __ATOMIC_RELAXED);
+      if (old & bit)
+        __atomic_fetch_or(build_collisions + pos / 64, bit,
+                          __ATOMIC_RELAXED);
+    }
+}
+
+static void keep_thread(int64_t t)
+{
+  /* move the colliding keys to the start of this thread's range */
+
+  uint64_t first, last;
+  thread_range(t, build_count, & first, & last);
+
+  uint64_t kept = first;
+  for (uint64_t i = first; i < last; i++)
+    {
+      uint64_t pos = mphf_position(mphf_hash(build_keys[i], build_level),
+                                   build_words);
+      if (build_collisions[pos / 64] & (1ULL << (pos & 63)))
+        build_keys[kept++] = build_keys[i];
+    }
+  build_kept[t] = kept - first;
+
+  /* clear the colliding bits in this thread's range of words */
+
+  thread_range(t, build_words, & first, & last);
+  for (uint64_t w = first; w < last; w++)
+    build_bits[w] &= ~ build_collisions[w];
+}
+
+static int compare_keys(const void * a, const void * b)
+{
+  uint64_t x = * static_cast<const uint64_t *>(a);
+  uint64_t y = * static_cast<const uint64_t *>(b);
+  if (x < y)
+    return -1;
+  else if (x > y)
+    return +1;
+  else
+    return 0;
+}
+
+struct mphf_s * mphf_init(uint64_t * keys, uint64_t key_count)
+{
+  struct mphf_s * m = static_cast<struct mphf_s *>
+    (xmalloc(sizeof(struct mphf_s)));
+
+  m->key_count = key_count;
+  m->placed = 0;
+  m->levels = 0;
+  m->bits = nullptr;
+  m->fallback_count = 0;
+  m->fallback = nullptr;
+
+  /* the remaining keys are kept in a copy, as they are reordered */
+
+  build_keys = static_cast<uint64_t *>
+    (xmalloc(MAX(key_count, 1) * sizeof(uint64_t)));
+  memcpy(build_keys, keys, key_count * sizeof(uint64_t));
+  build_count = key_count;
+  build_kept = static_cast<uint64_t *>
+    (xmalloc(static_cast<uint64_t>(opt_threads) * sizeof(uint64_t)));
+
+  uint64_t total_words = 0;
+
+  progress_init("Perfect hashing:  ", key_count);
+
+  while ((build_count > 0) && (m->levels < mphf_maxlevels))
+    {
+      build_level = m->levels;
+      build_words = (mphf_gamma * build_count + 63) / 64;
+
+      m->bits = static_cast<uint64_t *>
+        (xrealloc(m->bits, (total_words + build_words) * sizeof(uint64_t)));
+      build_bits = m->bits + total_words;
+      memset(build_bits, 0, build_words * sizeof(uint64_t));
+      build_collisions = static_cast<uint64_t *>
+        (xmalloc(build_words * sizeof(uint64_t)));
+      memset(build_collisions, 0, build_words * sizeof(uint64_t));
+
+      threads_run(mark_thread);
+      threads_run(keep_thread);
+
+      xfree(build_collisions);
+      build_collisions = nullptr;
+
+      /* gather the colliding keys left by each thread */
+
+      uint64_t remaining = 0;
+      for (int64_t t = 0; t < opt_threads; t++)
+        {
+          uint64_t first, last;
+          thread_range(t, build_count, & first, & last);
+          memmove(build_keys + remaining, build_keys + first,
+                  build_kept[t] * sizeof(uint64_t));
+          remaining += build_kept[t];
+        }
+
+      m->placed += build_count - remaining;
+      m->level_first[m->levels] = total_words;
+      m->level_words[m->levels] = build_words;
+      m->levels++;
+      total_words += build_words;
+      build_count = remaining;
+
+      progress_update(m->placed);
+    }
+
+  progress_done();
+
+  /* rank of the first bit in each block of 8 words */
+
+  uint64_t blocks = (total_words + 7) / 8;
+  m->ranks = static_cast<uint64_t *>
+    (xmalloc(MAX(blocks, 1) * sizeof(uint64_t)));
+  uint64_t rank = 0;
+  for (uint64_t w = 0; w < total_words; w++)
+    {
+      if (w % 8 == 0)
+        m->ranks[w / 8] = rank;
+      rank += __builtin_popcountll(m->bits[w]);
+    }
+
+  /* keys still colliding after the last level */
+
+  m->fallback_count = build_count;
+  if (build_count > 0)
+    {
+      m->fallback = static_cast<uint64_t *>
+        (xmalloc(build_count * sizeof(uint64_t)));
+      memcpy(m->fallback, build_keys, build_count * sizeof(uint64_t));
+      qsort(m->fallback, build_count, sizeof(uint64_t), compare_keys);
+    }
+
+  xfree(build_kept);
+  build_kept = nullptr;
+  xfree(build_keys);
+  build_keys = nullptr;
+  build_bits = nullptr;
+
+  return m;
+}
+
+uint64_t mphf_fallback(struct mphf_s * m, uint64_t key)
+{
+  /* binary search for the rare keys not placed in any level */
+
+  uint64_t lo = 0;
+  uint64_t hi = m->fallback_count;
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (m->fallback[mid] < key)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if ((lo < m->fallback_count) && (m->fallback[lo] == key))
+    return m->placed + lo;
+
+  /* not a key, any number will do */
+
+  return 0;
+}
+
+void mphf_exit(struct mphf_s * m)
+{
+  if (m->bits)
+    xfree(m->bits);
+  xfree(m->ranks);
+  if (m->fallback)
+    xfree(m->fallback);
+  xfree(m);
+}
@@ -0,0 +1,103 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Minimal perfect hash function for a static set of 64-bit keys, as
+  described in
+
+  Limasset A, Rizk G, Chikhi R, Peterlongo P (2017)
+  Fast and scalable minimal perfect hashing for massive key sets
+  16th International Symposium on Experimental Algorithms (SEA 2017)
+  https://doi.org/10.4230/LIPIcs.SEA.2017.25
+
+  The keys are hashed into a bit array twice as long as the number of
+  keys. Keys that do not collide with any other key are placed there,
+  while the colliding keys are hashed again into a new, shorter bit
+  array at the next level. The number of a key is the number of set
+  bits before its bit, found with a small rank table. The few keys
+  left after the last level are kept in a sorted array. The bit
+  arrays are marked in parallel using atomic operations. The whole
+  structure uses about 4 bits per key.
+
+  The keys must be distinct. For keys not in the set, an arbitrary
+  number is returned, so the caller must verify the result.
+*/
+
+const unsigned int mphf_maxlevels = 24;
+
+struct mphf_s
+{
+  uint64_t key_count;
+  uint64_t placed;
+  unsigned int levels;
+  uint64_t level_first[mphf_maxlevels];
+  uint64_t level_words[mphf_maxlevels];
+  uint64_t * bits;
+  uint64_t * ranks;
+  uint64_t fallback_count;
+  uint64_t * fallback;
+};
+
+struct mphf_s * mphf_init(uint64_t * keys, uint64_t key_count);
+
+void mphf_exit(struct mphf_s * m);
+
+uint64_t mphf_fallback(struct mphf_s * m, uint64_t key);
+
+inline uint64_t mphf_hash(uint64_t key, unsigned int level)
+{
+  /* mix the key with the level, finalizer of splitmix64 */
+
+  uint64_t x = key + (level + 1) * 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+inline uint64_t mphf_position(uint64_t h, uint64_t words)
+{
+  /* bit position within a level of the given number of words */
+
+  return (((h >> 32) * words) >> 32) * 64 + (h & 63);
+}
+
+inline uint64_t mphf_lookup(struct mphf_s * m, uint64_t key)
+{
+  /* number of the key, in the range 0 to key_count - 1 */
+
+  for (unsigned int l = 0; l < m->levels; l++)
+    {
+      uint64_t pos = mphf_position(mphf_hash(key, l), m->level_words[l]);
+      uint64_t * w = m->bits + m->level_first[l] + pos / 64;
+      uint64_t bit = 1ULL << (pos & 63);
+      if (*w & bit)
+        {
+          /* rank table entries cover blocks of 8 words */
+          uint64_t word = m->level_first[l] + pos / 64;
+          uint64_t rank = m->ranks[word / 8];
+          for (uint64_t k = word & ~7ULL; k < word; k++)
+            rank += __builtin_popcountll(m->bits[k]);
+          return rank + __builtin_popcountll(*w & (bit - 1));
+        }
+    }
+
+  return mphf_fallback(m, key);
+}
@@ -0,0 +1,89 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+#include <algorithm>
+
+static bool compare_entries(const struct multimap_entry_s & a,
+                            const struct multimap_entry_s & b)
+{
+  return (a.key < b.key) || ((a.key == b.key) && (a.seq < b.seq));
+}
+
+struct multimap_s * multimap_init(struct multimap_entry_s * entries,
+                                  uint64_t entry_count)
+{
+  /*
+    Build a multimap from the given entries. The multimap takes
+    ownership of the entries array, which will be sorted. Repeated
+    entries with the same key and sequence are stored only once.
+  */
+
+  struct multimap_s * mm = static_cast<struct multimap_s *>
+    (xmalloc(sizeof(struct multimap_s)));
+
+  mm->entry_count = entry_count;
+  mm->entries = entries;
+
+  progress_init("Sorting index:    ", entry_count);
+  std::sort(entries, entries + entry_count, compare_entries);
+  progress_done();
+
+  /* remove repeated entries with the same key and sequence */
+
+  uint64_t unique = 0;
+  for (uint64_t k = 0; k < entry_count; k++)
+    if ((unique == 0) ||
+        (entries[k].key != entries[unique-1].key) ||
+        (entries[k].seq != entries[unique-1].seq))
+      entries[unique++] = entries[k];
+  entry_count = unique;
+  mm->entry_count = entry_count;
+
+  /* store the first entry of each distinct key in a hash table */
+
+  uint64_t distinct = 0;
+  for (uint64_t k = 0; k < entry_count; k++)
+    if ((k == 0) || (entries[k].key != entries[k-1].key))
+      distinct++;
+
+  mm->ht = hash_init(distinct, entry_count);
+
+  for (uint64_t k = 0; k < entry_count; k++)
+    if ((k == 0) || (entries[k].key != entries[k-1].key))
+      {
+        uint64_t key = entries[k].key;
+        uint64_t j = hash_find_empty(mm->ht, key);
+        hash_set_occupied(mm->ht, j, key);
+        hash_set_value(mm->ht, j, key);
+        hash_set_data(mm->ht, j, k);
+      }
+
+  return mm;
+}
+
+void multimap_exit(struct multimap_s * mm)
+{
+  hash_exit(mm->ht);
+  xfree(mm->entries);
+  xfree(mm);
+}
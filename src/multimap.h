@@ -0,0 +1,77 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Multimap from 64-bit keys to sequence numbers.
+
+  The entries are sorted by key (and sequence number), and a hash
+  table maps each distinct key to its first entry. All entries with
+  the same key are therefore stored consecutively.
+*/
+
+struct multimap_entry_s
+{
+  uint64_t key;
+  uint64_t seq;
+};
+
+struct multimap_s
+{
+  uint64_t entry_count;
+  struct multimap_entry_s * entries;
+  struct hashtable_s * ht;
+};
+
+struct multimap_s * multimap_init(struct multimap_entry_s * entries,
+                                  uint64_t entry_count);
+
+void multimap_exit(struct multimap_s * mm);
+
+inline bool multimap_find(struct multimap_s * mm,
+                          uint64_t key,
+                          uint64_t * first)
+{
+  /* find the first entry with the given key, if any */
+
+  struct hash_probe_s probe;
+  uint64_t j;
+  hash_probe_init(mm->ht, key, & probe);
+  while (hash_probe_next(mm->ht, & probe, & j))
+    {
+      if (hash_compare_value(mm->ht, j, key))
+        {
+          * first = hash_get_data(mm->ht, j);
+          return true;
+        }
+    }
+  return false;
+}
+
+inline bool multimap_match(struct multimap_s * mm, uint64_t k, uint64_t key)
+{
+  /* check if entry k exists and has the given key */
+  return (k < mm->entry_count) && (mm->entries[k].key == key);
+}
+
+inline uint64_t multimap_get_seq(struct multimap_s * mm, uint64_t k)
+{
+  return mm->entries[k].seq;
+}
@@ -0,0 +1,223 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+/* from linux/mempolicy.h */
+const int mpol_interleave = 3;
+const unsigned int mpol_mf_move = 1 << 1;
+
+/* at most 64 nodes, one bit each in the node mask */
+const unsigned int max_nodes = 64;
+
+static bool numa_enabled = false;
+static unsigned int node_count = 1;
+static unsigned long node_mask = 1;
+static int * cpu_node = nullptr;
+static int cpu_node_count = 0;
+
+static bool numa_parse_list(const char * filename,
+                            bool * list,
+                            unsigned int list_size)
+{
+  /* parse a list like "0-3,8,10-11" into a set of flags */
+
+  FILE * fp = fopen(filename, "r");
+  if (! fp)
+    return false;
+
+  char line[4096];
+  bool ok = fgets(line, sizeof(line), fp) != nullptr;
+  fclose(fp);
+  if (! ok)
+    return false;
+
+  for (unsigned int i = 0; i < list_size; i++)
+    list[i] = false;
+
+  char * p = line;
+  while ((*p >= '0') && (*p <= '9'))
+    {
+      unsigned long first = strtoul(p, & p, 10);
+      unsigned long last = first;
+      if (*p == '-')
+        last = strtoul(p + 1, & p, 10);
+      for (unsigned long i = first; (i <= last) && (i < list_size); i++)
+        list[i] = true;
+      if (*p == ',')
+        p++;
+    }
+
+  return true;
+}
+
+void numa_init(bool enable)
+{
+  numa_enabled = false;
+  node_count = 1;
+  node_mask = 1;
+
+  if (! enable)
+    return;
+
+#ifdef __linux__
+  bool nodes[max_nodes];
+  if (numa_parse_list("/sys/devices/system/node/online", nodes, max_nodes))
+    {
+      cpu_node_count = CPU_SETSIZE;
+      cpu_node = static_cast<int *>(xmalloc(CPU_SETSIZE * sizeof(int)));
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        cpu_node[cpu] = 0;
+
+      unsigned int count = 0;
+      unsigned long mask = 0;
+      bool * cpus = static_cast<bool *>(xmalloc(CPU_SETSIZE * sizeof(bool)));
+      for (unsigned int node = 0; node < max_nodes; node++)
+        {
+          if (! nodes[node])
+            continue;
+
+          count++;
+          mask |= 1UL << node;
+
+          char filename[100];
+          snprintf(filename, sizeof(filename),
+                   "/sys/devices/system/node/node%u/cpulist", node);
+          if (numa_parse_list(filename, cpus, CPU_SETSIZE))
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+              if (cpus[cpu])
+                cpu_node[cpu] = static_cast<int>(node);
+        }
+      xfree(cpus);
+
+      if (count > 0)
+        {
+          node_count = count;
+          node_mask = mask;
+        }
+    }
+#endif
+
+  numa_enabled = node_count > 1;
+
+  fprintf(logfile, "NUMA nodes:        %u\n", node_count);
+}
+
+void numa_exit()
+{
+  if (cpu_node)
+    xfree(cpu_node);
+  cpu_node = nullptr;
+  cpu_node_count = 0;
+}
+
+unsigned int numa_node_count()
+{
+  return node_count;
+}
+
+void numa_spread(int * cpus, int count)
+{
+  if (! numa_enabled || (count < 2))
+    return;
+
+  /* take the first unused CPU of each node in turn, in node order */
+
+  int * spread = static_cast<int *>(xmalloc(count * sizeof(int)));
+  bool * used = static_cast<bool *>(xmalloc(count * sizeof(bool)));
+  for (int i = 0; i < count; i++)
+    used[i] = false;
+
+  int n = 0;
+  while (n < count)
+    {
+      int previous = n;
+
+      for (unsigned int node = 0; node < max_nodes; node++)
+        {
+          if (! (node_mask & (1UL << node)))
+            continue;
+          for (int i = 0; i < count; i++)
+            if (! used[i] &&
+                ((cpus[i] < cpu_node_count ? cpu_node[cpus[i]] : 0)
+                 == static_cast<int>(node)))
+              {
+                used[i] = true;
+                spread[n++] = cpus[i];
+                break;
+              }
+        }
+
+      /* CPUs on no known node are added last */
+
+      if (n == previous)
+        for (int i = 0; i < count; i++)
+          if (! used[i])
+            {
+              used[i] = true;
+              spread[n++] = cpus[i];
+            }
+    }
+
+  for (int i = 0; i < count; i++)
+    cpus[i] = spread[i];
+
+  xfree(used);
+  xfree(spread);
+}
+
+void numa_interleave(void * p, uint64_t size, bool move)
+{
+  /*
+    Only for memory shared by all threads, allocated by the main
+    thread. With move, pages already in use are migrated.
+  */
+
+  if (! numa_enabled || threads_running())
+    return;
+
+#ifdef __linux__
+  uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  uint64_t start = (reinterpret_cast<uint64_t>(p) + page - 1) & ~ (page - 1);
+  uint64_t end = (reinterpret_cast<uint64_t>(p) + size) & ~ (page - 1);
+  if (end <= start)
+    return;
+
+  /* best effort, the memory is just left where it is if this fails */
+
+  syscall(SYS_mbind,
+          reinterpret_cast<void *>(start),
+          end - start,
+          mpol_interleave,
+          & node_mask,
+          max_nodes + 1,
+          move ? mpol_mf_move : 0);
+#else
+  (void) p;
+  (void) size;
+  (void) move;
+#endif
+}
@@ -0,0 +1,48 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Placement of memory and threads on machines with several NUMA nodes.
+
+  With the --numa option, the large shared tables, which are probed at
+  random by all threads, are interleaved page by page across the
+  nodes, so that the load on the memory of each node and on the links
+  between them is balanced. Memory allocated inside a threaded job is
+  left to the default first-touch policy, so that it stays on the
+  node of the thread using it. The threads are pinned to CPUs taken
+  in turn from each node. Without libnuma, the nodes are found in
+  /sys and the policy is set with the mbind system call. On machines
+  with a single node, or other systems than Linux, nothing is done.
+*/
+
+void numa_init(bool enable);
+
+void numa_exit();
+
+unsigned int numa_node_count();
+
+/* reorder a list of CPUs, taking one from each node in turn */
+
+void numa_spread(int * cpus, int count);
+
+/* interleave the whole pages of a memory area across the nodes */
+
+void numa_interleave(void * p, uint64_t size, bool move);
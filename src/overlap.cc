@@ -30,6 +30,7 @@ static uint64_t * set1_repertoire_size = nullptr;
 static uint64_t * set1_repertoire_count = nullptr;
 static double * set1_repertoire_sq_count = nullptr;
 static unsigned int * set1_lookup_repertoire = nullptr;
+static unsigned int * set1_row = nullptr;
 
 static struct db * d2;
 static unsigned int set2_longestsequence = 0;
@@ -40,92 +41,111 @@ static uint64_t * set2_repertoire_size = nullptr;
 static uint64_t * set2_repertoire_count = nullptr;
 static double * set2_repertoire_sq_count = nullptr;
 static unsigned int * set2_lookup_repertoire = nullptr;
+static unsigned int * set2_column = nullptr;
 
 typedef double m_val_t;
 
-static pthread_mutex_t pairs_mutex;
+static FILE * * pairs_shard_files = nullptr;
 static pthread_mutex_t network_mutex;
 static uint64_t network_progress = 0;
 static struct bloom_s * bloom_a = nullptr; // Bloom filter for sequences
+static struct fuse_s * fuse = nullptr; // or a binary fuse filter
+static struct bloom_stats_s bloom_total;
 static m_val_t * repertoire_matrix = nullptr;
-static hashtable_s * hashtable = nullptr;
+static uint64_t * repertoire_counts = nullptr;
+static struct sparse_s * existence_cells = nullptr;
+static struct postings_s * postings = nullptr;
+static struct postings_s * queries = nullptr;
+static struct pigeonhole_s * pigeonhole = nullptr;
+static struct masked_s * masked = nullptr;
+static struct deletion_s * deletions = nullptr;
+static struct trie_s * trie = nullptr;
+static struct join_s * join = nullptr;
+static struct partitions_s * partitions = nullptr;
+static uint64_t * query_order = nullptr;
+static uint64_t query_count = 0;
+static uint64_t * symmetric_first = nullptr;
+static uint64_t tile_size = 0;
+static uint64_t tile_first = 0;
+static uint64_t tile_rows = 0;
+static struct partition_unit_s * units = nullptr;
+static uint64_t unit_count = 0;
+static uint64_t unit_next = 0;
+static uint64_t * unit_key = nullptr;
 
-static uint64_t all_matches = 0;
 
-typedef struct pair_s
+/*
+  The matching pairs found by a thread, as the rows of the sequences
+  in set 1 and set 2, two row numbers per pair. The row numbers are
+  stored in 32 bits whenever both sets are small enough.
+*/
+
+struct pairs_s
 {
-  uint64_t seq[2];
-} pair_t;
+  void * rows;
+  uint64_t count;
+  uint64_t alloc;
+};
+
+static bool pairs_narrow = false;
 
 const uint64_t CHUNK = 1000;
-const char * empty_string = "";
 
-static inline bool hash_insert(struct db * d,
-                               hashtable_s * ht,
-                               struct bloom_s * b,
-                               uint64_t seed)
+/* size of the pairs output of a thread before it is passed on */
+const uint64_t pairs_flush_size = 1024 * 1024;
+
+static void pairs_init(struct pairs_s * pairs)
 {
-  bool dup = false;
+  pairs->count = 0;
+  pairs->alloc = 4 * CHUNK;
+  pairs->rows = xmalloc(2 * pairs->alloc *
+                        (pairs_narrow ? sizeof(uint32_t) : sizeof(uint64_t)));
+}
 
-  /* find the first empty bucket */
-  uint64_t hash = db_gethash(d, seed);
-  uint64_t j = hash_getindex(ht, hash);
-  while (hash_is_occupied(ht, j))
+template <typename row_t>
+static inline void pairs_add_rows(struct pairs_s * pairs,
+                                  uint64_t a,
+                                  uint64_t b)
+{
+  /* allocate more memory if needed */
+  if (pairs->count >= pairs->alloc)
     {
-#if 1
-      if (((b == nullptr) || bloom_get(b, hash)) &&
-          (hash_compare_value(ht, j, hash)))
-#else
-      if (hash_compare_value(ht, j, hash))
-#endif
-        {
-          uint64_t hit = hash_get_data(ht, j);
-
-          /* check repertoire id match */
-          unsigned int seed_rep_id = db_get_repertoire_id_no(d, seed);
-          unsigned int hit_rep_id = db_get_repertoire_id_no(d, hit);
-
-          if (seed_rep_id == hit_rep_id)
-            {
-              /* double check that everything matches */
-              unsigned int seed_v_gene = db_get_v_gene(d, seed);
-              unsigned int seed_j_gene = db_get_j_gene(d, seed);
+      pairs->alloc *= 2;
+      pairs->rows = xrealloc(pairs->rows, 2 * pairs->alloc * sizeof(row_t));
+    }
 
-              unsigned int hit_v_gene = db_get_v_gene(d, hit);
-              unsigned int hit_j_gene = db_get_j_gene(d, hit);
+  row_t * p = static_cast<row_t *>(pairs->rows) + 2 * pairs->count++;
+  p[0] = static_cast<row_t>(a);
+  p[1] = static_cast<row_t>(b);
+}
 
-              if (opt_ignore_genes ||
-                  ((seed_v_gene == hit_v_gene) && (seed_j_gene == hit_j_gene)))
-                {
-                  unsigned char * seed_sequence
-                    = (unsigned char *) db_getsequence(d, seed);
-                  unsigned int seed_seqlen
-                    = db_getsequencelen(d, seed);
-                  unsigned char * hit_sequence
-                    = (unsigned char *) db_getsequence(d, hit);
-                  unsigned int hit_seqlen
-                    = db_getsequencelen(d, hit);
-
-                  if ((seed_seqlen == hit_seqlen) &&
-                      ! memcmp(seed_sequence, hit_sequence, seed_seqlen))
-                    {
-                      dup = true;
-                    }
-                }
-            }
-        }
-      j = hash_getnextindex(ht, j);
-    }
+static inline void pairs_add(struct pairs_s * pairs, uint64_t a, uint64_t b)
+{
+  if (pairs_narrow)
+    pairs_add_rows<uint32_t>(pairs, a, b);
+  else
+    pairs_add_rows<uint64_t>(pairs, a, b);
+}
 
-  hash_set_occupied(ht, j);
-  hash_set_value(ht, j, hash);
-  hash_set_data(ht, j, seed);
+template <typename row_t>
+static inline uint64_t pairs_get_row(struct pairs_s * pairs,
+                                     uint64_t i,
+                                     unsigned int set)
+{
+  return static_cast<row_t *>(pairs->rows)[2 * i + set];
+}
 
-  if (b)
-    bloom_set(b, hash);
+static inline uint64_t pairs_get(struct pairs_s * pairs,
+                                 uint64_t i,
+                                 unsigned int set)
+{
+  /* row of the sequence in set 1 (set = 0) or 2 (set = 1) of pair i */
 
-  return dup;
+  return pairs_narrow ?
+    pairs_get_row<uint32_t>(pairs, i, set) :
+    pairs_get_row<uint64_t>(pairs, i, set);
 }
+const char * empty_string = "";
 
 static int set1_compare_by_repertoire_name(const void * a, const void * b)
 {
@@ -165,97 +185,238 @@ static inline m_val_t compute_score(uint64_t a, uint64_t b)
       }
 }
 
-static void find_variant_matches(uint64_t seed,
-                                 var_s * var,
-                                 m_val_t * repertoire_matrix,
-                                 uint64_t * pairs_alloc,
-                                 uint64_t * pairs_count,
-                                 struct pair_s * * pairs_list)
+static inline uint64_t compute_score_int(uint64_t a, uint64_t b)
 {
-  /* compute hash and corresponding hash table index */
+  /* integer scores, the mean is kept as the sum until output */
 
-  uint64_t j = hash_getindex(hashtable, var->hash);
+  if (opt_ignore_counts)
+    return 1;
+  else
+    switch(opt_score_int)
+      {
+      case score_mh:
+      case score_product:
+        return a * b;
+      case score_jaccard:
+      case score_min:
+        return MIN(a, b);
+      case score_max:
+        return MAX(a, b);
+      case score_mean:
+        return a + b;
+      default:
+        fatal("Internal error");
+      }
+}
 
-  /* find matching buckets */
+static inline void matrix_add(uint64_t k, uint64_t a, uint64_t b)
+{
+  /*
+    Add a score to the shared overlap matrix. With several threads,
+    the cell is updated atomically, so that no thread needs its own
+    copy of the matrix.
+  */
 
-  while (hash_is_occupied(hashtable, j))
+  if (repertoire_counts)
+    {
+      uint64_t v = compute_score_int(a, b);
+      if (opt_threads > 1)
+        __atomic_fetch_add(repertoire_counts + k, v, __ATOMIC_RELAXED);
+      else
+        repertoire_counts[k] += v;
+    }
+  else
     {
-      if (hash_compare_value(hashtable, j, var->hash))
+      m_val_t v = compute_score(a, b);
+      if (opt_threads > 1)
         {
-          uint64_t hit = hash_get_data(hashtable, j);
+          m_val_t old;
+          __atomic_load(repertoire_matrix + k, & old, __ATOMIC_RELAXED);
+          m_val_t sum = old + v;
+          while (! __atomic_compare_exchange(repertoire_matrix + k,
+                                             & old, & sum, true,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED))
+            sum = old + v;
+        }
+      else
+        repertoire_matrix[k] += v;
+    }
+}
 
-          /* double check that everything matches */
+static double matrix_get(unsigned int s, unsigned int t)
+{
+  uint64_t k = set2_repertoires * (set1_row[s] - tile_first) + t;
 
-          unsigned int seed_v_gene = db_get_v_gene(d1, seed);
-          unsigned int seed_j_gene = db_get_j_gene(d1, seed);
+  if (! repertoire_counts)
+    return repertoire_matrix[k];
+  else if (opt_score_int == score_mean && ! opt_ignore_counts)
+    return (double)(repertoire_counts[k]) / 2;
+  else
+    return (double)(repertoire_counts[k]);
+}
 
-          unsigned int hit_v_gene = db_get_v_gene(d2, hit);
-          unsigned int hit_j_gene = db_get_j_gene(d2, hit);
+static inline void register_match(struct posting_s * query,
+                                  struct posting_s * hit,
+                                  struct sparse_s * sparse,
+                                  struct pairs_s * pairs)
+{
+  unsigned int i = query->repertoire;
+  unsigned int j = hit->repertoire;
 
-          if (opt_ignore_genes ||
-              ((seed_v_gene == hit_v_gene) && (seed_j_gene == hit_j_gene)))
-            {
-              unsigned char * seed_sequence
-                = (unsigned char *) db_getsequence(d1, seed);
-              unsigned int seed_seqlen
-                = db_getsequencelen(d1, seed);
-              unsigned char * hit_sequence
-                = (unsigned char *) db_getsequence(d2, hit);
-              unsigned int hit_seqlen
-                = db_getsequencelen(d2, hit);
-
-              if (check_variant(seed_sequence, seed_seqlen,
-                                var,
-                                hit_sequence, hit_seqlen))
-                {
-                  unsigned int i = db_get_repertoire_id_no(d1, seed);
-                  unsigned int j = db_get_repertoire_id_no(d2, hit);
-                  uint64_t f = db_get_count(d1, seed);
-                  uint64_t g = db_get_count(d2, hit);
-
-                  m_val_t s = compute_score(f, g);
-
-		  if (! opt_no_matrix)
-		    {
-		      if (opt_matrix)
-			{
-			  repertoire_matrix[set2_repertoires * i + j] += s;
-			}
-		      else
-			{
-			  repertoire_matrix[set2_repertoires * seed + j] += s;
-			}
-		    }
-
-                  all_matches++;
-
-                  if (opt_pairs)
-                    {
-                      /* allocate more memory if needed */
-                      if (*pairs_count >= *pairs_alloc)
-                        {
-                          * pairs_alloc = 2 * (* pairs_alloc);
-                          * pairs_list = static_cast<struct pair_s *>
-                            (xrealloc(* pairs_list,
-                                      (*pairs_alloc) * sizeof(struct pair_s)));
-                        }
-
-                      struct pair_s p = { seed, hit };
-                      (*pairs_list)[(*pairs_count)++] = p;
-                    }
-                }
-            }
+  if (! opt_no_matrix)
+    {
+      if (opt_matrix)
+        {
+          matrix_add(set2_repertoires * (set1_row[i] - tile_first) + j,
+                     query->count, hit->count);
         }
-      j = hash_getnextindex(hashtable, j);
+      else
+        {
+          sparse_add(sparse, set2_column[j],
+                     compute_score(query->count, hit->count));
+        }
+    }
+
+  if (opt_pairs)
+    {
+      pairs_add(pairs, query->seq, hit->seq);
+    }
+}
+
+static inline void add_hit(struct posting_s * hit,
+                           struct posting_s * * hits_data,
+                           uint64_t * hits_count,
+                           uint64_t * hits_alloc)
+{
+  if (*hits_alloc <= *hits_count)
+    {
+      *hits_alloc += 1024;
+      *hits_data = static_cast<struct posting_s *>
+        (xrealloc((*hits_data),
+                  (*hits_alloc) * sizeof(struct posting_s)));
+    }
+  (*hits_data)[(*hits_count)++] = *hit;
+}
+
+static void match_group(uint64_t seed,
+                        var_s * var,
+                        unsigned int seed_seqlen,
+                        uint64_t group,
+                        struct posting_s * * hits_data,
+                        uint64_t * hits_count,
+                        uint64_t * hits_alloc)
+{
+  /* check the first sequence of the group, then add all postings */
+
+  uint64_t first = postings_get_first(postings, group);
+  uint64_t last = postings_get_last(postings, group);
+  uint64_t hit = postings_get(postings, first).seq;
+
+  /* when comparing a set to itself, only search groups from the seed on */
+
+  if (symmetric_first && (hit < seed))
+    return;
+
+  /* double check that everything matches */
+
+  unsigned int seed_v_gene = db_get_v_gene(d1, seed);
+  unsigned int seed_j_gene = db_get_j_gene(d1, seed);
+
+  unsigned int hit_v_gene = db_get_v_gene(d2, hit);
+  unsigned int hit_j_gene = db_get_j_gene(d2, hit);
+
+  if (opt_ignore_genes ||
+      ((seed_v_gene == hit_v_gene) && (seed_j_gene == hit_j_gene)))
+    {
+      unsigned char * seed_sequence
+        = (unsigned char *) db_getsequence(d1, seed);
+      unsigned char * hit_sequence
+        = (unsigned char *) db_getsequence(d2, hit);
+      unsigned int hit_seqlen
+        = db_getsequencelen(d2, hit);
+
+      if (check_variant(seed_sequence, seed_seqlen,
+                        var,
+                        hit_sequence, hit_seqlen))
+        for (uint64_t k = first; k < last; k++)
+          {
+            struct posting_s p = postings_get(postings, k);
+            add_hit(& p, hits_data, hits_count, hits_alloc);
+          }
     }
 }
 
+static inline unsigned int prefilter_batch(struct bloom_stats_s * stats,
+                                           uint64_t * h,
+                                           unsigned int n)
+{
+  /* check a batch of variant hashes against the selected filter */
+
+  if (fuse)
+    return fuse_get_batch(fuse, stats, h, n);
+  else
+    return bloom_get_batch(bloom_a, stats, h, n);
+}
+
+static bool find_variant_matches(uint64_t seed,
+                                 var_s * var,
+                                 unsigned int seed_seqlen,
+                                 uint16_t tag,
+                                 struct posting_s * * hits_data,
+                                 uint64_t * hits_count,
+                                 uint64_t * hits_alloc)
+{
+  /* returns true if the hash value of the variant is present in set 2 */
+
+  unsigned int length = variant_length(var, seed_seqlen);
+  bool present = false;
+
+  if (postings->mphf)
+    {
+      /* a single slot, then the groups with the same hash value */
+
+      uint64_t first, last;
+      if (postings_lookup(postings, var->hash, & first, & last))
+        for (uint64_t group = first; group < last; group++)
+          {
+            uint64_t hit = postings_get(postings,
+                                        postings_get_first(postings, group)).seq;
+            if (db_gethash(d2, hit) == var->hash)
+              {
+                present = true;
+                if (db_getsequencelen(d2, hit) == length)
+                  match_group(seed, var, seed_seqlen, group,
+                              hits_data, hits_count, hits_alloc);
+              }
+          }
+      return present;
+    }
+
+  /* find matching buckets */
+
+  struct hashtable_s * ht = postings->ht;
+  struct hash_probe_s probe;
+  uint64_t j;
+
+  hash_probe_init(ht, var->hash, & probe);
+  while (hash_probe_next(ht, & probe, & j))
+    if (hash_compare_value(ht, j, var->hash))
+      {
+        present = true;
+        if (hash_compare_bucket(ht, j, var->hash, length, tag))
+          match_group(seed, var, seed_seqlen, hash_get_data(ht, j),
+                      hits_data, hits_count, hits_alloc);
+      }
+  return present;
+}
+
 static void process_variants(uint64_t seed,
                              var_s * variant_list,
-                             m_val_t * repertoire_matrix,
-                             uint64_t * pairs_alloc,
-                             uint64_t * pairs_count,
-                             struct pair_s * * pairs_list)
+                             struct bloom_stats_s * stats,
+                             struct posting_s * * hits_data,
+                             uint64_t * hits_count,
+                             uint64_t * hits_alloc)
 {
   unsigned int variant_count = 0;
   unsigned char * sequence = (unsigned char *) db_getsequence(d1, seed);
@@ -264,277 +425,599 @@ static void process_variants(uint64_t seed,
   uint64_t v_gene = db_get_v_gene(d1, seed);
   uint64_t j_gene = db_get_j_gene(d1, seed);
 
+  uint16_t tag = hash_gene_tag(v_gene, j_gene);
+
   generate_variants(hash,
                     sequence, seqlen, v_gene, j_gene,
                     variant_list, & variant_count);
 
-  for(unsigned int i = 0; i < variant_count; i++)
+  /* check the variants against the filter in batches */
+
+  for (unsigned int i = 0; i < variant_count; i += BLOOM_BATCH)
     {
-      var_s * var = variant_list + i;
-      if (bloom_get(bloom_a, var->hash))
+      unsigned int n = MIN(BLOOM_BATCH, variant_count - i);
+      uint64_t h[BLOOM_BATCH];
+      for (unsigned int k = 0; k < n; k++)
+        h[k] = variant_list[i + k].hash;
+
+      unsigned int pass = prefilter_batch(stats, h, n);
+      while (pass)
         {
-          find_variant_matches(seed,
-                               var,
-                               repertoire_matrix,
-                               pairs_alloc,
-                               pairs_count,
-                               pairs_list);
+          var_s * var = variant_list + i + __builtin_ctz(pass);
+          pass &= pass - 1;
+          if (find_variant_matches(seed,
+                                   var,
+                                   seqlen,
+                                   tag,
+                                   hits_data,
+                                   hits_count,
+                                   hits_alloc))
+            bloom_stats_found(stats);
         }
     }
 }
 
-static void process_trad(uint64_t seed,
-                         m_val_t * repertoire_matrix,
-                         uint64_t * pairs_alloc,
-                         uint64_t * pairs_count,
-                         struct pair_s * * pairs_list)
+static void process_partitioned(uint64_t seed,
+                                var_s * variant_list,
+                                struct posting_s * * hits_data,
+                                uint64_t * hits_count,
+                                uint64_t * hits_alloc)
 {
-  /* Only to be used with no indels (and d >= 3) */
+  /* look up each variant in the partition with its length and genes */
+
+  unsigned int variant_count = 0;
+  unsigned char * sequence = (unsigned char *) db_getsequence(d1, seed);
+  unsigned int seqlen = db_getsequencelen(d1, seed);
+  uint64_t hash = db_gethash(d1, seed);
+  uint64_t v_gene = db_get_v_gene(d1, seed);
+  uint64_t j_gene = db_get_j_gene(d1, seed);
 
-  for (uint64_t hit = 0; hit < set2_sequences; hit++)
+  uint16_t tag = hash_gene_tag(v_gene, j_gene);
+
+  /* partitions for lengths seqlen - 1, seqlen and seqlen + 1 */
+
+  struct partition_s * parts[3];
+  for (unsigned int k = 0; k < 3; k++)
+    parts[k] = nullptr;
+  parts[1] = partitions_get(partitions, seqlen, v_gene, j_gene);
+  if (opt_indels)
     {
-      /* check if everything matches */
+      if (seqlen > 0)
+        parts[0] = partitions_get(partitions, seqlen - 1, v_gene, j_gene);
+      parts[2] = partitions_get(partitions, seqlen + 1, v_gene, j_gene);
+    }
 
-      unsigned int seed_v_gene = db_get_v_gene(d1, seed);
-      unsigned int seed_j_gene = db_get_j_gene(d1, seed);
+  if (! (parts[0] || parts[1] || parts[2]))
+    return;
 
-      unsigned int hit_v_gene = db_get_v_gene(d2, hit);
-      unsigned int hit_j_gene = db_get_j_gene(d2, hit);
+  generate_variants(hash,
+                    sequence, seqlen, v_gene, j_gene,
+                    variant_list, & variant_count);
 
-      if (opt_ignore_genes ||
-          ((seed_v_gene == hit_v_gene) && (seed_j_gene == hit_j_gene)))
-        {
-          unsigned int seed_seqlen = db_getsequencelen(d1, seed);
-          unsigned int hit_seqlen = db_getsequencelen(d2, hit);
+  for(unsigned int i = 0; i < variant_count; i++)
+    {
+      var_s * var = variant_list + i;
+      unsigned int length = variant_length(var, seqlen);
+      struct partition_s * part = parts[length + 1 - seqlen];
 
-          if (seed_seqlen == hit_seqlen)
-            {
-              unsigned char * seed_sequence
-                = (unsigned char *) db_getsequence(d1, seed);
-              unsigned char * hit_sequence
-                = (unsigned char *) db_getsequence(d2, hit);
+      if ((! part) || ! partitions_bloom_get(partitions, part, var->hash))
+        continue;
 
-              if (seq_diff(seed_sequence, hit_sequence, seed_seqlen)
-                  <= opt_differences)
-              {
-                unsigned int i = db_get_repertoire_id_no(d1, seed);
-                unsigned int j = db_get_repertoire_id_no(d2, hit);
-                uint64_t f = db_get_count(d1, seed);
-                uint64_t g = db_get_count(d2, hit);
-
-                m_val_t s = compute_score(f, g);
-
-                if (! opt_no_matrix)
-                  {
-                    if (opt_matrix)
-                      {
-                        repertoire_matrix[set2_repertoires * i + j] += s;
-                      }
-                    else
-                      {
-                        repertoire_matrix[set2_repertoires * seed + j] += s;
-                      }
-                  }
-
-                all_matches++;
-
-                if (opt_pairs)
-                  {
-                    /* allocate more memory if needed */
-                    if (*pairs_count >= *pairs_alloc)
-                      {
-                        * pairs_alloc = 2 * (* pairs_alloc);
-                        * pairs_list = static_cast<struct pair_s *>
-                          (xrealloc(* pairs_list,
-                                    (*pairs_alloc) * sizeof(struct pair_s)));
-                      }
-
-                    struct pair_s p = { seed, hit };
-                    (*pairs_list)[(*pairs_count)++] = p;
-                  }
-              }
-            }
-        }
+      struct hash_probe_s probe;
+      uint64_t j;
+
+      hash_probe_init(part->ht, var->hash, & probe);
+      while (hash_probe_next(part->ht, & probe, & j))
+        if (hash_compare_bucket(part->ht, j, var->hash, length, tag))
+          match_group(seed, var, seqlen, hash_get_data(part->ht, j),
+                      hits_data, hits_count, hits_alloc);
     }
 }
 
-static void process_seq(uint64_t seed,
-                        var_s * variant_list,
-                        m_val_t * repertoire_matrix,
-                        uint64_t * pairs_alloc,
-                        uint64_t * pairs_count,
-                        struct pair_s * * pairs_list)
+static void process_index(uint64_t seed,
+                          uint64_t * * found_data,
+                          uint64_t * found_alloc,
+                          struct posting_s * * hits_data,
+                          uint64_t * hits_count,
+                          uint64_t * hits_alloc)
 {
-  if (opt_differences > MAXDIFF_HASH)
-    process_trad(seed, repertoire_matrix,
-                 pairs_alloc, pairs_count, pairs_list);
-  else
-    process_variants(seed, variant_list, repertoire_matrix,
-                     pairs_alloc, pairs_count, pairs_list);
+  /* Only the deletion and trie indices may be used with indels */
+
+  uint64_t found_count = 0;
+
+  switch (opt_index_int)
+    {
+    case index_masked:
+      masked_search(masked, d1, seed, symmetric_first,
+                    found_data, & found_count, found_alloc);
+      break;
+
+    case index_trie:
+      trie_search(trie, d1, seed,
+                  found_data, & found_count, found_alloc);
+      break;
+
+    case index_deletion:
+      deletion_search(deletions, d1, seed, symmetric_first,
+                      found_data, & found_count, found_alloc);
+      break;
+
+    default:
+      pigeonhole_search(pigeonhole, d1, seed, symmetric_first,
+                        found_data, & found_count, found_alloc);
+      break;
+    }
+
+  for (uint64_t k = 0; k < found_count; k++)
+    {
+      /* the trie is not filtered by group */
+      if (symmetric_first && (symmetric_first[(*found_data)[k]] < seed))
+        continue;
+      struct posting_s hit;
+      hit.seq = (*found_data)[k];
+      hit.count = db_get_count(d2, hit.seq);
+      hit.repertoire = db_get_repertoire_id_no(d2, hit.seq);
+      add_hit(& hit, hits_data, hits_count, hits_alloc);
+    }
 }
 
-static void sim_thread(int64_t t)
+static inline bool in_tile(unsigned int repertoire)
 {
-  (void) t;
+  return (set1_row[repertoire] >= tile_first) &&
+    (set1_row[repertoire] < tile_first + tile_rows);
+}
 
-  uint64_t maxvar = max_variants(set1_longestsequence);
+static inline uint64_t query_group(uint64_t k)
+{
+  /* the k-th group of set 1 to search */
 
-  uint64_t pairs_alloc = 4 * CHUNK;
-  uint64_t pairs_count = 0;
+  return query_order ? query_order[k] : k;
+}
 
-  struct pair_s * pairs_list = nullptr;
-  if (opt_pairs)
-    pairs_list = static_cast<struct pair_s *>
-      (xmalloc(pairs_alloc * sizeof(struct pair_s)));
+static void register_group(uint64_t group,
+                           struct posting_s * hits_data,
+                           uint64_t hits_count,
+                           struct sparse_s * sparse,
+                           struct pairs_s * pairs)
+{
+  /* register the hits for every member of a group in set 1 */
 
-  struct var_s * variant_list = static_cast<struct var_s *>
-    (xmalloc(maxvar * sizeof(struct var_s)));
+  uint64_t first = postings_get_first(queries, group);
+  uint64_t last = postings_get_last(queries, group);
 
-  m_val_t * repertoire_matrix_local = nullptr;
-  if (opt_threads > 1)
+  for (uint64_t m = first; m < last; m++)
     {
-      /* if multiple threads, create local matrix */
+      struct posting_s query = postings_get(queries, m);
+      if (opt_tile && ! in_tile(query.repertoire))
+        continue;
+      if (sparse)
+        sparse_row_begin(sparse, query.seq);
+      for (uint64_t k = 0; k < hits_count; k++)
+        register_match(& query, hits_data + k, sparse,
+                       pairs);
+      if (sparse)
+        sparse_row_end(sparse);
+    }
 
-      if (! opt_no_matrix)
-        {
-          if (opt_matrix)
-            {
-              repertoire_matrix_local = static_cast<m_val_t *>
-                (xmalloc(set1_repertoires * set2_repertoires * sizeof(m_val_t)));
+  if (symmetric_first)
+    {
+      /* mirror the hits in other groups, they will not search this one */
 
-              for(uint64_t k = 0; k < set1_repertoires * set2_repertoires; k++)
-                repertoire_matrix_local[k] = 0;
-            }
-          else
-            {
-              repertoire_matrix_local = static_cast<m_val_t *>
-                (xmalloc(set1_sequences * set2_repertoires * sizeof(m_val_t)));
+      uint64_t seed = postings_get(queries, first).seq;
 
-              for(uint64_t k = 0; k < set1_sequences * set2_repertoires; k++)
-                repertoire_matrix_local[k] = 0;
+      for (uint64_t k = 0; k < hits_count; k++)
+        if (symmetric_first[hits_data[k].seq] != seed)
+          for (uint64_t m = first; m < last; m++)
+            {
+              struct posting_s member = postings_get(queries, m);
+              register_match(hits_data + k, & member, sparse, pairs);
             }
-        }
-
-      pthread_mutex_lock(&network_mutex);
     }
+}
 
-  while (network_progress < set1_sequences)
-    {
-      uint64_t firstseed = network_progress;
-      network_progress += CHUNK;
-      if (network_progress > set1_sequences)
-        network_progress = set1_sequences;
-      progress_update(network_progress);
-      uint64_t chunksize = network_progress - firstseed;
+static void process_group(uint64_t group,
+                          var_s * variant_list,
+                          struct bloom_stats_s * stats,
+                          uint64_t * * found_data,
+                          uint64_t * found_alloc,
+                          struct posting_s * * hits_data,
+                          uint64_t * hits_alloc,
+                          struct sparse_s * sparse,
+                          struct pairs_s * pairs)
+{
+  /*
+    Search for the first sequence of a group of identical sequences
+    in set 1, then register the hits for every member of the group.
+  */
 
-      if (opt_threads > 1)
+  uint64_t seed = postings_get(queries,
+                               postings_get_first(queries, group)).seq;
+  uint64_t hits_count = 0;
+
+  if (opt_index_int == index_variants)
+    process_variants(seed, variant_list, stats,
+                     hits_data, & hits_count, hits_alloc);
+  else if (opt_index_int == index_partition)
+    process_partitioned(seed, variant_list,
+                        hits_data, & hits_count, hits_alloc);
+  else
+    process_index(seed, found_data, found_alloc,
+                  hits_data, & hits_count, hits_alloc);
+
+  register_group(group, *hits_data, hits_count, sparse,
+                 pairs);
+}
+
+static void process_join(uint64_t firstgroup,
+                         uint64_t chunksize,
+                         var_s * variant_list,
+                         struct bloom_stats_s * stats,
+                         struct join_batch_s * batch,
+                         struct posting_s * * hits_data,
+                         uint64_t * hits_alloc,
+                         struct sparse_s * sparse,
+                         struct pairs_s * pairs)
+{
+  /*
+    Collect the variants of the first sequence of each group in the
+    chunk that pass the filter, join them with set 2 in one
+    pass, then verify and register the matches group by group.
+  */
+
+  join_batch_clear(batch);
+
+  for (uint64_t z = 0; z < chunksize; z++)
+    {
+      uint64_t group = query_group(firstgroup + z);
+      uint64_t seed = postings_get(queries,
+                                   postings_get_first(queries, group)).seq;
+      unsigned int variant_count = 0;
+
+      generate_variants(db_gethash(d1, seed),
+                        (unsigned char *) db_getsequence(d1, seed),
+                        db_getsequencelen(d1, seed),
+                        db_get_v_gene(d1, seed),
+                        db_get_j_gene(d1, seed),
+                        variant_list, & variant_count);
+
+      for (unsigned int i = 0; i < variant_count; i += BLOOM_BATCH)
         {
-          pthread_mutex_unlock(&network_mutex);
+          unsigned int n = MIN(BLOOM_BATCH, variant_count - i);
+          uint64_t h[BLOOM_BATCH];
+          for (unsigned int k = 0; k < n; k++)
+            h[k] = variant_list[i + k].hash;
+
+          unsigned int pass = prefilter_batch(stats, h, n);
+          while (pass)
+            {
+              join_batch_add(batch, variant_list + i + __builtin_ctz(pass), z,
+                             stats->filtered);
+              pass &= pass - 1;
+            }
         }
+    }
 
-      /* process chunksize sequences starting at seed */
+  join_batch_run(join, batch);
 
-      for (uint64_t z = 0; z < chunksize; z++)
+  uint64_t m = 0;
+  for (uint64_t z = 0; z < chunksize; z++)
+    {
+      uint64_t group = query_group(firstgroup + z);
+      uint64_t seed = postings_get(queries,
+                                   postings_get_first(queries, group)).seq;
+      unsigned int seqlen = db_getsequencelen(d1, seed);
+      uint64_t hits_count = 0;
+
+      while ((m < batch->match_count) &&
+             (batch->query[batch->matches[m].key] == z))
         {
-          uint64_t seed = firstseed + z;
-          process_seq(seed,
-                      variant_list,
-                      (opt_threads > 1 ?
-                       repertoire_matrix_local :
-                       repertoire_matrix),
-                      & pairs_alloc,
-                      & pairs_count,
-                      & pairs_list);
+          uint64_t key = batch->matches[m].key;
+          var_s * var = batch->vars + key;
+          uint64_t hit_group = batch->matches[m].value;
+          /* count each filtered variant present in set 2 once */
+          if (batch->filtered[key] &&
+              ((m == 0) || (batch->matches[m - 1].key != key)))
+            stats->present++;
+          uint64_t hit = postings_get(postings,
+                                      postings_get_first(postings,
+                                                         hit_group)).seq;
+          if (db_getsequencelen(d2, hit) == variant_length(var, seqlen))
+            match_group(seed, var, seqlen, hit_group,
+                        hits_data, & hits_count, hits_alloc);
+          m++;
         }
 
-      if (opt_threads > 1)
+      register_group(group, *hits_data, hits_count, sparse,
+                     pairs);
+    }
+}
+
+static bool claim_chunk(uint64_t * unit_first,
+                        uint64_t * unit_left,
+                        uint64_t * unit_pos,
+                        uint64_t * firstgroup,
+                        uint64_t * chunksize,
+                        uint64_t * key)
+{
+  /*
+    Claim the next chunk of groups to process, using atomic operations
+    instead of a lock. The chunks get smaller towards the end, so that
+    the threads finish at about the same time. With partitions, a
+    whole unit is claimed and then processed by this thread chunk by
+    chunk.
+
+    The key is the position of the chunk in the order the chunks are
+    claimed in, which does not depend on the number of threads. It is
+    used to write the pairs in order.
+  */
+
+  if (units)
+    {
+      if (*unit_left == 0)
         {
-          pthread_mutex_lock(&network_mutex);
+          uint64_t u = __atomic_fetch_add(& unit_next, 1, __ATOMIC_RELAXED);
+          if (u >= unit_count)
+            return false;
+          *unit_first = units[u].first;
+          *unit_left = units[u].count;
+          *unit_pos = unit_key[u];
         }
+      *firstgroup = *unit_first;
+      *chunksize = MIN(CHUNK, *unit_left);
+      *key = *unit_pos;
+      *unit_first += *chunksize;
+      *unit_left -= *chunksize;
+      *unit_pos += *chunksize;
+      __atomic_fetch_add(& network_progress, *chunksize, __ATOMIC_RELAXED);
+      return true;
+    }
+
+  uint64_t first = __atomic_load_n(& network_progress, __ATOMIC_RELAXED);
+  uint64_t size;
+  do
+    {
+      if (first >= query_count)
+        return false;
+      size = (query_count - first) / (4 * static_cast<uint64_t>(opt_threads));
+      size = MAX(1, MIN(CHUNK, size));
+    }
+  while (! __atomic_compare_exchange_n(& network_progress, & first,
+                                       first + size, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  *firstgroup = first;
+  *chunksize = size;
+  *key = first;
+  return true;
+}
+
+static void format_pair(struct outbuf_s * o, uint64_t a, uint64_t b)
+{
+  /* one line of the pairs file, a and b are rows of set 1 and 2 */
+
+  int rep_id_no1 = db_get_repertoire_id_no(d1, a);
+  int64_t len1 = db_getsequencelen(d1, a);
+
+  int rep_id_no2 = db_get_repertoire_id_no(d2, b);
+  int64_t len2 = db_getsequencelen(d2, b);
+
+  outbuf_add_string(o, db_get_repertoire_id(d1, rep_id_no1));
+  outbuf_add_char(o, '\t');
+  outbuf_add_string(o, db_get_sequence_id(d1, a));
+  outbuf_add_char(o, '\t');
+  outbuf_add_u64(o, db_get_count(d1, a));
+  outbuf_add_char(o, '\t');
+  outbuf_add_string(o, db_get_v_gene_name(d1, a));
+  outbuf_add_char(o, '\t');
+  outbuf_add_string(o, db_get_j_gene_name(d1, a));
+  outbuf_add_char(o, '\t');
+  outbuf_add(o, db_get_rendered_sequence(d1, a), len1);
+  if (opt_keep_columns)
+    {
+      outbuf_add_char(o, '\t');
+      outbuf_add_string(o, db_get_keep_columns(d1, a));
+    }
+
+  outbuf_add_char(o, '\t');
+  outbuf_add_string(o, db_get_repertoire_id(d2, rep_id_no2));
+  outbuf_add_char(o, '\t');
+  outbuf_add_string(o, db_get_sequence_id(d2, b));
+  outbuf_add_char(o, '\t');
+  outbuf_add_u64(o, db_get_count(d2, b));
+  outbuf_add_char(o, '\t');
+  outbuf_add_string(o, db_get_v_gene_name(d2, b));
+  outbuf_add_char(o, '\t');
+  outbuf_add_string(o, db_get_j_gene_name(d2, b));
+  outbuf_add_char(o, '\t');
+  outbuf_add(o, db_get_rendered_sequence(d2, b), len2);
+  if (opt_keep_columns)
+    {
+      outbuf_add_char(o, '\t');
+      outbuf_add_string(o, db_get_keep_columns(d2, b));
+    }
+
+  if (opt_distance)
+    {
+      /* Compute Levenshtein distance if indels are allowed,
+         otherwise Hamming distance */
+      int64_t dist;
+      if (opt_indels)
+        dist = seq_edit_diff((unsigned char *)db_getsequence(d1, a),
+                             len1,
+                             (unsigned char *)db_getsequence(d2, b),
+                             len2);
+      else
+        dist = seq_diff((unsigned char *)db_getsequence(d1, a),
+                        (unsigned char *)db_getsequence(d2, b),
+                        len1);
+      outbuf_add_char(o, '\t');
+      outbuf_add_i64(o, dist);
+    }
+
+  outbuf_add_char(o, '\n');
+}
+
+static void sim_thread(int64_t t)
+{
+  /*
+    The pairs are formatted by each thread into its own buffer, which
+    is written to its own file with shards, or else passed on to the
+    writer thread, after each chunk when ordered.
+  */
+
+  struct pairs_s pairs;
+  struct outbuf_s * out = nullptr;
+  if (opt_pairs)
+    {
+      pairs_init(& pairs);
+      out = (opt_pairs_mode_int == pairs_shards) ?
+        outbuf_init() : writer_get();
+    }
+
+  struct var_s * variant_list = nullptr;
+  if ((opt_index_int == index_variants) ||
+      (opt_index_int == index_join) ||
+      (opt_index_int == index_partition))
+    variant_list = static_cast<struct var_s *>
+      (xmalloc(max_variants(set1_longestsequence) * sizeof(struct var_s)));
+
+  struct join_batch_s * batch = nullptr;
+  if (opt_index_int == index_join)
+    batch = join_batch_init();
+
+  struct bloom_stats_s stats;
+  bloom_stats_init(& stats);
+
+  uint64_t found_alloc = 1024;
+  uint64_t * found_data = static_cast<uint64_t *>
+    (xmalloc(found_alloc * sizeof(uint64_t)));
+
+  uint64_t hits_alloc = 1024;
+  struct posting_s * hits_data = static_cast<struct posting_s *>
+    (xmalloc(hits_alloc * sizeof(struct posting_s)));
+
+  /* existence results are collected as a list of cells per thread */
+
+  struct sparse_s * sparse = nullptr;
+  if (existence_cells)
+    sparse = sparse_init(set2_repertoires);
+
+  uint64_t unit_first = 0;
+  uint64_t unit_left = 0;
+  uint64_t unit_pos = 0;
+  uint64_t firstgroup = 0;
+  uint64_t chunksize = 0;
+  uint64_t key = 0;
+
+  while (claim_chunk(& unit_first, & unit_left, & unit_pos,
+                     & firstgroup, & chunksize, & key))
+    {
+      /* process chunksize groups of sequences starting at firstgroup */
+
+      if (opt_index_int == index_join)
+        process_join(firstgroup,
+                     chunksize,
+                     variant_list,
+                     & stats,
+                     batch,
+                     & hits_data,
+                     & hits_alloc,
+                     sparse,
+                     & pairs);
+      else
+        for (uint64_t z = 0; z < chunksize; z++)
+          {
+            process_group(query_group(firstgroup + z),
+                          variant_list,
+                          & stats,
+                          & found_data,
+                          & found_alloc,
+                          & hits_data,
+                          & hits_alloc,
+                          sparse,
+                          & pairs);
+          }
+
+      /* only the first thread shows the progress */
+
+      if (t == 0)
+        progress_update(__atomic_load_n(& network_progress, __ATOMIC_RELAXED));
 
       if (opt_pairs)
         {
-          for (uint64_t i = 0; i < pairs_count; i++)
+          for (uint64_t i = 0; i < pairs.count; i++)
+            format_pair(out, pairs_get(& pairs, i, 0), pairs_get(& pairs, i, 1));
+          pairs.count = 0;
+
+          if (opt_pairs_mode_int == pairs_ordered)
+            {
+              out->key = key;
+              out->size = chunksize;
+              writer_put(out);
+              out = writer_get();
+            }
+          else if (out->len >= pairs_flush_size)
             {
-              uint64_t a = pairs_list[i].seq[0];
-              uint64_t b = pairs_list[i].seq[1];
-
-              int rep_id_no1 = db_get_repertoire_id_no(d1, a);
-              const char * rep_id1 = db_get_repertoire_id(d1, rep_id_no1);
-              int64_t len1 = db_getsequencelen(d1, a);
-
-              int rep_id_no2 = db_get_repertoire_id_no(d2, b);
-              const char * rep_id2 = db_get_repertoire_id(d2, rep_id_no2);
-              int64_t len2 = db_getsequencelen(d2, b);
-
-              fprintf(pairsfile,
-                      "%s\t%s\t%" PRIu64 "\t%s\t%s\t",
-                      rep_id1,
-                      db_get_sequence_id(d1, a),
-                      db_get_count(d1, a),
-                      db_get_v_gene_name(d1, a),
-                      db_get_j_gene_name(d1, a));
-              db_fprint_sequence(pairsfile, d1, a);
-              if (opt_keep_columns)
-                fprintf(pairsfile, "\t%s", db_get_keep_columns(d1, a));
-
-              fprintf(pairsfile,
-                      "\t%s\t%s\t%" PRIu64 "\t%s\t%s\t",
-                      rep_id2,
-                      db_get_sequence_id(d2, b),
-                      db_get_count(d2, b),
-                      db_get_v_gene_name(d2, b),
-                      db_get_j_gene_name(d2, b));
-              db_fprint_sequence(pairsfile, d2, b);
-              if (opt_keep_columns)
-                fprintf(pairsfile, "\t%s", db_get_keep_columns(d2, b));
-
-              if (opt_distance)
+              if (opt_pairs_mode_int == pairs_shards)
+                outbuf_write(out, pairs_shard_files[t]);
+              else
                 {
-                  /* Compute Hamming distance if len1 = len2,
-                     otherwise use Levenshtein distance of 1 (one indel) */
-                  int64_t dist = 1;
-                  if (len1 == len2)
-                    dist = seq_diff((unsigned char *)db_getsequence(d1, a),
-                                    (unsigned char *)db_getsequence(d2, b),
-                                    len1);
-                  fprintf(pairsfile, "\t%" PRId64, dist);
+                  writer_put(out);
+                  out = writer_get();
                 }
-
-              fprintf(pairsfile, "\n");
             }
-          pairs_count = 0;
         }
     }
 
   if (opt_threads > 1)
     {
-      /* update global repertoire_matrix */
-      if (! opt_no_matrix)
-        {
-          if (opt_matrix)
-            {
-              for(uint64_t k = 0; k < set1_repertoires * set2_repertoires; k++)
-                repertoire_matrix[k] += repertoire_matrix_local[k];
-            }
-          else
-            {
-              for(uint64_t k = 0; k < set1_sequences * set2_repertoires; k++)
-                repertoire_matrix[k] += repertoire_matrix_local[k];
-            }
-        }
-
+      pthread_mutex_lock(&network_mutex);
+    }
+
+  bloom_stats_add(& bloom_total, & stats);
+
+  if (sparse)
+    {
+      sparse_merge(existence_cells, sparse);
+      sparse_exit(sparse);
+    }
+
+  if (opt_threads > 1)
+    {
       pthread_mutex_unlock(&network_mutex);
-
-      if (repertoire_matrix_local)
-        xfree(repertoire_matrix_local);
-      repertoire_matrix_local = nullptr;
     }
 
-  xfree(variant_list);
+  xfree(hits_data);
+  xfree(found_data);
+  if (variant_list)
+    xfree(variant_list);
+  if (batch)
+    join_batch_exit(batch);
 
   if (opt_pairs)
-    xfree(pairs_list);
+    {
+      xfree(pairs.rows);
+      if (opt_pairs_mode_int == pairs_shards)
+        outbuf_write(out, pairs_shard_files[t]);
+      if (out->len)
+        writer_put(out);
+      else
+        outbuf_exit(out);
+    }
+}
+
+static void bloom_thread(int64_t t)
+{
+  /* set the Bloom filter bits for every opt_threads-th group of set 2 */
+
+  for (uint64_t g = static_cast<uint64_t>(t);
+       g < postings->group_count;
+       g += static_cast<uint64_t>(opt_threads))
+    {
+      uint64_t first = postings_get_first(postings, g);
+      bloom_set_atomic(bloom_a,
+                       db_gethash(d2, postings_get(postings, first).seq));
+    }
 }
 
 static void show_matrix_value(unsigned int s, unsigned int t)
@@ -548,7 +1031,7 @@ static void show_matrix_value(unsigned int s, unsigned int t)
     case score_mh:
       /* Morisita-Horn index */
       /* Uses sum of product */
-      SP = repertoire_matrix[set2_repertoires * s + t];
+      SP = matrix_get(s, t);
       LX = set1_repertoire_sq_count[s] /
         set1_repertoire_count[s] / set1_repertoire_count[s];
       LY = set2_repertoire_sq_count[t] /
@@ -562,7 +1045,7 @@ static void show_matrix_value(unsigned int s, unsigned int t)
     case score_jaccard:
       /* Jaccard index */
       /* Uses sum of min */
-      SM = repertoire_matrix[set2_repertoires * s + t];
+      SM = matrix_get(s, t);
       SA = set1_repertoire_count[s];
       SB = set2_repertoire_count[t];
       JI = SM / (SA + SB - SM);
@@ -570,12 +1053,205 @@ static void show_matrix_value(unsigned int s, unsigned int t)
       break;
 
     default:
-      X = repertoire_matrix[set2_repertoires * s + t];
+      X = matrix_get(s, t);
       fprintf(outfile, "\t%.10lg", X);
       break;
     }
 }
 
+static double existence_value(uint64_t * k, uint64_t row, uint64_t col)
+{
+  /* value of a cell, with k the next of the sorted existence cells */
+
+  struct sparse_cell_s * cell = existence_cells->cells + *k;
+
+  if ((*k < existence_cells->count) &&
+      (cell->row == row) && (cell->col == col))
+    {
+      (*k)++;
+      return cell->value;
+    }
+  else
+    return 0;
+}
+
+struct group_cost_s
+{
+  uint64_t cost;
+  uint64_t group;
+};
+
+static int compare_group_cost(const void * a, const void * b)
+{
+  /* most expensive first, otherwise in order */
+
+  const struct group_cost_s * x = static_cast<const struct group_cost_s *>(a);
+  const struct group_cost_s * y = static_cast<const struct group_cost_s *>(b);
+
+  if (x->cost != y->cost)
+    return x->cost > y->cost ? -1 : +1;
+  if (x->group != y->group)
+    return x->group < y->group ? -1 : +1;
+  return 0;
+}
+
+static uint64_t group_cost(uint64_t group)
+{
+  /*
+    Estimate the cost of searching a group of set 1: the number of
+    variants of its length, or just the length with the other indices,
+    plus the hits to register for each member, guessed from the
+    number of identical sequences in set 2.
+  */
+
+  uint64_t first = postings_get_first(queries, group);
+  uint64_t last = postings_get_last(queries, group);
+  uint64_t seed = postings_get(queries, first).seq;
+  unsigned int seqlen = db_getsequencelen(d1, seed);
+
+  uint64_t cost = seqlen + 1;
+  if ((opt_index_int == index_variants) || (opt_index_int == index_join))
+    cost = max_variants(seqlen);
+
+  uint64_t chain = 1;
+  if (postings && postings->ht)
+    {
+      struct hashtable_s * ht = postings->ht;
+      uint64_t hash = db_gethash(d1, seed);
+      uint16_t tag = hash_gene_tag(db_get_v_gene(d1, seed),
+                                   db_get_j_gene(d1, seed));
+      struct hash_probe_s probe;
+      uint64_t j;
+
+      hash_probe_init(ht, hash, & probe);
+      while (hash_probe_next(ht, & probe, & j))
+        if (hash_compare_bucket(ht, j, hash, seqlen, tag))
+          {
+            uint64_t g = hash_get_data(ht, j);
+            chain += postings_get_last(postings, g) -
+              postings_get_first(postings, g);
+            break;
+          }
+    }
+
+  return cost + (last - first) * chain;
+}
+
+static void order_by_cost(uint64_t * order, uint64_t count)
+{
+  /* order the groups to search by estimated cost, largest first */
+
+  struct group_cost_s * costs = static_cast<struct group_cost_s *>
+    (xmalloc(MAX(count, 1) * sizeof(struct group_cost_s)));
+
+  for (uint64_t k = 0; k < count; k++)
+    {
+      costs[k].cost = group_cost(order[k]);
+      costs[k].group = order[k];
+    }
+
+  qsort(costs, count, sizeof(struct group_cost_s), compare_group_cost);
+
+  for (uint64_t k = 0; k < count; k++)
+    order[k] = costs[k].group;
+
+  xfree(costs);
+}
+
+static void select_tile_groups()
+{
+  /* list the groups of set 1 with a sequence in the current tile */
+
+  query_count = 0;
+  for (uint64_t g = 0; g < queries->group_count; g++)
+    for (uint64_t m = postings_get_first(queries, g);
+         m < postings_get_last(queries, g); m++)
+      if (in_tile(postings_get(queries, m).repertoire))
+        {
+          query_order[query_count++] = g;
+          break;
+        }
+}
+
+static void write_pairs_header(FILE * f)
+{
+  fprintf(f,
+          "#repertoire_id_1\tsequence_id_1\t"
+          "duplicate_count_1\tv_call_1\tj_call_1\t%s_1",
+          seq_header);
+  for (int k = 0; k < keep_columns_count; k++)
+    fprintf(f, "\t%s_1", keep_columns_names[k]);
+  fprintf(f,
+          "\trepertoire_id_2\tsequence_id_2\t"
+          "duplicate_count_2\tv_call_2\tj_call_2\t%s_2",
+          seq_header);
+  for (int k = 0; k < keep_columns_count; k++)
+    fprintf(f, "\t%s_2", keep_columns_names[k]);
+  if (opt_distance)
+    fprintf(f, "\tdistance");
+  fprintf(f, "\n");
+}
+
+static void write_overlap_header()
+{
+  if (opt_alternative)
+    {
+      fprintf(outfile, "#repertoire_id_1\trepertoire_id_2\tmatches\n");
+    }
+  else
+    {
+      fprintf(outfile, "#");
+      for (unsigned int j = 0; j < set2_repertoires; j++)
+        fprintf(outfile, "\t%s", db_get_repertoire_id(d2, set2_lookup_repertoire[j]));
+      fprintf(outfile, "\n");
+    }
+}
+
+static void write_overlap_rows()
+{
+  /* write the rows of the overlap matrix in the current tile */
+
+  uint64_t x = 0;
+  progress_init("Writing results:  ", tile_rows * set2_repertoires);
+
+  for (uint64_t i = tile_first; i < tile_first + tile_rows; i++)
+    {
+      unsigned int s = set1_lookup_repertoire[i];
+      if (opt_alternative)
+        {
+          /* Overlap results, 3-column format */
+          for (unsigned int j = 0; j < set2_repertoires; j++)
+            {
+              unsigned int t = set2_lookup_repertoire[j];
+              if (! (opt_sparse && (matrix_get(s, t) == 0)))
+                {
+                  fprintf(outfile,
+                          "%s\t%s",
+                          db_get_repertoire_id(d1, s),
+                          db_get_repertoire_id(d2, t));
+                  show_matrix_value(s, t);
+                  fprintf(outfile, "\n");
+                }
+              progress_update(++x);
+            }
+        }
+      else
+        {
+          /* Overlap results, matrix format */
+          fprintf(outfile, "%s", db_get_repertoire_id(d1, s));
+          for (unsigned int j = 0; j < set2_repertoires; j++)
+            {
+              unsigned int t = set2_lookup_repertoire[j];
+              show_matrix_value(s, t);
+              progress_update(++x);
+            }
+          fprintf(outfile, "\n");
+        }
+    }
+
+  progress_done();
+}
+
 uint64_t check_duplicates(struct db * d)
 {
   /*
@@ -585,21 +1261,9 @@ uint64_t check_duplicates(struct db * d)
     The Zobrist hashing must have already been set up.
   */
 
-  uint64_t sequences = db_getsequencecount(d);
-  struct hashtable_s * ht = hash_init(sequences);
   uint64_t dup = 0;
-
-  progress_init("Check duplicates: ", sequences);
-  for(uint64_t i=0; i < sequences; i++)
-    {
-      if (hash_insert(d, ht, nullptr, i))
-        dup++;
-      progress_update(i);
-    }
-  progress_done();
-
-  hash_exit(ht);
-  ht = nullptr;
+  struct postings_s * pl = postings_init(d, & dup);
+  postings_exit(pl);
 
   return dup;
 }
@@ -666,6 +1330,13 @@ void overlap(char * set1_filename, char * set2_filename)
         sizeof(unsigned int),
         set1_compare_by_repertoire_name);
 
+  /* row of each repertoire in the overlap matrix, in display order */
+
+  set1_row =
+    (unsigned int *) xmalloc(sizeof(unsigned int) * MAX(set1_repertoires, 1));
+  for (unsigned int i = 0; i < set1_repertoires; i++)
+    set1_row[set1_lookup_repertoire[i]] = i;
+
   /* list of repertoires in set 1 */
 
   for (unsigned int i = 0; i < set1_repertoires; i++)
@@ -835,156 +1506,369 @@ void overlap(char * set1_filename, char * set2_filename)
 
   /* compute hashes for each sequence in database */
 
-  if (opt_differences <= MAXDIFF_HASH)
+  zobrist_init(opt_index_int == index_pigeonhole ?
+               overall_longest : overall_longest + MAX_INSERTS,
+               db_get_v_gene_count(),
+               db_get_j_gene_count());
+
+  db_hash(d1);
+
+  /* group identical sequences in set 1, they are searched only once */
+
+  uint64_t dup1 = 0;
+  queries = postings_init(d1, & dup1);
+  if ((d2 != d1) && (dup1 > 0))
+    fprintf(logfile, "Warning: %" PRIu64 " duplicates detected in repertoire set 1\n",
+            dup1);
+
+  if ((d2 == d1) && opt_matrix && ! opt_tile)
     {
-      zobrist_init(overall_longest + MAX_INSERTS,
-                   db_get_v_gene_count(),
-                   db_get_j_gene_count());
+      /*
+        When set 2 is set 1, the groups of identical sequences are the
+        same in both, and a match between two groups would be found
+        from both of them. Each group is therefore only compared to
+        the groups starting at the same or a later sequence, and the
+        hits in later groups are mirrored. The first sequence of the
+        group of each sequence is used to tell the groups apart.
+        This is only done for the overlap matrix: when checking
+        existence, the results of each sequence are collected in one
+        row at a time, which the mirrored hits would not belong to.
+      */
+
+      symmetric_first = static_cast<uint64_t *>
+        (xmalloc(MAX(set1_sequences, 1) * sizeof(uint64_t)));
+      for (uint64_t g = 0; g < queries->group_count; g++)
+        {
+          uint64_t seed = postings_get(queries,
+                                       postings_get_first(queries, g)).seq;
+          for (uint64_t m = postings_get_first(queries, g);
+               m < postings_get_last(queries, g); m++)
+            symmetric_first[postings_get(queries, m).seq] = seed;
+        }
+    }
 
-      db_hash(d1);
+  if (opt_index_int == index_pigeonhole)
+    {
+      /* index the segments of the sequences in set 2 */
 
+      pigeonhole = pigeonhole_init(d2, overall_longest,
+                                   opt_differences + 1);
+    }
+  else
+    {
       if (d2 != d1)
+        db_hash(d2);
+
+      uint64_t dup2 = 0;
+
+      if ((opt_index_int == index_variants) ||
+          (opt_index_int == index_join) ||
+          (opt_index_int == index_partition))
         {
-          uint64_t dup1 = check_duplicates(d1);
-          if (dup1 > 0)
-            fprintf(logfile, "Warning: %" PRIu64 " duplicates detected in repertoire set 1\n",
-                    dup1);
+          /* store distinct sequences in a hash table with postings */
+          /* use an additional bloom filter for increased speed */
+          /* check for duplicates in set 2 */
 
-          db_hash(d2);
-        }
+          postings = postings_init(d2, & dup2);
 
-      /* store sequences in a hash table */
-      /* use an additional bloom filter for increased speed */
-      /* hashing into hash table & bloom filter */
-      /* check for duplicates in set 2 */
+          if (opt_index_int == index_partition)
+            {
+              /* split set 2 into partitions with their own tables,
+                 and split the queries into units by partition */
 
-      uint64_t dup2 = 0;
-      hashtable = hash_init(set2_sequences);
-      bloom_a = bloom_init(hash_get_tablesize(hashtable));
-      progress_init("Hashing sequences:", set2_sequences);
-      for(uint64_t i=0; i < set2_sequences; i++)
+              partitions = partitions_init(postings, d2);
+              hash_exit(postings->ht);
+              postings->ht = nullptr;
+              units = partitions_schedule(queries, d1,
+                                          & query_order, & unit_count);
+
+              /* position of the first chunk of each unit */
+
+              unit_key = static_cast<uint64_t *>
+                (xmalloc(MAX(unit_count, 1) * sizeof(uint64_t)));
+              uint64_t sum = 0;
+              for (uint64_t u = 0; u < unit_count; u++)
+                {
+                  unit_key[u] = sum;
+                  sum += units[u].count;
+                }
+            }
+          else
+            {
+              if (opt_perfect_hash)
+                postings_perfect_hash(postings, d2);
+
+              if (opt_filter_int == filter_fuse)
+                {
+                  uint64_t * keys = static_cast<uint64_t *>
+                    (xmalloc(MAX(postings->group_count, 1) * sizeof(uint64_t)));
+                  for (uint64_t g = 0; g < postings->group_count; g++)
+                    {
+                      uint64_t first = postings_get_first(postings, g);
+                      keys[g] = db_gethash(d2,
+                                           postings_get(postings, first).seq);
+                    }
+                  fuse = fuse_init(keys, postings->group_count);
+                  xfree(keys);
+                }
+              else
+                {
+                  bloom_a = bloom_init(bloom_size(postings->group_count));
+                  threads_run(bloom_thread);
+                }
+            }
+
+          if (opt_index_int == index_join)
+            {
+              /* replace the hash table with a sorted array */
+              join = join_init(postings, d2);
+              hash_exit(postings->ht);
+              postings->ht = nullptr;
+            }
+        }
+      else
         {
-          if (hash_insert(d2, hashtable, bloom_a, i))
-            dup2++;
-          progress_update(i);
+          /* check for duplicates in set 2, then store all sequences
+             in the selected index */
+
+          dup2 = check_duplicates(d2);
+
+          switch (opt_index_int)
+            {
+            case index_masked:
+              masked = masked_init(d2);
+              break;
+
+            case index_deletion:
+              deletions = deletion_init(d2);
+              break;
+
+            case index_trie:
+              trie = trie_init(d2);
+              break;
+            }
         }
-      progress_done();
+
       if (dup2 > 0)
         fprintf(logfile, "Warning: %" PRIu64 " duplicates detected in repertoire set 2\n", dup2);
     }
 
+  tile_size = static_cast<uint64_t>(opt_tile);
+
   if (! opt_no_matrix)
     {
       if (opt_matrix)
         {
-          /* allocate matrix of repertoire set 1 x repertoire set 2 counts */
-
-          repertoire_matrix = static_cast<m_val_t *>
-            (xmalloc(sizeof(m_val_t) * set1_repertoires * set2_repertoires));
-
-          for(unsigned int s = 0; s < set1_repertoires; s++)
-            for(unsigned int t = 0; t < set2_repertoires; t++)
-              repertoire_matrix[set2_repertoires * s + t] = 0;
+          /*
+            Allocate matrix of repertoire set 1 x repertoire set 2
+            counts, shared by all threads. Integer scores are summed
+            exactly in 64-bit integers, only ratios as doubles. With
+            tiles, it only holds the rows of one tile at a time.
+          */
+
+          uint64_t cells = (tile_size ? MIN(tile_size, set1_repertoires) :
+                            set1_repertoires) * set2_repertoires;
+
+          if (opt_ignore_counts || (opt_score_int != score_ratio))
+            repertoire_counts = static_cast<uint64_t *>
+              (xmalloc_huge(sizeof(uint64_t) * MAX(cells, 1)));
+          else
+            repertoire_matrix = static_cast<m_val_t *>
+              (xmalloc_huge(sizeof(m_val_t) * MAX(cells, 1)));
         }
       else
         {
-          /* allocate matrix of set 1 sequences x repertoire set 2 counts */
-
-          repertoire_matrix = static_cast<m_val_t *>
-            (xmalloc(sizeof(m_val_t) * set1_sequences * set2_repertoires));
-
-          for(unsigned int s = 0; s < set1_sequences; s++)
-            for(unsigned int t = 0; t < set2_repertoires; t++)
-              repertoire_matrix[set2_repertoires * s + t] = 0;
+          /*
+            The results for set 1 sequences x repertoire set 2 are
+            mostly zero, so only the non-zero cells are kept. The
+            columns are numbered in output order.
+          */
+
+          existence_cells = sparse_init(0);
+
+          set2_column = static_cast<unsigned int *>
+            (xmalloc(sizeof(unsigned int) * set2_repertoires));
+          for (unsigned int j = 0; j < set2_repertoires; j++)
+            set2_column[set2_lookup_repertoire[j]] = j;
         }
     }
 
+  if (opt_huge_pages)
+    huge_report();
+
+  /* store the rows of the pairs found in 32 bits if possible */
+
+  pairs_narrow = rows_fit_32(db_getsequencecount(d1)) &&
+    rows_fit_32(db_getsequencecount(d2));
+
   /* compare all sequences */
 
   pthread_mutex_init(&network_mutex, nullptr);
-  pthread_mutex_init(&pairs_mutex, nullptr);
-  progress_init("Analysing:        ", set1_sequences);
+  bloom_stats_init(& bloom_total);
 
   if (opt_pairs)
     {
-      fprintf(pairsfile,
-              "#repertoire_id_1\tsequence_id_1\t"
-              "duplicate_count_1\tv_call_1\tj_call_1\t%s_1",
-              seq_header);
-      for (int k = 0; k < keep_columns_count; k++)
-        fprintf(pairsfile, "\t%s_1", keep_columns_names[k]);
-      fprintf(pairsfile,
-              "\trepertoire_id_2\tsequence_id_2\t"
-              "duplicate_count_2\tv_call_2\tj_call_2\t%s_2",
-              seq_header);
-      for (int k = 0; k < keep_columns_count; k++)
-        fprintf(pairsfile, "\t%s_2", keep_columns_names[k]);
-      if (opt_distance)
-        fprintf(pairsfile, "\tdistance");
-      fprintf(pairsfile, "\n");
+      db_render(d1);
+      db_render(d2);
+
+      if (opt_pairs_mode_int == pairs_shards)
+        {
+          /* the pairs of thread t are written to FILENAME.t */
+
+          pairs_shard_files = static_cast<FILE * *>
+            (xmalloc(opt_threads * sizeof(FILE *)));
+          for (int64_t t = 0; t < opt_threads; t++)
+            {
+              std::string name = std::string(opt_pairs) + "." +
+                std::to_string(t);
+              pairs_shard_files[t] = fopen_output(name.c_str());
+              if (! pairs_shard_files[t])
+                fatal("Unable to open pairs file for writing.");
+              write_pairs_header(pairs_shard_files[t]);
+            }
+        }
+      else
+        {
+          write_pairs_header(pairsfile);
+          writer_init(pairsfile, opt_pairs_mode_int == pairs_ordered);
+        }
     }
-  if (opt_threads == 1)
+
+  if (opt_matrix && ! opt_no_matrix)
+    write_overlap_header();
+
+  /*
+    With tiles, the repertoires of set 1 are handled tile_size at a
+    time, in display order. Only the groups with a sequence in the current
+    tile are searched, and the rows of the tile are written before
+    the next tile is started.
+  */
+
+  uint64_t tiles = 1;
+  if (opt_tile)
     {
-      sim_thread(0);
+      tiles = MAX(1, (set1_repertoires + tile_size - 1) / tile_size);
+      fprintf(logfile, "Tiles:             %" PRIu64 "\n", tiles);
     }
-  else
+
+  /*
+    The most expensive groups are searched first, so that the threads
+    get the cheap ones at the end. The order does not depend on the
+    number of threads, nor does the order of the pairs written in
+    order.
+  */
+
+  bool own_order = ! units;
+  if (own_order)
+    query_order = static_cast<uint64_t *>
+      (xmalloc(MAX(queries->group_count, 1) * sizeof(uint64_t)));
+
+  for (uint64_t tile = 0; tile < tiles; tile++)
     {
-      ThreadRunner * sim_tr = new ThreadRunner(static_cast<int>(opt_threads),
-                                               sim_thread);
-      sim_tr->run();
-      delete sim_tr;
+      tile_first = tile * tile_size;
+      tile_rows = tile_size ?
+        MIN(tile_size, set1_repertoires - tile_first) : set1_repertoires;
+
+      if (opt_tile)
+        select_tile_groups();
+      else if (! units)
+        {
+          query_count = queries->group_count;
+          if (query_order)
+            for (uint64_t g = 0; g < query_count; g++)
+              query_order[g] = g;
+        }
+
+      if (own_order)
+        order_by_cost(query_order, query_count);
+
+      if (repertoire_counts)
+        threads_memset(repertoire_counts, 0,
+                       tile_rows * set2_repertoires * sizeof(uint64_t));
+      if (repertoire_matrix)
+        threads_memset(repertoire_matrix, 0,
+                       tile_rows * set2_repertoires * sizeof(m_val_t));
+
+      network_progress = 0;
+      progress_init("Analysing:        ", units ?
+                    queries->group_count : query_count);
+
+      threads_run(sim_thread);
+
+      if (opt_pairs && (opt_pairs_mode_int != pairs_shards))
+        writer_sync();
+
+      progress_done();
+
+      if (opt_matrix && ! opt_no_matrix)
+        write_overlap_rows();
+    }
+
+  if (opt_pairs)
+    {
+      if (opt_pairs_mode_int == pairs_shards)
+        {
+          for (int64_t t = 0; t < opt_threads; t++)
+            fclose(pairs_shard_files[t]);
+          xfree(pairs_shard_files);
+          pairs_shard_files = nullptr;
+        }
+      else
+        writer_exit();
     }
 
-  progress_done();
-  pthread_mutex_destroy(&pairs_mutex);
   pthread_mutex_destroy(&network_mutex);
 
-  /* dump similarity matrix */
+  if (own_order)
+    {
+      xfree(query_order);
+      query_order = nullptr;
+    }
+
+  if (bloom_a || fuse)
+    bloom_stats_report(& bloom_total);
 
-  if (! opt_no_matrix)
+  /* dump existence matrix */
+
+  if (opt_existence && ! opt_no_matrix)
     {
+      sparse_sort(existence_cells);
+
       unsigned int x = 0;
       if (opt_alternative)
         {
-          if (opt_matrix)
+          /* Existence results, 3-column format */
+          fprintf(outfile, "#sequence_id_1\trepertoire_id_2\tmatches\n");
+          if (opt_sparse)
             {
-              /* Overlap results, 3-column format */
-              progress_init("Writing results:  ",
-                            set1_repertoires * set2_repertoires);
-              fprintf(outfile, "#repertoire_id_1\trepertoire_id_2\tmatches\n");
-              for (unsigned int i = 0; i < set1_repertoires; i++)
+              progress_init("Writing results:  ", existence_cells->count);
+              for (uint64_t k = 0; k < existence_cells->count; k++)
                 {
-                  unsigned int s = set1_lookup_repertoire[i];
-                  for (unsigned int j = 0; j < set2_repertoires; j++)
-                    {
-                      unsigned int t = set2_lookup_repertoire[j];
-                      fprintf(outfile,
-                              "%s\t%s",
-                              db_get_repertoire_id(d1, s),
-                              db_get_repertoire_id(d2, t));
-                      show_matrix_value(s, t);
-                      fprintf(outfile, "\n");
-                      progress_update(++x);
-                    }
+                  struct sparse_cell_s * cell = existence_cells->cells + k;
+                  if (cell->value != 0)
+                    fprintf(outfile,
+                            "%s\t%s\t%.10lg\n",
+                            db_get_sequence_id(d1, cell->row),
+                            db_get_repertoire_id(d2, set2_lookup_repertoire[cell->col]),
+                            cell->value);
+                  progress_update(k + 1);
                 }
             }
           else
             {
-              /* Existence results, 3-column format */
               progress_init("Writing results:  ",
                             set1_sequences * set2_repertoires);
-              fprintf(outfile, "#sequence_id_1\trepertoire_id_2\tmatches\n");
+              uint64_t k = 0;
               for (unsigned int i = 0; i < set1_sequences; i++)
                 {
                   for (unsigned int j = 0; j < set2_repertoires; j++)
                     {
                       unsigned int t = set2_lookup_repertoire[j];
                       fprintf(outfile,
-                              "%s\t%s",
+                              "%s\t%s\t%.10lg\n",
                               db_get_sequence_id(d1, i),
-                              db_get_repertoire_id(d2, t));
-                      show_matrix_value(i, t);
-                      fprintf(outfile, "\n");
+                              db_get_repertoire_id(d2, t),
+                              existence_value(& k, i, j));
                       progress_update(++x);
                     }
                 }
@@ -992,66 +1876,115 @@ void overlap(char * set1_filename, char * set2_filename)
         }
       else
         {
-          if (opt_matrix)
+          /* Existence results, matrix format */
+          progress_init("Writing results:  ",
+                        set1_sequences * set2_repertoires);
+          fprintf(outfile, "#");
+          for (unsigned int j = 0; j < set2_repertoires; j++)
+            fprintf(outfile, "\t%s", db_get_repertoire_id(d2, set2_lookup_repertoire[j]));
+          fprintf(outfile, "\n");
+          uint64_t k = 0;
+          for (unsigned int i = 0; i < set1_sequences; i++)
             {
-              /* Overlap results, matrix format */
-              progress_init("Writing results:  ",
-                            set1_repertoires * set2_repertoires);
-              fprintf(outfile, "#");
+              fprintf(outfile, "%s", db_get_sequence_id(d1, i));
               for (unsigned int j = 0; j < set2_repertoires; j++)
-                fprintf(outfile, "\t%s", db_get_repertoire_id(d2, set2_lookup_repertoire[j]));
-              fprintf(outfile, "\n");
-              for (unsigned int i = 0; i < set1_repertoires; i++)
                 {
-                  unsigned int s = set1_lookup_repertoire[i];
-                  fprintf(outfile, "%s", db_get_repertoire_id(d1, s));
-                  for (unsigned int j = 0; j < set2_repertoires; j++)
-                    {
-                      unsigned int t = set2_lookup_repertoire[j];
-                      show_matrix_value(s, t);
-                      progress_update(++x);
-                    }
-                  fprintf(outfile, "\n");
+                  fprintf(outfile, "\t%.10lg", existence_value(& k, i, j));
+                  progress_update(++x);
                 }
-            }
-          else
-            {
-              /* Existence results, matrix format */
-              progress_init("Writing results:  ",
-                            set1_sequences * set2_repertoires);
-              fprintf(outfile, "#");
-              for (unsigned int j = 0; j < set2_repertoires; j++)
-                fprintf(outfile, "\t%s", db_get_repertoire_id(d2, set2_lookup_repertoire[j]));
               fprintf(outfile, "\n");
-              for (unsigned int i = 0; i < set1_sequences; i++)
-                {
-                  fprintf(outfile, "%s", db_get_sequence_id(d1, i));
-                  for (unsigned int j = 0; j < set2_repertoires; j++)
-                    {
-                      unsigned int t = set2_lookup_repertoire[j];
-                      show_matrix_value(i, t);
-                      progress_update(++x);
-                    }
-                  fprintf(outfile, "\n");
-                }
             }
         }
+
+      progress_done();
     }
 
-  progress_done();
   fprintf(logfile, "\n");
 
   if (repertoire_matrix)
-    xfree(repertoire_matrix);
+    xfree_huge(repertoire_matrix);
   repertoire_matrix = nullptr;
+  if (repertoire_counts)
+    xfree_huge(repertoire_counts);
+  repertoire_counts = nullptr;
+
+  if (existence_cells)
+    {
+      sparse_exit(existence_cells);
+      xfree(set2_column);
+    }
+  existence_cells = nullptr;
+  set2_column = nullptr;
 
-  if (opt_differences <= MAXDIFF_HASH)
+  switch (opt_index_int)
     {
-      bloom_exit(bloom_a);
-      hash_exit(hashtable);
-      zobrist_exit();
+    case index_variants:
+      if (bloom_a)
+        bloom_exit(bloom_a);
+      bloom_a = nullptr;
+      if (fuse)
+        fuse_exit(fuse);
+      fuse = nullptr;
+      postings_exit(postings);
+      postings = nullptr;
+      break;
+
+    case index_join:
+      join_exit(join);
+      join = nullptr;
+      if (bloom_a)
+        bloom_exit(bloom_a);
+      bloom_a = nullptr;
+      if (fuse)
+        fuse_exit(fuse);
+      fuse = nullptr;
+      postings_exit(postings);
+      postings = nullptr;
+      break;
+
+    case index_partition:
+      partitions_exit(partitions);
+      partitions = nullptr;
+      xfree(query_order);
+      query_order = nullptr;
+      xfree(units);
+      units = nullptr;
+      xfree(unit_key);
+      unit_key = nullptr;
+      postings_exit(postings);
+      postings = nullptr;
+      break;
+
+    case index_pigeonhole:
+      pigeonhole_exit(pigeonhole);
+      pigeonhole = nullptr;
+      break;
+
+    case index_masked:
+      masked_exit(masked);
+      masked = nullptr;
+      break;
+
+    case index_deletion:
+      deletion_exit(deletions);
+      deletions = nullptr;
+      break;
+
+    case index_trie:
+      trie_exit(trie);
+      trie = nullptr;
+      break;
     }
 
+  postings_exit(queries);
+  queries = nullptr;
+
+  if (symmetric_first)
+    xfree(symmetric_first);
+  symmetric_first = nullptr;
+
+  zobrist_exit();
+
   if (d1 != d2)
     {
       xfree(set2_lookup_repertoire);
@@ -1069,6 +2002,8 @@ void overlap(char * set1_filename, char * set2_filename)
       d2 = nullptr;
     }
 
+  xfree(set1_row);
+  set1_row = nullptr;
   xfree(set1_lookup_repertoire);
   xfree(set1_repertoire_sq_count);
   xfree(set1_repertoire_count);
@@ -0,0 +1,337 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+struct partition_key_s
+{
+  unsigned int length;
+  uint64_t v_gene;
+  uint64_t j_gene;
+  uint64_t group;
+};
+
+static int compare_keys(const void * a, const void * b)
+{
+  /* order by length, V gene, J gene, then group */
+
+  const struct partition_key_s * x
+    = static_cast<const struct partition_key_s *>(a);
+  const struct partition_key_s * y
+    = static_cast<const struct partition_key_s *>(b);
+
+  if (x->length != y->length)
+    return x->length < y->length ? -1 : +1;
+  if (x->v_gene != y->v_gene)
+    return x->v_gene < y->v_gene ? -1 : +1;
+  if (x->j_gene != y->j_gene)
+    return x->j_gene < y->j_gene ? -1 : +1;
+  if (x->group != y->group)
+    return x->group < y->group ? -1 : +1;
+  return 0;
+}
+
+static struct partition_key_s * sorted_keys(struct postings_s * pl,
+                                            struct db * d)
+{
+  /* partition of the first sequence of each group, sorted */
+
+  uint64_t groups = pl->group_count;
+  struct partition_key_s * keys = static_cast<struct partition_key_s *>
+    (xmalloc(MAX(groups, 1) * sizeof(struct partition_key_s)));
+
+  for (uint64_t g = 0; g < groups; g++)
+    {
+      uint64_t seq = postings_get(pl, postings_get_first(pl, g)).seq;
+      keys[g].length = db_getsequencelen(d, seq);
+      keys[g].v_gene = opt_ignore_genes ? 0 : db_get_v_gene(d, seq);
+      keys[g].j_gene = opt_ignore_genes ? 0 : db_get_j_gene(d, seq);
+      keys[g].group = g;
+    }
+
+  qsort(keys, groups, sizeof(struct partition_key_s), compare_keys);
+
+  return keys;
+}
+
+static bool same_partition(struct partition_key_s * a,
+                           struct partition_key_s * b)
+{
+  return (a->length == b->length) &&
+    (a->v_gene == b->v_gene) &&
+    (a->j_gene == b->j_gene);
+}
+
+struct partitions_s * partitions_init(struct postings_s * pl, struct db * d)
+{
+  /* find the partitions, their tables are built on demand */
+
+  struct partitions_s * ps = static_cast<struct partitions_s *>
+    (xmalloc(sizeof(struct partitions_s)));
+
+  uint64_t groups = pl->group_count;
+  struct partition_key_s * keys = sorted_keys(pl, d);
+
+  ps->pl = pl;
+  ps->d = d;
+  ps->count = 0;
+  for (uint64_t i = 0; i < groups; i++)
+    if ((i == 0) || ! same_partition(keys + i - 1, keys + i))
+      ps->count++;
+
+  ps->list = static_cast<struct partition_s *>
+    (xmalloc(MAX(ps->count, 1) * sizeof(struct partition_s)));
+  ps->groups = static_cast<uint64_t *>
+    (xmalloc(MAX(groups, 1) * sizeof(uint64_t)));
+
+  /* the Bloom filters of all partitions are stored consecutively */
+
+  uint64_t l2size = arch_get_l2size();
+  uint64_t bloom_max = 8;
+  while (2 * bloom_max <= l2size)
+    bloom_max <<= 1;
+
+  uint64_t bloom_words = 0;
+  for (uint64_t i = 0, n = 0; i < groups; i++)
+    {
+      n++;
+      if ((i + 1 == groups) || ! same_partition(keys + i, keys + i + 1))
+        {
+          bloom_words += MIN(bloom_size(n), bloom_max) / 8;
+          n = 0;
+        }
+    }
+
+  ps->patterns = bloom_init(8);
+  ps->bitmap = static_cast<uint64_t *>
+    (xmalloc(MAX(bloom_words, 1) * sizeof(uint64_t)));
+
+  uint64_t * bitmap = ps->bitmap;
+  uint64_t p = 0;
+  uint64_t i = 0;
+
+  progress_init("Partitioning:     ", groups);
+
+  while (i < groups)
+    {
+      uint64_t n = 1;
+      while ((i + n < groups) && same_partition(keys + i, keys + i + n))
+        n++;
+
+      struct partition_s * part = ps->list + p++;
+      part->length = keys[i].length;
+      part->v_gene = keys[i].v_gene;
+      part->j_gene = keys[i].j_gene;
+      part->first = i;
+      part->count = n;
+      part->state = partition_empty;
+      part->ht = nullptr;
+
+      uint64_t words = MIN(bloom_size(n), bloom_max) / 8;
+      part->bitmap = bitmap;
+      part->mask = words - 1;
+      bitmap += words;
+
+      for (uint64_t k = i; k < i + n; k++)
+        ps->groups[k] = keys[k].group;
+
+      i += n;
+      progress_update(i);
+    }
+
+  progress_done();
+
+  xfree(keys);
+
+  return ps;
+}
+
+static void partition_build(struct partitions_s * ps, struct partition_s * part)
+{
+  /* build the hash table and Bloom filter of a partition */
+
+  struct db * d = ps->d;
+
+  part->ht = hash_init(part->count, ps->pl->group_count);
+  memset(part->bitmap, 0xff, (part->mask + 1) * sizeof(uint64_t));
+
+  for (uint64_t k = part->first; k < part->first + part->count; k++)
+    {
+      uint64_t g = ps->groups[k];
+      uint64_t seq = postings_get(ps->pl, postings_get_first(ps->pl, g)).seq;
+      uint64_t hash = db_gethash(d, seq);
+      uint64_t j = hash_find_empty(part->ht, hash);
+      hash_set_occupied(part->ht, j, hash);
+      hash_set_value(part->ht, j, hash);
+      hash_set_data(part->ht, j, g);
+      hash_set_info(part->ht, j, part->length,
+                    hash_gene_tag(db_get_v_gene(d, seq),
+                                  db_get_j_gene(d, seq)));
+      part->bitmap[(hash >> BLOOM_PATTERN_SHIFT) & part->mask]
+        &= ~ bloom_pat(ps->patterns, hash);
+    }
+}
+
+void partitions_exit(struct partitions_s * ps)
+{
+  for (uint64_t p = 0; p < ps->count; p++)
+    if (ps->list[p].ht)
+      hash_exit(ps->list[p].ht);
+  bloom_exit(ps->patterns);
+  xfree(ps->bitmap);
+  xfree(ps->groups);
+  xfree(ps->list);
+  xfree(ps);
+}
+
+static struct partition_s * partitions_find(struct partitions_s * ps,
+                                            unsigned int length,
+                                            uint64_t v_gene,
+                                            uint64_t j_gene)
+{
+  /* binary search for the partition, nullptr if there is none */
+
+  struct partition_key_s key;
+  key.length = length;
+  key.v_gene = opt_ignore_genes ? 0 : v_gene;
+  key.j_gene = opt_ignore_genes ? 0 : j_gene;
+  key.group = 0;
+
+  uint64_t lo = 0;
+  uint64_t hi = ps->count;
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      struct partition_s * part = ps->list + mid;
+      struct partition_key_s x;
+      x.length = part->length;
+      x.v_gene = part->v_gene;
+      x.j_gene = part->j_gene;
+      x.group = 0;
+      int c = compare_keys(& x, & key);
+      if (c == 0)
+        return part;
+      else if (c < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return nullptr;
+}
+
+struct partition_s * partitions_get(struct partitions_s * ps,
+                                    unsigned int length,
+                                    uint64_t v_gene,
+                                    uint64_t j_gene)
+{
+  /*
+    Find a partition and make sure it has been built. The first thread
+    to get here builds it, while any other thread waits for it.
+  */
+
+  struct partition_s * part = partitions_find(ps, length, v_gene, j_gene);
+  if (! part)
+    return nullptr;
+
+  if (__atomic_load_n(& part->state, __ATOMIC_ACQUIRE) == partition_ready)
+    return part;
+
+  int expected = partition_empty;
+  if (__atomic_compare_exchange_n(& part->state, & expected,
+                                  partition_building, false,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+      partition_build(ps, part);
+      __atomic_store_n(& part->state, partition_ready, __ATOMIC_RELEASE);
+    }
+  else
+    {
+      while (__atomic_load_n(& part->state, __ATOMIC_ACQUIRE)
+             != partition_ready)
+        sched_yield();
+    }
+
+  return part;
+}
+
+static int compare_units(const void * a, const void * b)
+{
+  /* largest units first, otherwise in order */
+
+  const struct partition_unit_s * x
+    = static_cast<const struct partition_unit_s *>(a);
+  const struct partition_unit_s * y
+    = static_cast<const struct partition_unit_s *>(b);
+
+  if (x->count != y->count)
+    return x->count > y->count ? -1 : +1;
+  if (x->first != y->first)
+    return x->first < y->first ? -1 : +1;
+  return 0;
+}
+
+struct partition_unit_s * partitions_schedule(struct postings_s * pl,
+                                              struct db * d,
+                                              uint64_t * * order,
+                                              uint64_t * unit_count)
+{
+  /*
+    Order the groups of pl by partition, and split them into units of
+    groups with the same length and genes, largest units first. The
+    units are ranges of the returned order.
+  */
+
+  uint64_t groups = pl->group_count;
+  struct partition_key_s * keys = sorted_keys(pl, d);
+
+  *order = static_cast<uint64_t *>
+    (xmalloc(MAX(groups, 1) * sizeof(uint64_t)));
+
+  uint64_t count = 0;
+  for (uint64_t i = 0; i < groups; i++)
+    {
+      (*order)[i] = keys[i].group;
+      if ((i == 0) || ! same_partition(keys + i - 1, keys + i))
+        count++;
+    }
+
+  struct partition_unit_s * units = static_cast<struct partition_unit_s *>
+    (xmalloc(MAX(count, 1) * sizeof(struct partition_unit_s)));
+
+  uint64_t u = 0;
+  for (uint64_t i = 0; i < groups; i++)
+    {
+      if ((i == 0) || ! same_partition(keys + i - 1, keys + i))
+        {
+          units[u].first = i;
+          units[u].count = 0;
+          u++;
+        }
+      units[u - 1].count++;
+    }
+
+  xfree(keys);
+
+  qsort(units, count, sizeof(struct partition_unit_s), compare_units);
+
+  *unit_count = count;
+  return units;
+}
@@ -0,0 +1,96 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Variants index partitioned by sequence length and genes.
+
+  Substitution variants have the same length as the original
+  sequence, and must have the same V and J genes unless genes are
+  ignored, while indel variants are one residue shorter or longer.
+  The distinct sequences of set 2 are therefore split into partitions
+  with the same length, V gene and J gene, each with its own small
+  hash table and Bloom filter. The Bloom filters are at most as large
+  as the level 2 cache, and share one set of bit patterns.
+
+  The queries are split into units with the same length and genes,
+  which are handed to the threads largest first. The table and filter
+  of a partition are built on demand by the first thread needing them,
+  and without indels each partition is only used by a single unit, so
+  that the threads work on their own indices, kept in their cache.
+*/
+
+const int partition_empty = 0;
+const int partition_building = 1;
+const int partition_ready = 2;
+
+struct partition_s
+{
+  unsigned int length;
+  uint64_t v_gene;
+  uint64_t j_gene;
+  uint64_t first;
+  uint64_t count;
+  int state;
+  struct hashtable_s * ht;
+  uint64_t * bitmap;
+  uint64_t mask;
+};
+
+struct partition_unit_s
+{
+  uint64_t first;
+  uint64_t count;
+};
+
+struct partitions_s
+{
+  uint64_t count;
+  struct partition_s * list;
+  struct bloom_s * patterns;
+  uint64_t * bitmap;
+  uint64_t * groups;
+  struct postings_s * pl;
+  struct db * d;
+};
+
+struct partitions_s * partitions_init(struct postings_s * pl, struct db * d);
+
+void partitions_exit(struct partitions_s * ps);
+
+struct partition_s * partitions_get(struct partitions_s * ps,
+                                    unsigned int length,
+                                    uint64_t v_gene,
+                                    uint64_t j_gene);
+
+struct partition_unit_s * partitions_schedule(struct postings_s * pl,
+                                              struct db * d,
+                                              uint64_t * * order,
+                                              uint64_t * unit_count);
+
+inline bool partitions_bloom_get(struct partitions_s * ps,
+                                 struct partition_s * part,
+                                 uint64_t h)
+{
+  /* like bloom_get, but with the bitmap of the partition */
+
+  return ! (part->bitmap[(h >> BLOOM_PATTERN_SHIFT) & part->mask] &
+            bloom_pat(ps->patterns, h));
+}
@@ -0,0 +1,239 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Pigeonhole segment index for Hamming distances d > 2.
+
+  The principle is described in
+
+  Wu S, Manber U (1992)
+  Fast text searching allowing errors
+  Communications of the ACM, 35, 10, 83-91
+  https://doi.org/10.1145/135239.135244
+*/
+
+#include "compairr.h"
+
+#include <algorithm>
+
+struct pigeonhole_s
+{
+  struct db * d;
+  unsigned int segments;
+  unsigned int longest;
+  uint64_t * mix;
+  struct multimap_s * mm;
+};
+
+static inline unsigned int segment_start(unsigned int len,
+                                         unsigned int segments,
+                                         unsigned int s)
+{
+  /* start position of segment s in a sequence of length len */
+  return static_cast<unsigned int>
+    (static_cast<uint64_t>(len) * s / segments);
+}
+
+static inline uint64_t segment_key(struct pigeonhole_s * ph,
+                                   unsigned char * seq,
+                                   unsigned int len,
+                                   unsigned int s,
+                                   int v_gene,
+                                   int j_gene)
+{
+  /* hash of segment s, including sequence length and segment number */
+  unsigned int start = segment_start(len, ph->segments, s);
+  unsigned int end = segment_start(len, ph->segments, s + 1);
+  return zobrist_hash_segment(seq, start, end, v_gene, j_gene)
+    ^ ph->mix[ph->segments * len + s];
+}
+
+static inline bool segment_identical(unsigned char * a,
+                                     unsigned char * b,
+                                     unsigned int len,
+                                     unsigned int segments,
+                                     unsigned int s)
+{
+  unsigned int start = segment_start(len, segments, s);
+  unsigned int end = segment_start(len, segments, s + 1);
+  return ! memcmp(a + start, b + start, end - start);
+}
+
+struct pigeonhole_s * pigeonhole_init(struct db * d,
+                                      unsigned int longest,
+                                      unsigned int segments)
+{
+  /*
+    Index all sequences in d by each of their segments. The longest
+    argument must be the length of the longest sequence that will be
+    either indexed or searched for.
+  */
+
+  struct pigeonhole_s * ph = static_cast<struct pigeonhole_s *>
+    (xmalloc(sizeof(struct pigeonhole_s)));
+
+  ph->d = d;
+  ph->segments = segments;
+  ph->longest = longest;
+
+  /* random values for each combination of length and segment number */
+
+  uint64_t mix_count = static_cast<uint64_t>(longest + 1) * segments;
+  ph->mix = static_cast<uint64_t *>(xmalloc(mix_count * sizeof(uint64_t)));
+  for (uint64_t i = 0; i < mix_count; i++)
+    {
+      uint64_t z;
+      z = arch_random();
+      z <<= 16;
+      z ^= arch_random();
+      z <<= 16;
+      z ^= arch_random();
+      z <<= 16;
+      z ^= arch_random();
+      ph->mix[i] = z;
+    }
+
+  /* compute the key of all segments of all sequences */
+
+  uint64_t sequences = db_getsequencecount(d);
+  uint64_t entry_count = sequences * segments;
+  struct multimap_entry_s * entries = static_cast<struct multimap_entry_s *>
+    (xmalloc(entry_count * sizeof(struct multimap_entry_s)));
+
+  progress_init("Indexing segments:", sequences);
+  for (uint64_t i = 0; i < sequences; i++)
+    {
+      unsigned char * seq = (unsigned char *) db_getsequence(d, i);
+      unsigned int len = db_getsequencelen(d, i);
+      int v_gene = db_get_v_gene(d, i);
+      int j_gene = db_get_j_gene(d, i);
+      for (unsigned int s = 0; s < segments; s++)
+        {
+          struct multimap_entry_s * e = entries + segments * i + s;
+          e->key = segment_key(ph, seq, len, s, v_gene, j_gene);
+          e->seq = i;
+        }
+      progress_update(i);
+    }
+  progress_done();
+
+  ph->mm = multimap_init(entries, entry_count);
+
+  return ph;
+}
+
+void pigeonhole_exit(struct pigeonhole_s * ph)
+{
+  multimap_exit(ph->mm);
+  xfree(ph->mix);
+  xfree(ph);
+}
+
+void pigeonhole_search(struct pigeonhole_s * ph,
+                       struct db * d,
+                       uint64_t seed,
+                       const uint64_t * group_first,
+                       uint64_t * * hits_data,
+                       uint64_t * hits_count,
+                       uint64_t * hits_alloc)
+{
+  /*
+    Find all sequences in the index with at most opt_differences
+    substitutions compared to sequence seed in d. Each hit is reported
+    once, for the first segment that is identical, and the hits are
+    sorted in input order. If group_first is given, sequences whose
+    group starts before seed are skipped.
+  */
+
+  uint64_t first_hit = *hits_count;
+
+  unsigned char * seed_sequence = (unsigned char *) db_getsequence(d, seed);
+  unsigned int seed_seqlen = db_getsequencelen(d, seed);
+  int seed_v_gene = db_get_v_gene(d, seed);
+  int seed_j_gene = db_get_j_gene(d, seed);
+
+  assert(seed_seqlen <= ph->longest);
+
+  for (unsigned int s = 0; s < ph->segments; s++)
+    {
+      uint64_t key = segment_key(ph, seed_sequence, seed_seqlen, s,
+                                 seed_v_gene, seed_j_gene);
+
+      uint64_t first;
+      if (! multimap_find(ph->mm, key, & first))
+        continue;
+
+      for (uint64_t k = first; multimap_match(ph->mm, k, key); k++)
+        {
+          uint64_t hit = multimap_get_seq(ph->mm, k);
+
+          if (group_first && (group_first[hit] < seed))
+            continue;
+
+          /* double check that everything matches */
+
+          if (db_getsequencelen(ph->d, hit) != seed_seqlen)
+            continue;
+
+          if ((! opt_ignore_genes) &&
+              ((db_get_v_gene(ph->d, hit) != (uint64_t) seed_v_gene) ||
+               (db_get_j_gene(ph->d, hit) != (uint64_t) seed_j_gene)))
+            continue;
+
+          unsigned char * hit_sequence
+            = (unsigned char *) db_getsequence(ph->d, hit);
+
+          if (! segment_identical(seed_sequence, hit_sequence,
+                                  seed_seqlen, ph->segments, s))
+            continue;
+
+          /* skip hits already found with a previous segment */
+
+          bool seen = false;
+          for (unsigned int t = 0; t < s; t++)
+            if (segment_identical(seed_sequence, hit_sequence,
+                                  seed_seqlen, ph->segments, t))
+              {
+                seen = true;
+                break;
+              }
+          if (seen)
+            continue;
+
+          if (seq_diff(seed_sequence, hit_sequence, seed_seqlen)
+              <= opt_differences)
+            {
+              if (*hits_alloc <= *hits_count)
+                {
+                  *hits_alloc += 1024;
+                  *hits_data = static_cast<uint64_t *>
+                    (xrealloc((*hits_data),
+                              (*hits_alloc) * sizeof(uint64_t)));
+                }
+              (*hits_data)[(*hits_count)++] = hit;
+            }
+        }
+    }
+
+  /* report the hits in input order, not in the order of the segments */
+
+  std::sort(*hits_data + first_hit, *hits_data + *hits_count);
+}
@@ -0,0 +1,48 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Pigeonhole segment index for Hamming distances d > 2.
+
+  Each sequence is split into d+1 segments of (almost) equal length.
+  Two sequences of the same length with at most d substitutions must
+  then have at least one identical segment. The sequences of a set are
+  indexed by the hash of each segment (including the sequence length,
+  segment number and, unless genes are ignored, the V and J genes).
+  Candidates found by looking up the segments of a query sequence are
+  verified by counting the differences.
+*/
+
+struct pigeonhole_s;
+
+struct pigeonhole_s * pigeonhole_init(struct db * d,
+                                      unsigned int longest,
+                                      unsigned int segments);
+
+void pigeonhole_exit(struct pigeonhole_s * ph);
+
+void pigeonhole_search(struct pigeonhole_s * ph,
+                       struct db * d,
+                       uint64_t seed,
+                       const uint64_t * group_first,
+                       uint64_t * * hits_data,
+                       uint64_t * hits_count,
+                       uint64_t * hits_alloc);
@@ -0,0 +1,359 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+static bool same_sequence(struct db * d, uint64_t a, uint64_t b)
+{
+  /* check that sequences and, unless ignored, genes are identical */
+
+  if ((! opt_ignore_genes) &&
+      ((db_get_v_gene(d, a) != db_get_v_gene(d, b)) ||
+       (db_get_j_gene(d, a) != db_get_j_gene(d, b))))
+    return false;
+
+  unsigned int a_len = db_getsequencelen(d, a);
+  unsigned int b_len = db_getsequencelen(d, b);
+
+  return (a_len == b_len) &&
+    ! memcmp(db_getsequence(d, a), db_getsequence(d, b), a_len);
+}
+
+/* state shared by the threads while grouping the sequences */
+
+static struct db * build_db = nullptr;
+static struct hashtable_s * build_ht = nullptr;
+static uint64_t * build_rep = nullptr;
+static uint64_t * build_slot = nullptr;
+static struct hash_owners_s * build_owners = nullptr;
+
+static void group_thread(int64_t t)
+{
+  /*
+    Find the first identical sequence (the representative) of each
+    sequence with a hash owned by this thread, in input order, and
+    insert the new representatives into the hash table.
+  */
+
+  struct db * d = build_db;
+  struct hashtable_s * ht = build_ht;
+  struct hash_owners_s * ho = build_owners;
+  uint64_t owners = static_cast<uint64_t>(opt_threads);
+
+  for (uint64_t k = hash_owners_first(ho, t); k < hash_owners_last(ho, t); k++)
+    {
+      uint64_t i = hash_owners_get(ho, k);
+      uint64_t hash = db_gethash(d, i);
+
+      if (t == 0)
+        progress_update(k * owners);
+
+      unsigned int length = db_getsequencelen(d, i);
+      uint16_t tag = hash_gene_tag(db_get_v_gene(d, i), db_get_j_gene(d, i));
+      struct hash_probe_s probe;
+      uint64_t j;
+      bool found = false;
+
+      hash_probe_init<true>(ht, hash, & probe);
+      while (hash_probe_next<true>(ht, & probe, & j))
+        {
+          if (hash_compare_bucket(ht, j, hash, length, tag) &&
+              same_sequence(d, hash_get_data(ht, j), i))
+            {
+              found = true;
+              break;
+            }
+        }
+
+      if (found)
+        {
+          build_rep[i] = hash_get_data(ht, j);
+        }
+      else
+        {
+          j = hash_claim_empty(ht, hash);
+          hash_set_value(ht, j, hash);
+          hash_set_data(ht, j, i);
+          hash_set_info(ht, j, length, tag);
+          hash_publish(ht, j, hash);
+          build_rep[i] = i;
+          build_slot[i] = j;
+        }
+    }
+}
+
+struct postings_s * postings_init(struct db * d, uint64_t * duplicates)
+{
+  /*
+    Group the sequences in d. The sequence hashes must have been
+    computed. The number of exact duplicates (same repertoire,
+    sequence, V gene and J gene) is returned in duplicates.
+  */
+
+  struct postings_s * pl = static_cast<struct postings_s *>
+    (xmalloc(sizeof(struct postings_s)));
+
+  uint64_t sequences = db_getsequencecount(d);
+
+  pl->ht = hash_init(sequences, sequences);
+  pl->narrow = rows_fit_32(sequences);
+  pl->mphf = nullptr;
+  pl->slot_count = 0;
+  pl->fingerprint = nullptr;
+  pl->slot_first = nullptr;
+  pl->group_count = 0;
+
+  /* first sequence of each group, and the group of each sequence */
+
+  uint64_t * group_seq = static_cast<uint64_t *>
+    (xmalloc(MAX(sequences, 1) * sizeof(uint64_t)));
+  uint64_t * seq_group = static_cast<uint64_t *>
+    (xmalloc(MAX(sequences, 1) * sizeof(uint64_t)));
+
+  pl->group_first = static_cast<uint64_t *>
+    (xmalloc((sequences + 1) * sizeof(uint64_t)));
+
+  /* find the representatives in parallel, with the slots in group_seq */
+
+  build_db = d;
+  build_ht = pl->ht;
+  build_rep = seq_group;
+  build_slot = group_seq;
+  build_owners = hash_owners_init(d);
+
+  progress_init("Hashing sequences:", sequences);
+  threads_run(group_thread);
+  progress_done();
+
+  hash_owners_exit(build_owners);
+  build_owners = nullptr;
+  build_db = nullptr;
+  build_ht = nullptr;
+  build_rep = nullptr;
+  build_slot = nullptr;
+
+  /* number the groups in input order, and count their sizes */
+
+  for (uint64_t i = 0; i < sequences; i++)
+    {
+      uint64_t g;
+      if (seq_group[i] == i)
+        {
+          g = pl->group_count++;
+          hash_set_data(pl->ht, group_seq[i], g);
+          group_seq[g] = i;
+          pl->group_first[g] = 0;
+        }
+      else
+        g = seq_group[seq_group[i]];
+      seq_group[i] = g;
+      pl->group_first[g]++;
+    }
+
+  /* turn the group sizes into start positions */
+
+  uint64_t * next = group_seq;
+  uint64_t sum = 0;
+  for (uint64_t g = 0; g < pl->group_count; g++)
+    {
+      uint64_t size = pl->group_first[g];
+      pl->group_first[g] = sum;
+      next[g] = sum;
+      sum += size;
+    }
+  pl->group_first[pl->group_count] = sum;
+
+  /* fill in the posting lists in input order */
+
+  pl->list = xmalloc(MAX(sequences, 1) * postings_row_size(pl));
+
+  for (uint64_t i = 0; i < sequences; i++)
+    {
+      struct posting_s p;
+      p.seq = i;
+      p.count = db_get_count(d, i);
+      p.repertoire = db_get_repertoire_id_no(d, i);
+      postings_set(pl, next[seq_group[i]]++, & p);
+    }
+
+  xfree(seq_group);
+  xfree(group_seq);
+
+  /* count repertoires occurring more than once in the same group */
+
+  uint64_t repertoires = db_get_repertoire_count(d);
+  uint64_t * last_group = static_cast<uint64_t *>
+    (xmalloc(MAX(repertoires, 1) * sizeof(uint64_t)));
+  for (uint64_t r = 0; r < repertoires; r++)
+    last_group[r] = UINT64_MAX;
+
+  uint64_t dup = 0;
+  for (uint64_t g = 0; g < pl->group_count; g++)
+    for (uint64_t k = pl->group_first[g]; k < pl->group_first[g + 1]; k++)
+      {
+        unsigned int r = postings_get(pl, k).repertoire;
+        if (last_group[r] == g)
+          dup++;
+        else
+          last_group[r] = g;
+      }
+
+  xfree(last_group);
+
+  *duplicates = dup;
+
+  return pl;
+}
+
+static int compare_hashes(const void * a, const void * b)
+{
+  uint64_t x = * static_cast<const uint64_t *>(a);
+  uint64_t y = * static_cast<const uint64_t *>(b);
+  if (x < y)
+    return -1;
+  else if (x > y)
+    return +1;
+  else
+    return 0;
+}
+
+void postings_perfect_hash(struct postings_s * pl, struct db * d)
+{
+  /*
+    Replace the hash table with a minimal perfect hash function over
+    the distinct hash values of the groups, and reorder the groups by
+    the number given to their hash value.
+  */
+
+  uint64_t groups = pl->group_count;
+
+  uint64_t * group_hash = static_cast<uint64_t *>
+    (xmalloc(MAX(groups, 1) * sizeof(uint64_t)));
+  uint64_t * keys = static_cast<uint64_t *>
+    (xmalloc(MAX(groups, 1) * sizeof(uint64_t)));
+
+  for (uint64_t g = 0; g < groups; g++)
+    {
+      group_hash[g] = db_gethash(d, postings_get(pl, pl->group_first[g]).seq);
+      keys[g] = group_hash[g];
+    }
+
+  /* different sequences may rarely have the same hash value */
+
+  qsort(keys, groups, sizeof(uint64_t), compare_hashes);
+  uint64_t slots = 0;
+  for (uint64_t g = 0; g < groups; g++)
+    if ((slots == 0) || (keys[g] != keys[slots - 1]))
+      keys[slots++] = keys[g];
+
+  pl->mphf = mphf_init(keys, slots);
+  pl->slot_count = slots;
+  xfree(keys);
+
+  /* count the groups in each slot and record their fingerprints */
+
+  pl->fingerprint = static_cast<uint16_t *>
+    (xmalloc(MAX(slots, 1) * sizeof(uint16_t)));
+  uint64_t * next = static_cast<uint64_t *>
+    (xmalloc((slots + 1) * sizeof(uint64_t)));
+  memset(next, 0, (slots + 1) * sizeof(uint64_t));
+
+  uint64_t * group_slot = group_hash;
+  for (uint64_t g = 0; g < groups; g++)
+    {
+      uint64_t s = mphf_lookup(pl->mphf, group_hash[g]);
+      pl->fingerprint[s] = postings_fingerprint(group_hash[g]);
+      group_slot[g] = s;
+      next[s]++;
+    }
+
+  uint64_t sum = 0;
+  for (uint64_t s = 0; s < slots; s++)
+    {
+      uint64_t size = next[s];
+      next[s] = sum;
+      sum += size;
+    }
+  next[slots] = sum;
+
+  if (slots < groups)
+    {
+      pl->slot_first = static_cast<uint64_t *>
+        (xmalloc((slots + 1) * sizeof(uint64_t)));
+      memcpy(pl->slot_first, next, (slots + 1) * sizeof(uint64_t));
+    }
+
+  /* new position of each group, keeping their order within a slot */
+
+  uint64_t * group_order = static_cast<uint64_t *>
+    (xmalloc(MAX(groups, 1) * sizeof(uint64_t)));
+  for (uint64_t g = 0; g < groups; g++)
+    group_order[next[group_slot[g]]++] = g;
+  xfree(next);
+  xfree(group_hash);
+
+  /* move the posting lists to the new order of the groups */
+
+  uint64_t * group_first = static_cast<uint64_t *>
+    (xmalloc((groups + 1) * sizeof(uint64_t)));
+  uint64_t row_size = postings_row_size(pl);
+  char * old_list = static_cast<char *>(pl->list);
+  char * list = static_cast<char *>
+    (xmalloc(MAX(pl->group_first[groups], 1) * row_size));
+
+  uint64_t k = 0;
+  for (uint64_t h = 0; h < groups; h++)
+    {
+      uint64_t g = group_order[h];
+      uint64_t size = pl->group_first[g + 1] - pl->group_first[g];
+      group_first[h] = k;
+      memcpy(list + k * row_size,
+             old_list + pl->group_first[g] * row_size,
+             size * row_size);
+      k += size;
+    }
+  group_first[groups] = k;
+
+  xfree(group_order);
+  xfree(pl->group_first);
+  xfree(pl->list);
+  pl->group_first = group_first;
+  pl->list = list;
+
+  hash_exit(pl->ht);
+  pl->ht = nullptr;
+}
+
+void postings_exit(struct postings_s * pl)
+{
+  if (pl->ht)
+    hash_exit(pl->ht);
+  if (pl->mphf)
+    {
+      mphf_exit(pl->mphf);
+      xfree(pl->fingerprint);
+      if (pl->slot_first)
+        xfree(pl->slot_first);
+    }
+  xfree(pl->group_first);
+  xfree(pl->list);
+  xfree(pl);
+}
@@ -0,0 +1,165 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Grouped index of the distinct sequences in a repertoire set.
+
+  Each distinct combination of sequence, V gene and J gene (or just
+  sequence, if genes are ignored) is stored once in the hash table,
+  with the group number as data. The rows of each group are stored
+  consecutively in the posting list, in the order they appear in the
+  input, together with their repertoire and count. Public sequences
+  present in many repertoires are thereby verified only once. The row
+  numbers in the posting lists are stored in 32 bits whenever
+  rows_fit_32 allows it, giving 16-byte postings, and in 64 bits
+  otherwise. postings_get returns a posting with 64-bit fields in
+  either case.
+
+  When the set is not changed any more, the hash table may be replaced
+  by a minimal perfect hash function over the distinct hash values,
+  with a 16-bit fingerprint for each of them. The groups are then
+  reordered so that the groups with the hash value numbered s by the
+  function start at slot_first[s], or simply are group s if all
+  hash values are distinct.
+*/
+
+struct posting_s
+{
+  uint64_t seq;
+  uint64_t count;
+  unsigned int repertoire;
+};
+
+template <typename row_t>
+struct posting_row_s
+{
+  uint64_t count;
+  row_t seq;
+  unsigned int repertoire;
+};
+
+struct postings_s
+{
+  bool narrow;
+  struct hashtable_s * ht;
+  struct mphf_s * mphf;
+  uint64_t slot_count;
+  uint16_t * fingerprint;
+  uint64_t * slot_first;
+  uint64_t group_count;
+  uint64_t * group_first;
+  void * list;
+};
+
+struct postings_s * postings_init(struct db * d, uint64_t * duplicates);
+
+void postings_exit(struct postings_s * pl);
+
+void postings_perfect_hash(struct postings_s * pl, struct db * d);
+
+inline uint16_t postings_fingerprint(uint64_t hash)
+{
+  return static_cast<uint16_t>(hash >> 48);
+}
+
+inline bool postings_lookup(struct postings_s * pl,
+                            uint64_t hash,
+                            uint64_t * first_group,
+                            uint64_t * last_group)
+{
+  /* find the groups that may have the given hash, perfect hash only */
+
+  uint64_t s = mphf_lookup(pl->mphf, hash);
+  if ((s >= pl->slot_count) ||
+      (pl->fingerprint[s] != postings_fingerprint(hash)))
+    return false;
+
+  if (pl->slot_first)
+    {
+      *first_group = pl->slot_first[s];
+      *last_group = pl->slot_first[s + 1];
+    }
+  else
+    {
+      *first_group = s;
+      *last_group = s + 1;
+    }
+  return true;
+}
+
+inline uint64_t postings_get_first(struct postings_s * pl, uint64_t g)
+{
+  return pl->group_first[g];
+}
+
+inline uint64_t postings_get_last(struct postings_s * pl, uint64_t g)
+{
+  /* one past the last posting of group g */
+  return pl->group_first[g + 1];
+}
+
+template <typename row_t>
+inline struct posting_s postings_get_row(struct postings_s * pl, uint64_t k)
+{
+  posting_row_s<row_t> * r
+    = static_cast<posting_row_s<row_t> *>(pl->list) + k;
+  struct posting_s p;
+  p.seq = r->seq;
+  p.count = r->count;
+  p.repertoire = r->repertoire;
+  return p;
+}
+
+inline struct posting_s postings_get(struct postings_s * pl, uint64_t k)
+{
+  if (pl->narrow)
+    return postings_get_row<uint32_t>(pl, k);
+  else
+    return postings_get_row<uint64_t>(pl, k);
+}
+
+template <typename row_t>
+inline void postings_set_row(struct postings_s * pl,
+                             uint64_t k,
+                             struct posting_s * p)
+{
+  posting_row_s<row_t> * r
+    = static_cast<posting_row_s<row_t> *>(pl->list) + k;
+  r->seq = static_cast<row_t>(p->seq);
+  r->count = p->count;
+  r->repertoire = p->repertoire;
+}
+
+inline void postings_set(struct postings_s * pl,
+                         uint64_t k,
+                         struct posting_s * p)
+{
+  if (pl->narrow)
+    postings_set_row<uint32_t>(pl, k, p);
+  else
+    postings_set_row<uint64_t>(pl, k, p);
+}
+
+inline uint64_t postings_row_size(struct postings_s * pl)
+{
+  return pl->narrow ?
+    sizeof(posting_row_s<uint32_t>) : sizeof(posting_row_s<uint64_t>);
+}
@@ -0,0 +1,127 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+struct sparse_s * sparse_init(uint64_t width)
+{
+  struct sparse_s * sp = static_cast<struct sparse_s *>
+    (xmalloc(sizeof(struct sparse_s)));
+
+  sp->count = 0;
+  sp->alloc = 1024;
+  sp->cells = static_cast<struct sparse_cell_s *>
+    (xmalloc(sp->alloc * sizeof(struct sparse_cell_s)));
+
+  sp->width = width;
+  sp->row = 0;
+  sp->acc = static_cast<double *>
+    (xmalloc(MAX(width, 1) * sizeof(double)));
+  sp->stamp = static_cast<uint64_t *>
+    (xmalloc(MAX(width, 1) * sizeof(uint64_t)));
+  sp->touched = static_cast<uint64_t *>
+    (xmalloc(MAX(width, 1) * sizeof(uint64_t)));
+  sp->touched_count = 0;
+
+  for (uint64_t c = 0; c < width; c++)
+    sp->stamp[c] = 0;
+
+  return sp;
+}
+
+void sparse_exit(struct sparse_s * sp)
+{
+  xfree(sp->touched);
+  xfree(sp->stamp);
+  xfree(sp->acc);
+  xfree(sp->cells);
+  xfree(sp);
+}
+
+static void sparse_reserve(struct sparse_s * sp, uint64_t n)
+{
+  if (sp->count + n > sp->alloc)
+    {
+      while (sp->count + n > sp->alloc)
+        sp->alloc *= 2;
+      sp->cells = static_cast<struct sparse_cell_s *>
+        (xrealloc(sp->cells, sp->alloc * sizeof(struct sparse_cell_s)));
+    }
+}
+
+void sparse_row_end(struct sparse_s * sp)
+{
+  /* append the touched cells of the current row */
+
+  sparse_reserve(sp, sp->touched_count);
+
+  for (uint64_t k = 0; k < sp->touched_count; k++)
+    {
+      uint64_t col = sp->touched[k];
+      struct sparse_cell_s * cell = sp->cells + sp->count++;
+      cell->row = sp->row;
+      cell->col = col;
+      cell->value = sp->acc[col];
+    }
+
+  sp->touched_count = 0;
+}
+
+void sparse_merge(struct sparse_s * total, struct sparse_s * sp)
+{
+  /* append the cells of sp, no row may be in both */
+
+  if (total->count == 0)
+    {
+      /* just swap the lists */
+      struct sparse_cell_s * cells = total->cells;
+      uint64_t alloc = total->alloc;
+      total->cells = sp->cells;
+      total->alloc = sp->alloc;
+      total->count = sp->count;
+      sp->cells = cells;
+      sp->alloc = alloc;
+      sp->count = 0;
+      return;
+    }
+
+  sparse_reserve(total, sp->count);
+  memcpy(total->cells + total->count, sp->cells,
+         sp->count * sizeof(struct sparse_cell_s));
+  total->count += sp->count;
+}
+
+static int compare_cells(const void * a, const void * b)
+{
+  const struct sparse_cell_s * x = static_cast<const struct sparse_cell_s *>(a);
+  const struct sparse_cell_s * y = static_cast<const struct sparse_cell_s *>(b);
+
+  if (x->row != y->row)
+    return x->row < y->row ? -1 : +1;
+  if (x->col != y->col)
+    return x->col < y->col ? -1 : +1;
+  return 0;
+}
+
+void sparse_sort(struct sparse_s * sp)
+{
+  qsort(sp->cells, sp->count, sizeof(struct sparse_cell_s), compare_cells);
+}
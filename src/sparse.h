@@ -0,0 +1,79 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Sparse accumulation of a matrix with many rows, used for the results
+  of existence (-x) computations. Each thread adds the values of one
+  row at a time into a dense row accumulator, keeping a list of the
+  columns touched, and then appends the non-empty cells of the row to
+  its own list of cells. The lists of the threads are concatenated and
+  sorted by row and column at the end. Memory use is proportional to
+  the number of non-empty cells.
+*/
+
+struct sparse_cell_s
+{
+  uint64_t row;
+  uint64_t col;
+  double value;
+};
+
+struct sparse_s
+{
+  uint64_t count;
+  uint64_t alloc;
+  struct sparse_cell_s * cells;
+
+  uint64_t width;
+  uint64_t row;
+  double * acc;
+  uint64_t * stamp;
+  uint64_t * touched;
+  uint64_t touched_count;
+};
+
+struct sparse_s * sparse_init(uint64_t width);
+
+void sparse_exit(struct sparse_s * sp);
+
+void sparse_row_end(struct sparse_s * sp);
+
+void sparse_merge(struct sparse_s * total, struct sparse_s * sp);
+
+void sparse_sort(struct sparse_s * sp);
+
+inline void sparse_row_begin(struct sparse_s * sp, uint64_t row)
+{
+  sp->row = row;
+}
+
+inline void sparse_add(struct sparse_s * sp, uint64_t col, double value)
+{
+  /* the stamp of a column is the row it was last touched in, plus 1 */
+
+  if (sp->stamp[col] != sp->row + 1)
+    {
+      sp->stamp[col] = sp->row + 1;
+      sp->acc[col] = 0;
+      sp->touched[sp->touched_count++] = col;
+    }
+  sp->acc[col] += value;
+}
@@ -0,0 +1,293 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+static int64_t pool_size = 1;
+static pthread_t * pool_threads = nullptr;
+static pthread_mutex_t pool_mutex;
+static pthread_cond_t pool_work;
+static pthread_cond_t pool_done;
+static uint64_t pool_generation = 0;
+static int64_t pool_busy = 0;
+static bool pool_quit = false;
+static bool pool_running = false;
+static const std::function<void(int64_t t)> * pool_job = nullptr;
+
+/* number of nested jobs being run serially by this thread */
+
+static thread_local int64_t serial_depth = 0;
+
+static pthread_mutex_t barrier_mutex;
+static pthread_cond_t barrier_cond;
+static int64_t barrier_waiting = 0;
+static uint64_t barrier_generation = 0;
+
+static const uint64_t memset_chunk = 1024 * 1024;
+
+static bool threads_pin(int64_t count)
+{
+  /* pin thread t to the t-th CPU allowed for the process, cyclically */
+
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(cpu_set_t), & allowed))
+    return false;
+
+  int cpus[CPU_SETSIZE];
+  int cpu_count = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, & allowed))
+      cpus[cpu_count++] = cpu;
+  if (cpu_count == 0)
+    return false;
+
+  numa_spread(cpus, cpu_count);
+
+  for (int64_t t = 0; t < count; t++)
+    {
+      cpu_set_t one;
+      CPU_ZERO(& one);
+      CPU_SET(cpus[t % cpu_count], & one);
+      pthread_t thread = t ? pool_threads[t - 1] : pthread_self();
+      if (pthread_setaffinity_np(thread, sizeof(cpu_set_t), & one))
+        return false;
+    }
+  return true;
+#else
+  (void) count;
+  return false;
+#endif
+}
+
+static void * threads_worker(void * vp)
+{
+  int64_t t = reinterpret_cast<intptr_t>(vp);
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(& pool_mutex);
+
+  /* loop until signalled to quit */
+  while (true)
+    {
+      /* wait for a new job */
+      while ((pool_generation == seen) && ! pool_quit)
+        pthread_cond_wait(& pool_work, & pool_mutex);
+
+      if (pool_quit)
+        break;
+
+      seen = pool_generation;
+      const std::function<void(int64_t t)> * job = pool_job;
+
+      pthread_mutex_unlock(& pool_mutex);
+      (*job)(t);
+      pthread_mutex_lock(& pool_mutex);
+
+      pool_busy--;
+      if (pool_busy == 0)
+        pthread_cond_signal(& pool_done);
+    }
+
+  pthread_mutex_unlock(& pool_mutex);
+  return nullptr;
+}
+
+void threads_init(int64_t count, bool pin)
+{
+  pool_size = count;
+  pool_generation = 0;
+  pool_busy = 0;
+  pool_quit = false;
+
+  pthread_mutex_init(& pool_mutex, nullptr);
+  pthread_cond_init(& pool_work, nullptr);
+  pthread_cond_init(& pool_done, nullptr);
+  pthread_mutex_init(& barrier_mutex, nullptr);
+  pthread_cond_init(& barrier_cond, nullptr);
+  barrier_waiting = 0;
+  barrier_generation = 0;
+
+  pool_threads = static_cast<pthread_t *>
+    (xmalloc(MAX(count - 1, 1) * sizeof(pthread_t)));
+
+  pthread_attr_t attr;
+  pthread_attr_init(& attr);
+  pthread_attr_setdetachstate(& attr, PTHREAD_CREATE_JOINABLE);
+
+  for (int64_t t = 1; t < count; t++)
+    if (pthread_create(pool_threads + t - 1,
+                       & attr,
+                       threads_worker,
+                       reinterpret_cast<void *>(static_cast<intptr_t>(t))))
+      fatal("Cannot create thread");
+
+  pthread_attr_destroy(& attr);
+
+  if (pin && ! threads_pin(count))
+    fprintf(logfile, "Warning: Unable to pin threads to CPUs\n");
+}
+
+void threads_exit()
+{
+  pthread_mutex_lock(& pool_mutex);
+  pool_quit = true;
+  pthread_cond_broadcast(& pool_work);
+  pthread_mutex_unlock(& pool_mutex);
+
+  for (int64_t t = 1; t < pool_size; t++)
+    if (pthread_join(pool_threads[t - 1], nullptr))
+      fatal("Cannot join thread");
+
+  xfree(pool_threads);
+  pool_threads = nullptr;
+
+  pthread_cond_destroy(& barrier_cond);
+  pthread_mutex_destroy(& barrier_mutex);
+  pthread_cond_destroy(& pool_done);
+  pthread_cond_destroy(& pool_work);
+  pthread_mutex_destroy(& pool_mutex);
+
+  pool_size = 1;
+}
+
+void threads_run(const std::function<void(int64_t t)> & f)
+{
+  /*
+    Run f on all threads, in this thread only if there is just one.
+    A call from within a job, like building a partition table inside
+    a search thread, also runs f only in the calling thread.
+  */
+
+  if (pool_size == 1)
+    {
+      f(0);
+      return;
+    }
+
+  if (__atomic_load_n(& pool_running, __ATOMIC_ACQUIRE))
+    {
+      serial_depth++;
+      f(0);
+      serial_depth--;
+      return;
+    }
+
+  __atomic_store_n(& pool_running, true, __ATOMIC_RELEASE);
+
+  pthread_mutex_lock(& pool_mutex);
+  pool_job = & f;
+  pool_busy = pool_size - 1;
+  pool_generation++;
+  pthread_cond_broadcast(& pool_work);
+  pthread_mutex_unlock(& pool_mutex);
+
+  f(0);
+
+  pthread_mutex_lock(& pool_mutex);
+  while (pool_busy > 0)
+    pthread_cond_wait(& pool_done, & pool_mutex);
+  pool_job = nullptr;
+  pthread_mutex_unlock(& pool_mutex);
+
+  __atomic_store_n(& pool_running, false, __ATOMIC_RELEASE);
+}
+
+bool threads_running()
+{
+  return __atomic_load_n(& pool_running, __ATOMIC_ACQUIRE);
+}
+
+void threads_barrier()
+{
+  /* a serial job has no other threads to wait for */
+
+  if ((pool_size == 1) || (serial_depth > 0) ||
+      ! __atomic_load_n(& pool_running, __ATOMIC_ACQUIRE))
+    return;
+
+  pthread_mutex_lock(& barrier_mutex);
+  uint64_t generation = barrier_generation;
+  barrier_waiting++;
+  if (barrier_waiting == pool_size)
+    {
+      barrier_waiting = 0;
+      barrier_generation++;
+      pthread_cond_broadcast(& barrier_cond);
+    }
+  else
+    {
+      while (generation == barrier_generation)
+        pthread_cond_wait(& barrier_cond, & barrier_mutex);
+    }
+  pthread_mutex_unlock(& barrier_mutex);
+}
+
+void threads_parallel_for(uint64_t begin,
+                          uint64_t end,
+                          uint64_t chunk,
+                          const std::function<void(int64_t t,
+                                                   uint64_t first,
+                                                   uint64_t last)> & f)
+{
+  if (begin >= end)
+    return;
+
+  uint64_t size = end - begin;
+  if (chunk == 0)
+    chunk = MAX(1, size / (4 * static_cast<uint64_t>(pool_size)));
+
+  if ((pool_size == 1) || (size <= chunk))
+    {
+      f(0, begin, end);
+      return;
+    }
+
+  uint64_t next = begin;
+
+  threads_run([&](int64_t t)
+              {
+                while (true)
+                  {
+                    uint64_t first = __atomic_fetch_add(& next, chunk,
+                                                        __ATOMIC_RELAXED);
+                    if (first >= end)
+                      break;
+                    f(t, first, MIN(first + chunk, end));
+                  }
+              });
+}
+
+void threads_memset(void * s, int c, uint64_t n)
+{
+  unsigned char * p = static_cast<unsigned char *>(s);
+
+  threads_parallel_for(0, n, memset_chunk,
+                       [=](int64_t t, uint64_t first, uint64_t last)
+                       {
+                         (void) t;
+                         memset(p + first, c, last - first);
+                       });
+}
@@ -19,129 +19,50 @@
     PO Box 1080 Blindern, NO-0316 Oslo, Norway
 */
 
-class ThreadRunner
-{
-private:
-
-  int64_t thread_count;
-
-  pthread_attr_t attr;
-
-  struct thread_s
-  {
-    int64_t t;
-    void (*fun)(int64_t t);
-    pthread_t pthread;
-    pthread_mutex_t workmutex;
-    pthread_cond_t workcond;
-    int64_t work; /* 1: work available, 0: wait, -1: quit */
-  } * thread_array;
-
-  static void * worker(void * vp)
-  {
-    struct thread_s * tip = static_cast<struct thread_s *>(vp);
-
-    pthread_mutex_lock(&tip->workmutex);
-
-    /* loop until signalled to quit */
-    while (tip->work >= 0)
-      {
-        /* wait for work available */
-        if (tip->work == 0)
-          pthread_cond_wait(&tip->workcond, &tip->workmutex);
-
-        if (tip->work > 0)
-          {
-            (*tip->fun)(tip->t);
-            tip->work = 0;
-            pthread_cond_signal(&tip->workcond);
-          }
-      }
-
-    pthread_mutex_unlock(&tip->workmutex);
-    return nullptr;
-  }
-
-public:
-
-  ThreadRunner(int t, void (*f)(int64_t t))
-  {
-    thread_count = t;
-
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-    /* allocate memory for thread data */
-    thread_array = static_cast<struct thread_s *>
-      (xmalloc(static_cast<uint64_t>(thread_count) * sizeof(struct thread_s)));
-
-    /* init and create worker threads */
-    for(int64_t i=0; i<thread_count; i++)
-      {
-        struct thread_s * tip = thread_array + i;
-        tip->t = i;
-        tip->work = 0;
-        tip->fun = f;
-        pthread_mutex_init(&tip->workmutex, nullptr);
-        pthread_cond_init(&tip->workcond, nullptr);
-        if (pthread_create(&tip->pthread,
-                           &attr,
-                           worker,
-                           static_cast<void*>(thread_array + i)))
-          fatal("Cannot create thread");
-      }
-  }
-
-  ~ThreadRunner()
-  {
-    /* ask threads to quit */
-    /* sleep until they have quit */
-    /* destroy threads */
-    /* finish and clean up worker threads */
-
-    for(int64_t i=0; i<thread_count; i++)
-      {
-        struct thread_s * tip = thread_array + i;
-
-        /* tell worker to quit */
-        pthread_mutex_lock(&tip->workmutex);
-        tip->work = -1;
-        pthread_cond_signal(&tip->workcond);
-        pthread_mutex_unlock(&tip->workmutex);
-
-        /* wait for worker to quit */
-        if (pthread_join(tip->pthread, nullptr))
-          fatal("Cannot join thread");
-
-        pthread_cond_destroy(&tip->workcond);
-        pthread_mutex_destroy(&tip->workmutex);
-      }
-
-    xfree(thread_array);
-    pthread_attr_destroy(&attr);
-  }
-
-  void run()
-  {
-    /* wake up threads */
-    for(int64_t i=0; i<thread_count; i++)
-      {
-        struct thread_s * tip = thread_array + i;
-        pthread_mutex_lock(&tip->workmutex);
-        tip->work = 1;
-        pthread_cond_signal(&tip->workcond);
-        pthread_mutex_unlock(&tip->workmutex);
-      }
-
-    /* wait for threads to finish their work */
-    for(int64_t i=0; i<thread_count; i++)
-      {
-        struct thread_s * tip = thread_array + i;
-        pthread_mutex_lock(&tip->workmutex);
-        while (tip->work > 0)
-          pthread_cond_wait(&tip->workcond, &tip->workmutex);
-        pthread_mutex_unlock(&tip->workmutex);
-      }
-  }
-};
+/*
+  A pool of worker threads that lives for the whole run. The calling
+  thread takes part in the work as thread 0, so that the pool has
+  opt_threads - 1 workers of its own. The workers may optionally be
+  pinned to one CPU each, in the order they are allowed for the
+  process.
+*/
+
+void threads_init(int64_t count, bool pin);
+
+void threads_exit();
+
+/*
+  Run f(t) on all threads, t = 0 .. count-1, and wait for them. When
+  called from within a running job, f(0) is run in the calling thread.
+*/
+
+void threads_run(const std::function<void(int64_t t)> & f);
+
+/* true while a job is running */
+
+bool threads_running();
+
+/*
+  Wait until all threads of the current threads_run have got here.
+  Returns at once outside a job and within a nested job, which is run
+  by the calling thread alone.
+*/
+
+void threads_barrier();
+
+/*
+  Call f(t, first, last) for chunks of the range [begin, end), handed
+  to the threads in order as they become idle. A chunk size of 0
+  selects about 4 chunks per thread.
+*/
+
+void threads_parallel_for(uint64_t begin,
+                          uint64_t end,
+                          uint64_t chunk,
+                          const std::function<void(int64_t t,
+                                                   uint64_t first,
+                                                   uint64_t last)> & f);
+
+/* memset in parallel, in chunks of 1MB */
 
+void threads_memset(void * s, int c, uint64_t n);
@@ -0,0 +1,516 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+#include <algorithm>
+
+/*
+  The nodes are stored in a single array. The children of a node are
+  linked through next_sibling in increasing order of their first
+  residue. Node 0 is always a root, so 0 is used to mark missing
+  links. Chains of nodes with a single child and no sequences ending
+  in them are merged, so that each edge is labelled with a string of
+  residues. The labels are stored consecutively in the order the
+  nodes are created, close to the order they are visited in. The
+  sequences ending in a node are given by seq_first and seq_count as
+  a range in the sorted order of sequences.
+*/
+
+struct trie_node_s
+{
+  uint64_t first_child;
+  uint64_t next_sibling;
+  uint64_t seq_first;
+  uint64_t label;
+  unsigned int label_len;
+  unsigned int seq_count;
+};
+
+struct trie_group_s
+{
+  uint64_t v_gene;
+  uint64_t j_gene;
+  uint64_t root;
+};
+
+struct trie_s
+{
+  struct db * d;
+  unsigned int longest;
+  uint64_t * order;
+  uint64_t node_count;
+  struct trie_node_s * nodes;
+  uint64_t label_size;
+  unsigned char * labels;
+  uint64_t group_count;
+  struct trie_group_s * groups;
+};
+
+struct trie_search_s
+{
+  struct trie_s * tr;
+  unsigned char * seq;
+  unsigned int len;
+  unsigned int maxdiff;
+  unsigned int * rows;
+  uint64_t * * hits_data;
+  uint64_t * hits_count;
+  uint64_t * hits_alloc;
+};
+
+static const uint64_t stack_cells = 4096;
+
+static struct db * sort_db = nullptr;
+
+static bool same_genes(struct db * d, uint64_t a, uint64_t b)
+{
+  return opt_ignore_genes ||
+    ((db_get_v_gene(d, a) == db_get_v_gene(d, b)) &&
+     (db_get_j_gene(d, a) == db_get_j_gene(d, b)));
+}
+
+static bool compare_sequences(const uint64_t & a, const uint64_t & b)
+{
+  /* order by V gene, J gene, and then sequence with prefixes first */
+
+  if (! opt_ignore_genes)
+    {
+      uint64_t a_v = db_get_v_gene(sort_db, a);
+      uint64_t b_v = db_get_v_gene(sort_db, b);
+      if (a_v != b_v)
+        return a_v < b_v;
+
+      uint64_t a_j = db_get_j_gene(sort_db, a);
+      uint64_t b_j = db_get_j_gene(sort_db, b);
+      if (a_j != b_j)
+        return a_j < b_j;
+    }
+
+  unsigned int a_len = db_getsequencelen(sort_db, a);
+  unsigned int b_len = db_getsequencelen(sort_db, b);
+  int r = memcmp(db_getsequence(sort_db, a),
+                 db_getsequence(sort_db, b),
+                 MIN(a_len, b_len));
+  if (r != 0)
+    return r < 0;
+  return a_len < b_len;
+}
+
+static unsigned int common_prefix(struct db * d, uint64_t a, uint64_t b)
+{
+  /* length of the common prefix of two sequences */
+
+  unsigned int len = MIN(db_getsequencelen(d, a), db_getsequencelen(d, b));
+  char * a_seq = db_getsequence(d, a);
+  char * b_seq = db_getsequence(d, b);
+  unsigned int k = 0;
+  while ((k < len) && (a_seq[k] == b_seq[k]))
+    k++;
+  return k;
+}
+
+static uint64_t new_node(struct trie_s * tr,
+                         uint64_t label,
+                         unsigned int label_len)
+{
+  uint64_t n = tr->node_count++;
+  struct trie_node_s * node = tr->nodes + n;
+  node->first_child = 0;
+  node->next_sibling = 0;
+  node->seq_first = 0;
+  node->label = label;
+  node->label_len = label_len;
+  node->seq_count = 0;
+  return n;
+}
+
+struct trie_s * trie_init(struct db * d)
+{
+  /* Build a compact prefix trie of the sequences in d for each gene pair. */
+
+  struct trie_s * tr = static_cast<struct trie_s *>
+    (xmalloc(sizeof(struct trie_s)));
+
+  uint64_t sequences = db_getsequencecount(d);
+
+  tr->d = d;
+  tr->longest = db_getlongestsequence(d);
+  tr->order = static_cast<uint64_t *>
+    (xmalloc(MAX(sequences, 1) * sizeof(uint64_t)));
+
+  for (uint64_t i = 0; i < sequences; i++)
+    tr->order[i] = i;
+
+  progress_init("Sorting sequences:", sequences);
+  sort_db = d;
+  std::sort(tr->order, tr->order + sequences, compare_sequences);
+  sort_db = nullptr;
+  progress_done();
+
+  /* count groups, each sequence adds at most a leaf and a branch node */
+
+  uint64_t group_count = 0;
+  for (uint64_t k = 0; k < sequences; k++)
+    if ((k == 0) || ! same_genes(d, tr->order[k-1], tr->order[k]))
+      group_count++;
+
+  tr->group_count = 0;
+  tr->groups = static_cast<struct trie_group_s *>
+    (xmalloc(MAX(group_count, 1) * sizeof(struct trie_group_s)));
+  tr->node_count = 0;
+  tr->nodes = static_cast<struct trie_node_s *>
+    (xmalloc((2 * sequences + group_count + 1) * sizeof(struct trie_node_s)));
+  tr->label_size = 0;
+  tr->labels = static_cast<unsigned char *>
+    (xmalloc(MAX(db_getresiduescount(d), 1)));
+
+  /*
+    The nodes on the path of the previous sequence, from the root, and
+    the depth of the path at the end of each of them.
+  */
+
+  uint64_t * path = static_cast<uint64_t *>
+    (xmalloc((tr->longest + 2) * sizeof(uint64_t)));
+  unsigned int * path_depth = static_cast<unsigned int *>
+    (xmalloc((tr->longest + 2) * sizeof(unsigned int)));
+  unsigned int path_len = 0;
+
+  progress_init("Building trie:    ", sequences);
+  for (uint64_t k = 0; k < sequences; k++)
+    {
+      uint64_t i = tr->order[k];
+      unsigned char * seq = (unsigned char *) db_getsequence(d, i);
+      unsigned int len = db_getsequencelen(d, i);
+      unsigned int prefix = 0;
+
+      if ((k == 0) || ! same_genes(d, tr->order[k-1], i))
+        {
+          struct trie_group_s * g = tr->groups + tr->group_count++;
+          g->v_gene = opt_ignore_genes ? 0 : db_get_v_gene(d, i);
+          g->j_gene = opt_ignore_genes ? 0 : db_get_j_gene(d, i);
+          g->root = new_node(tr, 0, 0);
+          path[0] = g->root;
+          path_depth[0] = 0;
+          path_len = 1;
+        }
+      else
+        prefix = common_prefix(d, tr->order[k-1], i);
+
+      /*
+        Go back up the path to the deepest node ending within the
+        common prefix. Due to the sort order, the node below it on the
+        path is its last child.
+      */
+
+      uint64_t last_child = 0;
+      while (path_depth[path_len - 1] > prefix)
+        last_child = path[--path_len];
+
+      uint64_t parent = path[path_len - 1];
+      unsigned int depth = path_depth[path_len - 1];
+
+      if (depth < prefix)
+        {
+          /* split the edge to the last child at the end of the prefix */
+
+          struct trie_node_s * child = tr->nodes + last_child;
+          unsigned int split = prefix - depth;
+          uint64_t m = new_node(tr, child->label, split);
+          child->label += split;
+          child->label_len -= split;
+          tr->nodes[m].first_child = last_child;
+
+          struct trie_node_s * p = tr->nodes + parent;
+          if (p->first_child == last_child)
+            p->first_child = m;
+          else
+            {
+              uint64_t c = p->first_child;
+              while (tr->nodes[c].next_sibling != last_child)
+                c = tr->nodes[c].next_sibling;
+              tr->nodes[c].next_sibling = m;
+            }
+
+          parent = m;
+          depth = prefix;
+          path[path_len] = m;
+          path_depth[path_len] = prefix;
+          path_len++;
+        }
+
+      /* add the rest of the sequence as a new last child */
+
+      uint64_t n = parent;
+      if (len > prefix)
+        {
+          n = new_node(tr, tr->label_size, len - prefix);
+          memcpy(tr->labels + tr->label_size, seq + prefix, len - prefix);
+          tr->label_size += len - prefix;
+          if (last_child)
+            tr->nodes[last_child].next_sibling = n;
+          else
+            tr->nodes[parent].first_child = n;
+          path[path_len] = n;
+          path_depth[path_len] = len;
+          path_len++;
+        }
+
+      struct trie_node_s * end = tr->nodes + n;
+      if (end->seq_count == 0)
+        end->seq_first = k;
+      end->seq_count++;
+
+      progress_update(k);
+    }
+  progress_done();
+
+  xfree(path_depth);
+  xfree(path);
+
+  tr->nodes = static_cast<struct trie_node_s *>
+    (xrealloc(tr->nodes, MAX(tr->node_count, 1) * sizeof(struct trie_node_s)));
+  tr->labels = static_cast<unsigned char *>
+    (xrealloc(tr->labels, MAX(tr->label_size, 1)));
+
+  return tr;
+}
+
+void trie_exit(struct trie_s * tr)
+{
+  xfree(tr->groups);
+  xfree(tr->labels);
+  xfree(tr->nodes);
+  xfree(tr->order);
+  xfree(tr);
+}
+
+static void add_hits(struct trie_search_s * ts, struct trie_node_s * node)
+{
+  for (uint64_t k = node->seq_first;
+       k < node->seq_first + node->seq_count; k++)
+    {
+      if (*ts->hits_alloc <= *ts->hits_count)
+        {
+          *ts->hits_alloc += 1024;
+          *ts->hits_data = static_cast<uint64_t *>
+            (xrealloc((*ts->hits_data),
+                      (*ts->hits_alloc) * sizeof(uint64_t)));
+        }
+      (*ts->hits_data)[(*ts->hits_count)++] = ts->tr->order[k];
+    }
+}
+
+static void visit_hamming(struct trie_search_s * ts,
+                          uint64_t n,
+                          unsigned int depth,
+                          unsigned int diff)
+{
+  /* visit the children of node n at the given depth */
+
+  struct trie_node_s * nodes = ts->tr->nodes;
+
+  for (uint64_t c = nodes[n].first_child; c; c = nodes[c].next_sibling)
+    {
+      unsigned char * label = ts->tr->labels + nodes[c].label;
+      unsigned int label_len = nodes[c].label_len;
+
+      if (depth + label_len > ts->len)
+        continue;
+
+      unsigned int cdiff = diff;
+      for (unsigned int i = 0; (i < label_len) && (cdiff <= ts->maxdiff); i++)
+        cdiff += (label[i] != ts->seq[depth + i]);
+      if (cdiff > ts->maxdiff)
+        continue;
+
+      if (depth + label_len == ts->len)
+        {
+          if (nodes[c].seq_count)
+            add_hits(ts, nodes + c);
+        }
+      else
+        visit_hamming(ts, c, depth + label_len, cdiff);
+    }
+}
+
+static inline bool edit_row(struct trie_search_s * ts,
+                            unsigned int k,
+                            unsigned char residue)
+{
+  /*
+    Compute row k of the banded dynamic programming matrix from row
+    k - 1, for a path ending with the given residue. Row k holds the
+    edit distances between the first k residues on the trie path and
+    each prefix of the query. Only cells within maxdiff of the
+    diagonal are computed, with the cells just outside the band set to
+    maxdiff + 1. Returns false if all cells exceed maxdiff.
+  */
+
+  unsigned int len = ts->len;
+  unsigned int maxdiff = ts->maxdiff;
+  unsigned int * prev = ts->rows + (k - 1) * (len + 1);
+  unsigned int * row = prev + (len + 1);
+
+  unsigned int lo = k > maxdiff ? k - maxdiff : 0;
+  unsigned int hi = MIN(k + maxdiff, len);
+
+  if (lo > len)
+    return false;
+
+  unsigned int rowmin = maxdiff + 1;
+
+  if (lo > 0)
+    row[lo - 1] = maxdiff + 1;
+
+  for (unsigned int i = lo; i <= hi; i++)
+    {
+      unsigned int x;
+      if (i == 0)
+        x = k;
+      else
+        {
+          x = prev[i - 1] + (residue != ts->seq[i - 1]);
+          x = MIN(x, prev[i] + 1);
+          x = MIN(x, row[i - 1] + 1);
+        }
+      x = MIN(x, maxdiff + 1);
+      row[i] = x;
+      rowmin = MIN(rowmin, x);
+    }
+
+  if (hi < len)
+    row[hi + 1] = maxdiff + 1;
+
+  return rowmin <= maxdiff;
+}
+
+static void visit_edit(struct trie_search_s * ts,
+                       uint64_t n,
+                       unsigned int depth)
+{
+  /* visit the children of node n, computing one row per residue */
+
+  struct trie_node_s * nodes = ts->tr->nodes;
+  unsigned int len = ts->len;
+  unsigned int maxdiff = ts->maxdiff;
+
+  for (uint64_t c = nodes[n].first_child; c; c = nodes[c].next_sibling)
+    {
+      unsigned char * label = ts->tr->labels + nodes[c].label;
+      unsigned int label_len = nodes[c].label_len;
+      unsigned int k = depth;
+      bool alive = true;
+
+      for (unsigned int i = 0; alive && (i < label_len); i++)
+        alive = edit_row(ts, ++k, label[i]);
+
+      if (! alive)
+        continue;
+
+      if (nodes[c].seq_count && (k + maxdiff >= len) &&
+          (ts->rows[k * (len + 1) + len] <= maxdiff))
+        add_hits(ts, nodes + c);
+
+      if (nodes[c].first_child)
+        visit_edit(ts, c, k);
+    }
+}
+
+void trie_search(struct trie_s * tr,
+                 struct db * d,
+                 uint64_t seed,
+                 uint64_t * * hits_data,
+                 uint64_t * hits_count,
+                 uint64_t * hits_alloc)
+{
+  /*
+    Find all sequences in the trie within opt_differences of sequence
+    seed in d. The hits are added after the existing hits.
+  */
+
+  uint64_t v_gene = opt_ignore_genes ? 0 : db_get_v_gene(d, seed);
+  uint64_t j_gene = opt_ignore_genes ? 0 : db_get_j_gene(d, seed);
+
+  /* find the group with the same genes */
+
+  uint64_t lo = 0;
+  uint64_t hi = tr->group_count;
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+      struct trie_group_s * g = tr->groups + mid;
+      if ((g->v_gene < v_gene) ||
+          ((g->v_gene == v_gene) && (g->j_gene < j_gene)))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if ((lo == tr->group_count) ||
+      (tr->groups[lo].v_gene != v_gene) ||
+      (tr->groups[lo].j_gene != j_gene))
+    return;
+
+  uint64_t root = tr->groups[lo].root;
+
+  struct trie_search_s ts;
+  ts.tr = tr;
+  ts.seq = (unsigned char *) db_getsequence(d, seed);
+  ts.len = db_getsequencelen(d, seed);
+  ts.maxdiff = static_cast<unsigned int>(opt_differences);
+  ts.rows = nullptr;
+  ts.hits_data = hits_data;
+  ts.hits_count = hits_count;
+  ts.hits_alloc = hits_alloc;
+
+  if (! opt_indels)
+    {
+      if (ts.len == 0)
+        {
+          if (tr->nodes[root].seq_count)
+            add_hits(& ts, tr->nodes + root);
+        }
+      else
+        visit_hamming(& ts, root, 0, 0);
+      return;
+    }
+
+  /* one row for each depth of the trie */
+
+  unsigned int stack_array[stack_cells];
+  uint64_t cells = static_cast<uint64_t>(tr->longest + 1) * (ts.len + 1);
+  ts.rows = stack_array;
+  if (cells > stack_cells)
+    ts.rows = static_cast<unsigned int *>
+      (xmalloc(cells * sizeof(unsigned int)));
+
+  for (unsigned int i = 0; i <= ts.len; i++)
+    ts.rows[i] = MIN(i, ts.maxdiff + 1);
+
+  if (tr->nodes[root].seq_count && (ts.len <= ts.maxdiff))
+    add_hits(& ts, tr->nodes + root);
+
+  visit_edit(& ts, root, 0);
+
+  if (ts.rows != stack_array)
+    xfree(ts.rows);
+}
@@ -0,0 +1,47 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Compact prefix (radix) trie of the sequences, grouped by V and J
+  gene, for any d, with or without indels. Chains of nodes with a
+  single child are merged into one node with a string label, so that
+  there are at most about two nodes per sequence instead of one per
+  residue.
+
+  A query sequence traverses the trie while keeping a banded row of
+  the dynamic programming matrix for the edit distance (or a count of
+  mismatches when indels are not allowed). Branches are pruned as soon
+  as the distance exceeds d. Common prefixes of the sequences are
+  therefore only compared once.
+*/
+
+struct trie_s;
+
+struct trie_s * trie_init(struct db * d);
+
+void trie_exit(struct trie_s * tr);
+
+void trie_search(struct trie_s * tr,
+                 struct db * d,
+                 uint64_t seed,
+                 uint64_t * * hits_data,
+                 uint64_t * hits_count,
+                 uint64_t * hits_alloc);
@@ -29,6 +29,17 @@ static const uint64_t progress_granularity = 200;
 const size_t memalignment = 16;
 static std::chrono::time_point<std::chrono::steady_clock> time_point_start;
 
+/* large arrays mapped with xmalloc_huge, and their mapped size */
+const size_t huge_page_size = 2 * 1024 * 1024;
+static pthread_mutex_t huge_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<void *, size_t> huge_areas;
+static uint64_t huge_bytes = 0;
+static uint64_t huge_hugetlb_bytes = 0;
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
 void progress_init(const char * prompt, uint64_t size)
 {
   progress_prompt = prompt;
@@ -131,6 +142,156 @@ void xfree(void * ptr)
     fatal("Trying to free a null pointer");
 }
 
+void * xmalloc_huge(size_t size)
+{
+  /*
+    Allocate a large array that is kept for a long time and accessed
+    at random, on 2MB pages if possible. The area is 2MB-aligned and
+    advised to use transparent huge pages. With the --huge-pages
+    option, explicit huge pages from hugetlbfs are tried first, and
+    all pages are populated at once. Arrays shared by all threads are
+    placed with numa_interleave before they are touched. Small arrays,
+    and all arrays on other systems than Linux, are allocated with
+    xmalloc. Free the array with xfree_huge.
+  */
+
+#ifdef __linux__
+  if (size >= huge_page_size)
+    {
+      size_t length = (size + huge_page_size - 1) & ~ (huge_page_size - 1);
+      void * t = MAP_FAILED;
+      bool hugetlb = false;
+
+#ifdef MAP_HUGETLB
+      if (opt_huge_pages)
+        {
+          t = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+          hugetlb = t != MAP_FAILED;
+        }
+#endif
+
+      if (! hugetlb)
+        {
+          /* map one page more than needed and unmap the unaligned ends */
+
+          size_t extra = length + huge_page_size;
+          char * m = static_cast<char *>
+            (mmap(nullptr, extra, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+          if (m == MAP_FAILED)
+            fatal("Unable to allocate enough memory.");
+
+          char * a = reinterpret_cast<char *>
+            ((reinterpret_cast<uintptr_t>(m) + huge_page_size - 1)
+             & ~ static_cast<uintptr_t>(huge_page_size - 1));
+          if (a > m)
+            munmap(m, a - m);
+          if (m + extra > a + length)
+            munmap(a + length, (m + extra) - (a + length));
+          t = a;
+
+#ifdef MADV_HUGEPAGE
+          madvise(t, length, MADV_HUGEPAGE);
+#endif
+        }
+
+      numa_interleave(t, length, false);
+
+      /* best effort, older kernels just fault the pages in later */
+
+      if (opt_huge_pages)
+        madvise(t, length, MADV_POPULATE_WRITE);
+
+      pthread_mutex_lock(& huge_mutex);
+      huge_areas[t] = length;
+      huge_bytes += length;
+      if (hugetlb)
+        huge_hugetlb_bytes += length;
+      pthread_mutex_unlock(& huge_mutex);
+
+      return t;
+    }
+#endif
+
+  void * t = xmalloc(size);
+  numa_interleave(t, size, false);
+  return t;
+}
+
+void xfree_huge(void * ptr)
+{
+  size_t length = 0;
+
+  pthread_mutex_lock(& huge_mutex);
+  auto area = huge_areas.find(ptr);
+  if (area != huge_areas.end())
+    {
+      length = area->second;
+      huge_areas.erase(area);
+      huge_bytes -= length;
+    }
+  pthread_mutex_unlock(& huge_mutex);
+
+  if (length)
+    munmap(ptr, length);
+  else
+    xfree(ptr);
+}
+
+void huge_advise(void * ptr, size_t size)
+{
+  /* ask for transparent huge pages for the aligned part of an array */
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  uintptr_t start = (reinterpret_cast<uintptr_t>(ptr) + huge_page_size - 1)
+    & ~ static_cast<uintptr_t>(huge_page_size - 1);
+  uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + size)
+    & ~ static_cast<uintptr_t>(huge_page_size - 1);
+  if (end > start)
+    madvise(reinterpret_cast<void *>(start), end - start, MADV_HUGEPAGE);
+#else
+  (void) ptr;
+  (void) size;
+#endif
+}
+
+void huge_report()
+{
+  /*
+    Show how many of the 2MB pages of the large arrays are huge pages.
+    Transparent huge pages are counted for the whole process.
+  */
+
+  uint64_t anon_kb = 0;
+
+#ifdef __linux__
+  FILE * fp = fopen("/proc/self/smaps_rollup", "r");
+  if (fp)
+    {
+      char line[256];
+      while (fgets(line, sizeof(line), fp))
+        {
+          unsigned long kb = 0;
+          if (sscanf(line, "AnonHugePages: %lu kB", & kb) == 1)
+            anon_kb = kb;
+        }
+      fclose(fp);
+    }
+#endif
+
+  pthread_mutex_lock(& huge_mutex);
+  uint64_t pages = huge_bytes / huge_page_size;
+  uint64_t hugetlb = huge_hugetlb_bytes / huge_page_size;
+  pthread_mutex_unlock(& huge_mutex);
+
+  uint64_t transparent = anon_kb * 1024 / huge_page_size;
+
+  fprintf(logfile, "Huge pages:        %" PRIu64 " of %" PRIu64
+          " (%" PRIu64 " hugetlbfs, %" PRIu64 " transparent)\n",
+          MIN(hugetlb + transparent, pages), pages, hugetlb, transparent);
+}
+
 char * xstrdup(const char * s)
 {
   char * t = strdup(s);
@@ -182,3 +343,93 @@ int64_t seq_diff(unsigned char * a, unsigned char * b, int64_t len)
       }
   return diffs;
 }
+
+int64_t seq_edit_diff(unsigned char * a, int64_t alen,
+                      unsigned char * b, int64_t blen)
+{
+  /*
+    Count the minimum number of substitutions, insertions and
+    deletions needed to turn a into b (the Levenshtein distance).
+    Only the band of cells within opt_differences of the diagonal is
+    computed, and opt_differences + 1 is returned as soon as it is
+    clear that the distance is larger than opt_differences.
+  */
+
+  const int64_t limit = opt_differences + 1;
+
+  if ((alen - blen >= limit) || (blen - alen >= limit))
+    return limit;
+
+  /* cell (i, j) of the band is stored in row[j - i + opt_differences] */
+
+  const int64_t width = 2 * opt_differences + 1;
+  const int64_t stack_width = 65;
+  int64_t stack_prev[stack_width];
+  int64_t stack_curr[stack_width];
+  int64_t * prev = stack_prev;
+  int64_t * curr = stack_curr;
+  if (width > stack_width)
+    {
+      prev = static_cast<int64_t *>(xmalloc(width * sizeof(int64_t)));
+      curr = static_cast<int64_t *>(xmalloc(width * sizeof(int64_t)));
+    }
+
+  for (int64_t k = 0; k < width; k++)
+    {
+      int64_t j = k - opt_differences;
+      prev[k] = ((j >= 0) && (j <= blen)) ? j : limit;
+    }
+
+  int64_t result = limit;
+  bool exceeded = false;
+
+  for (int64_t i = 1; i <= alen; i++)
+    {
+      int64_t row_min = limit;
+      for (int64_t k = 0; k < width; k++)
+        {
+          int64_t j = i + k - opt_differences;
+          int64_t x = limit;
+          if ((j >= 0) && (j <= blen))
+            {
+              if (j == 0)
+                x = i;
+              else
+                {
+                  /* substitution or match, diagonal */
+                  x = prev[k] + (a[i-1] != b[j-1] ? 1 : 0);
+                  /* deletion from a, cell above */
+                  if (k + 1 < width)
+                    x = MIN(x, prev[k+1] + 1);
+                  /* insertion into a, cell to the left */
+                  if (k > 0)
+                    x = MIN(x, curr[k-1] + 1);
+                }
+              x = MIN(x, limit);
+            }
+          curr[k] = x;
+          row_min = MIN(row_min, x);
+        }
+
+      int64_t * temp = prev;
+      prev = curr;
+      curr = temp;
+
+      if (row_min >= limit)
+        {
+          exceeded = true;
+          break;
+        }
+    }
+
+  if (! exceeded)
+    result = prev[blen - alen + opt_differences];
+
+  if (width > stack_width)
+    {
+      xfree(prev);
+      xfree(curr);
+    }
+
+  return result;
+}
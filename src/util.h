@@ -26,6 +26,22 @@ int64_t gcd(int64_t a, int64_t b);
 void * xmalloc(size_t size);
 void * xrealloc(void * ptr, size_t size);
 void xfree(void * ptr);
+void * xmalloc_huge(size_t size);
+void xfree_huge(void * ptr);
+void huge_advise(void * ptr, size_t size);
+void huge_report();
+
+/*
+  Row numbers are stored in 32 bits whenever there are few enough
+  rows, leaving the two largest values free to be used as markers.
+  The --wide-rows option forces 64 bits, so that this path can be
+  tested on small inputs.
+*/
+
+inline bool rows_fit_32(uint64_t rows)
+{
+  return (! opt_wide_rows) && (rows < UINT32_MAX - 1);
+}
 char * xstrdup(const char * s);
 void progress_init(const char * prompt, uint64_t size);
 void progress_update(uint64_t progress);
@@ -33,3 +49,5 @@ void progress_done();
 FILE * fopen_input(const char * filename);
 FILE * fopen_output(const char * filename);
 int64_t seq_diff(unsigned char * a, unsigned char * b, int64_t len);
+int64_t seq_edit_diff(unsigned char * a, int64_t alen,
+                      unsigned char * b, int64_t blen);
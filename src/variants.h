@@ -72,6 +72,22 @@ struct var_s
   unsigned char residue2;
 };
 
+inline unsigned int variant_length(struct var_s * var,
+                                   unsigned int seed_seqlen)
+{
+  /* length of the sequence obtained by applying a variant */
+
+  switch (var->kind)
+    {
+    case deletion:
+      return seed_seqlen - 1;
+    case insertion:
+      return seed_seqlen + 1;
+    default:
+      return seed_seqlen;
+    }
+}
+
 void generate_variant_sequence(unsigned char * seed_sequence,
                                unsigned int seed_seqlen,
                                struct var_s * var,
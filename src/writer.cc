@@ -0,0 +1,203 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+#include "compairr.h"
+
+static const uint64_t outbuf_initial = 64 * 1024;
+
+static FILE * writer_file = nullptr;
+static bool writer_ordered = false;
+static pthread_t writer_thread;
+static pthread_mutex_t writer_mutex;
+static pthread_cond_t writer_work;
+static pthread_cond_t writer_space;
+static std::map<uint64_t, struct outbuf_s *> writer_pending;
+static std::vector<struct outbuf_s *> writer_free;
+static uint64_t writer_next = 0;
+static uint64_t writer_arrival = 0;
+static uint64_t writer_queued = 0;
+static uint64_t writer_limit = 0;
+static bool writer_quit = false;
+
+struct outbuf_s * outbuf_init()
+{
+  struct outbuf_s * o = static_cast<struct outbuf_s *>
+    (xmalloc(sizeof(struct outbuf_s)));
+  o->alloc = outbuf_initial;
+  o->data = static_cast<char *>(xmalloc(o->alloc));
+  o->len = 0;
+  o->key = 0;
+  o->size = 0;
+  return o;
+}
+
+void outbuf_exit(struct outbuf_s * o)
+{
+  xfree(o->data);
+  xfree(o);
+}
+
+void outbuf_grow(struct outbuf_s * o, uint64_t n)
+{
+  while (o->len + n > o->alloc)
+    o->alloc *= 2;
+  o->data = static_cast<char *>(xrealloc(o->data, o->alloc));
+}
+
+void outbuf_write(struct outbuf_s * o, FILE * f)
+{
+  if (o->len && (fwrite(o->data, 1, o->len, f) != o->len))
+    fatal("Unable to write to pairs file.");
+  o->len = 0;
+}
+
+static void * writer_worker(void * vp)
+{
+  (void) vp;
+
+  pthread_mutex_lock(& writer_mutex);
+
+  while (true)
+    {
+      /* write the next buffer, if it has arrived */
+
+      auto first = writer_pending.begin();
+      if ((first != writer_pending.end()) && (first->first == writer_next))
+        {
+          struct outbuf_s * o = first->second;
+          writer_pending.erase(first);
+
+          pthread_mutex_unlock(& writer_mutex);
+          outbuf_write(o, writer_file);
+          pthread_mutex_lock(& writer_mutex);
+
+          writer_next += o->size;
+          writer_queued--;
+          writer_free.push_back(o);
+          pthread_cond_broadcast(& writer_space);
+          continue;
+        }
+
+      if (writer_quit)
+        break;
+
+      pthread_cond_wait(& writer_work, & writer_mutex);
+    }
+
+  pthread_mutex_unlock(& writer_mutex);
+  return nullptr;
+}
+
+void writer_init(FILE * f, bool ordered)
+{
+  writer_file = f;
+  writer_ordered = ordered;
+  writer_next = 0;
+  writer_arrival = 0;
+  writer_queued = 0;
+  writer_limit = 4 * static_cast<uint64_t>(opt_threads);
+  writer_quit = false;
+
+  pthread_mutex_init(& writer_mutex, nullptr);
+  pthread_cond_init(& writer_work, nullptr);
+  pthread_cond_init(& writer_space, nullptr);
+
+  if (pthread_create(& writer_thread, nullptr, writer_worker, nullptr))
+    fatal("Cannot create thread");
+}
+
+void writer_exit()
+{
+  writer_sync();
+
+  pthread_mutex_lock(& writer_mutex);
+  writer_quit = true;
+  pthread_cond_signal(& writer_work);
+  pthread_mutex_unlock(& writer_mutex);
+
+  if (pthread_join(writer_thread, nullptr))
+    fatal("Cannot join thread");
+
+  for (auto o : writer_free)
+    outbuf_exit(o);
+  writer_free.clear();
+
+  pthread_cond_destroy(& writer_space);
+  pthread_cond_destroy(& writer_work);
+  pthread_mutex_destroy(& writer_mutex);
+}
+
+struct outbuf_s * writer_get()
+{
+  struct outbuf_s * o = nullptr;
+
+  pthread_mutex_lock(& writer_mutex);
+  if (! writer_free.empty())
+    {
+      o = writer_free.back();
+      writer_free.pop_back();
+    }
+  pthread_mutex_unlock(& writer_mutex);
+
+  if (! o)
+    o = outbuf_init();
+  return o;
+}
+
+void writer_put(struct outbuf_s * o)
+{
+  pthread_mutex_lock(& writer_mutex);
+
+  /*
+    The writer keeps up with the threads, or they have to wait. The
+    buffer the writer needs next is always accepted, so that the
+    queue can drain when the threads producing later buffers wait.
+  */
+
+  if (writer_ordered)
+    {
+      while ((writer_queued >= writer_limit) && (o->key != writer_next))
+        pthread_cond_wait(& writer_space, & writer_mutex);
+    }
+  else
+    {
+      while (writer_queued >= writer_limit)
+        pthread_cond_wait(& writer_space, & writer_mutex);
+      o->key = writer_arrival++;
+      o->size = 1;
+    }
+
+  writer_pending[o->key] = o;
+  writer_queued++;
+  pthread_cond_signal(& writer_work);
+
+  pthread_mutex_unlock(& writer_mutex);
+}
+
+void writer_sync()
+{
+  pthread_mutex_lock(& writer_mutex);
+  while (writer_queued > 0)
+    pthread_cond_wait(& writer_space, & writer_mutex);
+  if (writer_ordered)
+    writer_next = 0;
+  pthread_mutex_unlock(& writer_mutex);
+}
@@ -0,0 +1,129 @@
+/*
+    Copyright (C) 2012-2022 Torbjorn Rognes and Frederic Mahe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+    Department of Informatics, University of Oslo,
+    PO Box 1080 Blindern, NO-0316 Oslo, Norway
+*/
+
+/*
+  Buffered output of the matching pairs.
+
+  Each thread formats its pairs into its own output buffers, without
+  any locking, and hands the completed buffers to a single writer
+  thread through a queue. The buffers are written in the order of
+  their keys: either in the order they arrive, or, for a
+  deterministic output, in the order of the chunks of groups they
+  were found in, given by the position of the chunk in the order the
+  chunks are claimed. The number of queued buffers is limited in
+  both cases, and the written buffers are reused.
+*/
+
+struct outbuf_s
+{
+  char * data;
+  uint64_t len;
+  uint64_t alloc;
+  uint64_t key;
+  uint64_t size;
+};
+
+struct outbuf_s * outbuf_init();
+
+void outbuf_exit(struct outbuf_s * o);
+
+void outbuf_grow(struct outbuf_s * o, uint64_t n);
+
+inline void outbuf_reserve(struct outbuf_s * o, uint64_t n)
+{
+  if (o->len + n > o->alloc)
+    outbuf_grow(o, n);
+}
+
+inline void outbuf_add(struct outbuf_s * o, const char * s, uint64_t n)
+{
+  outbuf_reserve(o, n);
+  memcpy(o->data + o->len, s, n);
+  o->len += n;
+}
+
+inline void outbuf_add_char(struct outbuf_s * o, char c)
+{
+  outbuf_reserve(o, 1);
+  o->data[o->len++] = c;
+}
+
+inline void outbuf_add_string(struct outbuf_s * o, const char * s)
+{
+  outbuf_add(o, s, strlen(s));
+}
+
+inline void outbuf_add_u64(struct outbuf_s * o, uint64_t x)
+{
+  /* the digits are produced backwards, then copied in order */
+
+  char digits[20];
+  unsigned int n = 0;
+  do
+    {
+      digits[n++] = static_cast<char>('0' + x % 10);
+      x /= 10;
+    }
+  while (x);
+
+  outbuf_reserve(o, n);
+  char * p = o->data + o->len;
+  for (unsigned int i = 0; i < n; i++)
+    p[i] = digits[n - 1 - i];
+  o->len += n;
+}
+
+inline void outbuf_add_i64(struct outbuf_s * o, int64_t x)
+{
+  if (x < 0)
+    {
+      outbuf_add_char(o, '-');
+      outbuf_add_u64(o, - static_cast<uint64_t>(x));
+    }
+  else
+    outbuf_add_u64(o, static_cast<uint64_t>(x));
+}
+
+void outbuf_write(struct outbuf_s * o, FILE * f);
+
+/* the writer thread, writing to f, in order of the keys if ordered */
+
+void writer_init(FILE * f, bool ordered);
+
+void writer_exit();
+
+/* get an empty buffer */
+
+struct outbuf_s * writer_get();
+
+/*
+  Queue a buffer to be written. Without order, the key and size are
+  set here. With order, the buffer with key k and size n is written
+  after the one with key k - n, starting with key 0. Waits while many
+  buffers are queued, unless the buffer is the next one to be
+  written.
+*/
+
+void writer_put(struct outbuf_s * o);
+
+/* wait until all queued buffers are written, the next key is then 0 */
+
+void writer_sync();
@@ -22,6 +22,7 @@
 #include "compairr.h"
 
 uint64_t * zobrist_tab_base = nullptr;
+uint64_t * zobrist_wildcard_base = nullptr;
 static uint64_t * zobrist_v_base = nullptr;
 static uint64_t * zobrist_d_base = nullptr;
 
@@ -37,12 +38,13 @@ void zobrist_init(unsigned int n, unsigned int v_genes, unsigned int d_genes)
     The number is generated by xor'ing together four shifted
     31-bit random numbers.
 
-    Also make some random values for the V genes and D genes.
+    Also make some random values for the V genes and D genes, as well
+    as a wildcard value for each position, used for masked residues.
   */
 
   /* allocate memory for table */
 
-  uint64_t numbers = alphabet_size * n + v_genes + d_genes;
+  uint64_t numbers = alphabet_size * n + v_genes + d_genes + n;
 
   zobrist_tab_base = static_cast<uint64_t *>
     (xmalloc(numbers * sizeof(uint64_t)));
@@ -64,6 +66,7 @@ void zobrist_init(unsigned int n, unsigned int v_genes, unsigned int d_genes)
 
   zobrist_v_base = zobrist_tab_base + alphabet_size * n;
   zobrist_d_base = zobrist_v_base + v_genes;
+  zobrist_wildcard_base = zobrist_d_base + d_genes;
 }
 
 void zobrist_exit()
@@ -150,3 +153,20 @@ uint64_t zobrist_hash_insert_first_two(unsigned char * s,
     z ^= zobrist_value(p + 2, s[p]);
   return z;
 }
+
+uint64_t zobrist_hash_segment(unsigned char * s,
+                              unsigned int start,
+                              unsigned int end,
+                              int v_gene,
+                              int d_gene)
+{
+  /* compute the Zobrist hash function of the part of sequence s
+     from position start up to (but not including) position end */
+
+  uint64_t z = 0;
+  if (! opt_ignore_genes)
+    z ^= zobrist_v_base[v_gene] ^ zobrist_d_base[d_gene];
+  for(unsigned int p = start; p < end; p++)
+    z ^= zobrist_value(p, s[p]);
+  return z;
+}
@@ -20,12 +20,18 @@
 */
 
 extern uint64_t * zobrist_tab_base;
+extern uint64_t * zobrist_wildcard_base;
 
 inline uint64_t zobrist_value(unsigned int pos, unsigned char x)
 {
   return zobrist_tab_base[alphabet_size * pos + x];
 }
 
+inline uint64_t zobrist_wildcard(unsigned int pos)
+{
+  return zobrist_wildcard_base[pos];
+}
+
 void zobrist_init(unsigned int longest,
                   unsigned int v_genes,
                   unsigned int d_genes);
@@ -56,3 +62,9 @@ uint64_t zobrist_hash_insert_first_two(unsigned char * s,
                                        unsigned int len,
                                        int v_gene,
                                        int d_gene);
+
+uint64_t zobrist_hash_segment(unsigned char * s,
+                              unsigned int start,
+                              unsigned int end,
+                              int v_gene,
+                              int d_gene);
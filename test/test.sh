@@ -1,16 +1,502 @@
 #!/bin/sh
 
-if ! [ -e ../src/compairr ] ; then
+COMPAIRR=../src/compairr
+
+LC_ALL=C
+export LC_ALL
+
+if ! [ -e $COMPAIRR ] ; then
     echo The compairr binary is missing
     echo Test failed.
     exit 1
 fi
 
-../src/compairr -m seta.tsv setb.tsv -d 1 -i -l compairr.log -o output.tsv
+$COMPAIRR -m seta.tsv setb.tsv -d 1 -i -l compairr.log -o output.tsv
 
-if diff -q output.tsv expected.tsv; then
-    echo Test completed successfully.
-else
+if ! diff -q output.tsv expected.tsv; then
     echo Test failed.
     exit 1
 fi
+
+# The remaining tests use setd.tsv (one repertoire) and sete.tsv (four
+# repertoires). The results of each command are compared with those of
+# a reference command, or with expected files made with CompAIRR 1.13.0.
+# Pairs are compared sorted, as their order is unspecified.
+
+cleanup ()
+{
+    rm -f reference.tsv reference_pairs.tsv check.tsv check.log \
+       pairs.tsv pairs.tsv.* sorted.tsv copy.tsv ordered.tsv
+}
+
+fail ()
+{
+    echo Failed: compairr "$@"
+    cleanup
+    echo Test failed.
+    exit 1
+}
+
+# use the given files as the reference results and pairs
+
+expected ()
+{
+    cp "$1" reference.tsv
+    if [ -n "$2" ] ; then
+        cp "$2" reference_pairs.tsv
+    else
+        rm -f reference_pairs.tsv
+    fi
+}
+
+# run the reference command (without pairs when clustering)
+
+reference ()
+{
+    rm -f reference_pairs.tsv
+    if [ "$1" = "-c" ] ; then
+        $COMPAIRR "$@" -l check.log -o reference.tsv || fail "$@"
+    else
+        $COMPAIRR "$@" -l check.log -o reference.tsv \
+            -p reference_pairs.tsv || fail "$@"
+        sort -o reference_pairs.tsv reference_pairs.tsv
+    fi
+}
+
+# run a command and compare its results with the reference
+
+run ()
+{
+    if [ -f reference_pairs.tsv ] ; then
+        $COMPAIRR "$@" -l check.log -o check.tsv -p pairs.tsv || fail "$@"
+        sort pairs.tsv | diff -q - reference_pairs.tsv > /dev/null \
+            || fail "$@"
+    else
+        $COMPAIRR "$@" -l check.log -o check.tsv || fail "$@"
+    fi
+}
+
+check ()
+{
+    run "$@"
+    diff -q check.tsv reference.tsv > /dev/null || fail "$@"
+}
+
+# as check, but for clusters found with another index, where the order
+# of the members of a cluster depends on the order of the hits
+
+check_sorted ()
+{
+    run "$@"
+    sort reference.tsv > sorted.tsv
+    sort check.tsv | diff -q - sorted.tsv > /dev/null || fail "$@"
+}
+
+# pigeonhole segment index, used when d>2
+
+expected expected_d3.tsv expected_d3_pairs.tsv
+check -m sete.tsv setd.tsv -d 3
+check -m sete.tsv setd.tsv -d 3 -t 4
+reference -x setd.tsv sete.tsv -d 4 -g
+check -x setd.tsv sete.tsv -d 4 -g -t 4
+
+# wildcard-masked index, and the pigeonhole index when d<=2
+
+for d in 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d
+    check -m sete.tsv setd.tsv -d $d --index masked
+    check -m sete.tsv setd.tsv -d $d --index masked -t 4
+    check -m sete.tsv setd.tsv -d $d --index pigeonhole
+    reference -x setd.tsv sete.tsv -d $d
+    check -x setd.tsv sete.tsv -d $d --index masked
+    check -x setd.tsv sete.tsv -d $d --index pigeonhole
+    reference -c sete.tsv -d $d
+    check_sorted -c sete.tsv -d $d --index masked
+    check_sorted -c sete.tsv -d $d --index pigeonhole
+done
+
+# symmetric deletion index
+
+reference -m sete.tsv setd.tsv -d 1 -i
+check -m sete.tsv setd.tsv -d 1 -i --index deletion
+reference -x setd.tsv sete.tsv -d 1 -i
+check -x setd.tsv sete.tsv -d 1 -i --index deletion
+reference -c sete.tsv -d 1 -i
+check_sorted -c sete.tsv -d 1 -i --index deletion
+reference -m sete.tsv setd.tsv -d 2 -i
+check -m sete.tsv setd.tsv -d 2 -i --index deletion -t 4
+
+# prefix trie, compared with the default index for each case
+
+for d in 0 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d
+    check -m sete.tsv setd.tsv -d $d --index trie
+    reference -x setd.tsv sete.tsv -d $d
+    check -x setd.tsv sete.tsv -d $d --index trie
+    reference -c sete.tsv -d $d
+    check_sorted -c sete.tsv -d $d --index trie
+done
+for d in 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d -i
+    check -m sete.tsv setd.tsv -d $d -i --index trie
+    check -m sete.tsv setd.tsv -d $d -i --index trie -t 4
+    reference -x setd.tsv sete.tsv -d $d -i
+    check -x setd.tsv sete.tsv -d $d -i --index trie
+    reference -c sete.tsv -d $d -i
+    check_sorted -c sete.tsv -d $d -i --index trie
+done
+expected expected_d3.tsv expected_d3_pairs.tsv
+check -m sete.tsv setd.tsv -d 3 --index trie
+reference -m sete.tsv setd.tsv -d 3 -i
+check -m sete.tsv setd.tsv -d 3 -i -t 4
+
+# identical sequences of set 2, stored once with a list of postings
+
+expected expected_d1.tsv expected_d1_pairs.tsv
+for index in variants masked pigeonhole trie ; do
+    check -m sete.tsv setd.tsv -d 1 --index $index
+done
+
+# identical sequences of set 1, searched only once
+
+expected expected_exist.tsv expected_exist_pairs.tsv
+for index in variants masked pigeonhole trie ; do
+    check -x setd.tsv sete.tsv -d 1 --index $index
+done
+expected expected_cluster.tsv
+check -c sete.tsv -d 1
+check -c sete.tsv -d 1 -t 4
+
+# gene tags in the hash table buckets, with and without genes
+
+for d in 0 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d -g --index trie
+    check -m sete.tsv setd.tsv -d $d -g
+    reference -x setd.tsv sete.tsv -d $d -g --index trie
+    check -x setd.tsv sete.tsv -d $d -g
+    reference -c sete.tsv -d $d -g --index trie
+    check_sorted -c sete.tsv -d $d -g
+done
+
+# hash table probed in groups of slots
+
+expected expected_dedup.tsv
+check -z sete.tsv
+check -z sete.tsv -t 4
+for t in 1 4 ; do
+    expected expected_d1.tsv expected_d1_pairs.tsv
+    check -m sete.tsv setd.tsv -d 1 -t $t
+    expected expected_cluster.tsv
+    check -c sete.tsv -d 1 -t $t
+done
+
+# minimal perfect hash
+
+for d in 0 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d
+    check -m sete.tsv setd.tsv -d $d --perfect-hash
+    reference -x setd.tsv sete.tsv -d $d
+    check -x setd.tsv sete.tsv -d $d --perfect-hash -t 4
+done
+reference -m sete.tsv setd.tsv -d 1 -i
+check -m sete.tsv setd.tsv -d 1 -i --perfect-hash
+
+# sorted hash join index
+
+for d in 0 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d
+    check -m sete.tsv setd.tsv -d $d --index join
+    check -m sete.tsv setd.tsv -d $d --index join -t 4
+    reference -x setd.tsv sete.tsv -d $d
+    check -x setd.tsv sete.tsv -d $d --index join
+done
+reference -m sete.tsv setd.tsv -d 1 -i
+check -m sete.tsv setd.tsv -d 1 -i --index join
+
+# index partitioned by length and genes
+
+for d in 0 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d
+    check -m sete.tsv setd.tsv -d $d --index partition
+    reference -x setd.tsv sete.tsv -d $d
+    check -x setd.tsv sete.tsv -d $d --index partition
+done
+reference -m sete.tsv setd.tsv -d 1 -i
+check -m sete.tsv setd.tsv -d 1 -i --index partition
+reference -m sete.tsv setd.tsv -d 1 -g
+check -m sete.tsv setd.tsv -d 1 -g --index partition
+
+# partition units scheduled onto threads
+
+for t in 2 3 8 ; do
+    reference -m sete.tsv setd.tsv -d 1 -i --index partition
+    check -m sete.tsv setd.tsv -d 1 -i --index partition -t $t
+    reference -x setd.tsv sete.tsv -d 2 --index partition
+    check -x setd.tsv sete.tsv -d 2 --index partition -t $t
+done
+
+# hash tables built in parallel
+
+for t in 2 3 8 ; do
+    expected expected_cluster.tsv
+    check -c sete.tsv -d 1 -t $t
+    expected expected_dedup.tsv
+    check -z sete.tsv -t $t
+    expected expected_exist.tsv expected_exist_pairs.tsv
+    check -x setd.tsv sete.tsv -d 1 -t $t
+    check -x setd.tsv sete.tsv -d 1 -t $t --perfect-hash
+done
+
+# Bloom filter sized by a target false positive rate
+
+expected expected_d1.tsv expected_d1_pairs.tsv
+check -m sete.tsv setd.tsv -d 1 --bloom-fpr 0.5
+check -m sete.tsv setd.tsv -d 1 --bloom-fpr 0.0001 -t 4
+expected expected_cluster.tsv
+check -c sete.tsv -d 1 --bloom-fpr 0.5
+reference -x setd.tsv sete.tsv -d 2
+check -x setd.tsv sete.tsv -d 2 --bloom-fpr 0.5
+check -x setd.tsv sete.tsv -d 2 --bloom-fpr 0.5 --index join
+
+# binary fuse filter
+
+expected expected_cluster.tsv
+check -c sete.tsv -d 1 --filter fuse
+for d in 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d
+    check -m sete.tsv setd.tsv -d $d --filter fuse
+    check -m sete.tsv setd.tsv -d $d --filter fuse --index join -t 4
+    reference -x setd.tsv sete.tsv -d $d
+    check -x setd.tsv sete.tsv -d $d --filter fuse
+done
+
+# sparse existence results, compared with the non-zero lines of the
+# full output
+
+for d in 0 1 ; do
+    reference -x setd.tsv sete.tsv -d $d -a
+    awk '$3 != 0' reference.tsv > sorted.tsv
+    mv sorted.tsv reference.tsv
+    check -x setd.tsv sete.tsv -d $d -a --sparse
+    check -x setd.tsv sete.tsv -d $d -a --sparse --index join -t 4
+done
+reference -m sete.tsv setd.tsv -d 0 -a
+check -m sete.tsv setd.tsv -d 0 -a --sparse
+expected expected_exist.tsv expected_exist_pairs.tsv
+check -x setd.tsv sete.tsv -d 1 -t 4
+
+# overlap matrix shared by the threads, with sums independent of the
+# number of threads
+
+for score in product ratio min max mean ; do
+    reference -m sete.tsv setd.tsv -d 1 -s $score
+    check -m sete.tsv setd.tsv -d 1 -s $score -t 4
+    check -m sete.tsv setd.tsv -d 1 -s $score -t 8
+done
+for score in MH Jaccard ; do
+    reference -m sete.tsv setd.tsv -s $score
+    check -m sete.tsv setd.tsv -s $score -t 4
+done
+
+# overlap matrix computed in tiles
+
+for tile in 1 3 ; do
+    reference -m sete.tsv setd.tsv -d 1
+    check -m sete.tsv setd.tsv -d 1 --tile $tile
+    check -m sete.tsv setd.tsv -d 1 --tile $tile -t 4
+    reference -m sete.tsv setd.tsv -d 1 -a
+    check -m sete.tsv setd.tsv -d 1 -a --tile $tile
+    reference -m sete.tsv sete.tsv -d 2 -i
+    check -m sete.tsv sete.tsv -d 2 -i --tile $tile -t 4
+done
+
+# overlap of a set with itself, compared with its overlap with a copy
+
+cp sete.tsv copy.tsv
+for d in 0 1 2 ; do
+    reference -m sete.tsv copy.tsv -d $d
+    check -m sete.tsv -d $d
+    check -m sete.tsv sete.tsv -d $d -t 4
+    check -m sete.tsv -d $d --index masked
+    check -m sete.tsv -d $d --index trie
+done
+reference -m sete.tsv copy.tsv -d 1 -i
+check -m sete.tsv -d 1 -i
+reference -m sete.tsv copy.tsv -d 2 -i
+check -m sete.tsv -d 2 -i -t 4
+reference -m sete.tsv copy.tsv -d 3
+check -m sete.tsv -d 3
+
+# searches scheduled by estimated cost, which must not change the
+# results or the order of the members of each cluster
+
+for t in 2 3 8 ; do
+    expected expected_cluster.tsv
+    check -c sete.tsv -d 1 -t $t
+    reference -c sete.tsv -d 2 -i --index trie
+    check -c sete.tsv -d 2 -i --index trie -t $t
+    expected expected_d1.tsv expected_d1_pairs.tsv
+    check -m sete.tsv setd.tsv -d 1 -t $t
+    reference -x setd.tsv sete.tsv -d 2 -i
+    check -x setd.tsv sete.tsv -d 2 -i -t $t
+done
+
+# persistent thread pool, with and without pinned threads
+
+for t in 1 2 4 ; do
+    expected expected_d1.tsv expected_d1_pairs.tsv
+    check -m sete.tsv setd.tsv -d 1 -t $t --pin-threads
+    expected expected_cluster.tsv
+    check -c sete.tsv -d 1 -t $t --pin-threads
+    expected expected_dedup.tsv
+    check -z sete.tsv -t $t --pin-threads
+done
+
+# tables interleaved over NUMA nodes
+
+expected expected_d1.tsv expected_d1_pairs.tsv
+check -m sete.tsv setd.tsv -d 1 --numa -t 4
+check -m sete.tsv setd.tsv -d 1 --numa --pin-threads -t 4
+expected expected_cluster.tsv
+check -c sete.tsv -d 1 --numa -t 4
+reference -x setd.tsv sete.tsv -d 2 -i
+check -x setd.tsv sete.tsv -d 2 -i --numa -t 4
+
+# huge pages
+
+expected expected_d1.tsv expected_d1_pairs.tsv
+check -m sete.tsv setd.tsv -d 1 --huge-pages
+check -m sete.tsv setd.tsv -d 1 --huge-pages --perfect-hash -t 4
+expected expected_cluster.tsv
+check -c sete.tsv -d 1 --huge-pages
+expected expected_dedup.tsv
+check -z sete.tsv --huge-pages
+
+# row numbers stored in 32 bits, or in 64 bits with --wide-rows
+
+for t in 1 4 ; do
+    expected expected_d1.tsv expected_d1_pairs.tsv
+    check -m sete.tsv setd.tsv -d 1 -t $t --wide-rows
+    expected expected_exist.tsv expected_exist_pairs.tsv
+    check -x setd.tsv sete.tsv -d 1 -t $t --wide-rows
+    expected expected_dedup.tsv
+    check -z sete.tsv -t $t --wide-rows
+done
+
+# ordered pairs, which must be the same for any number of threads, and
+# pairs sharded into one file per thread, each with its own header
+
+check_ordered ()
+{
+    check "$@" --pairs-mode ordered -t 1
+    mv pairs.tsv ordered.tsv
+    for t in 3 8 ; do
+        check "$@" --pairs-mode ordered -t $t
+        diff -q pairs.tsv ordered.tsv > /dev/null || fail "$@"
+    done
+}
+
+check_shards ()
+{
+    rm -f pairs.tsv.*
+    $COMPAIRR "$@" --pairs-mode shards -t 4 -p pairs.tsv -l check.log \
+        -o check.tsv || fail "$@"
+    diff -q check.tsv reference.tsv > /dev/null || fail "$@"
+    head -n 1 pairs.tsv.0 > pairs.tsv
+    for i in 0 1 2 3 ; do
+        head -n 1 pairs.tsv.$i | grep -q '^#' || fail "$@"
+        tail -n +2 pairs.tsv.$i >> pairs.tsv
+    done
+    sort pairs.tsv | diff -q - reference_pairs.tsv > /dev/null || fail "$@"
+}
+
+for d in 1 2 ; do
+    reference -m sete.tsv setd.tsv -d $d -i
+    check_ordered -m sete.tsv setd.tsv -d $d -i
+    check_shards -m sete.tsv setd.tsv -d $d -i
+    reference -x setd.tsv sete.tsv -d $d
+    check_ordered -x setd.tsv sete.tsv -d $d
+    check_shards -x setd.tsv sete.tsv -d $d
+    reference -m sete.tsv -d $d
+    check_ordered -m sete.tsv -d $d
+    check_shards -m sete.tsv -d $d
+done
+reference -x setd.tsv sete.tsv -d 1 -i --index partition
+check_ordered -x setd.tsv sete.tsv -d 1 -i --index partition
+
+# hash table buckets with 64-bit data
+
+expected expected_cluster.tsv
+check -c sete.tsv -d 1 --wide-rows
+check -c sete.tsv -d 1 --wide-rows -t 4
+expected expected_d1.tsv expected_d1_pairs.tsv
+for index in variants partition masked pigeonhole ; do
+    check -m sete.tsv setd.tsv -d 1 --index $index --wide-rows
+done
+reference -m sete.tsv setd.tsv -d 2 -i
+check -m sete.tsv setd.tsv -d 2 -i --wide-rows -t 4
+
+# posting lists with 64-bit rows
+
+expected expected_exist.tsv expected_exist_pairs.tsv
+for index in variants join partition trie ; do
+    check -x setd.tsv sete.tsv -d 1 --index $index --wide-rows
+done
+check -x setd.tsv sete.tsv -d 1 --perfect-hash --wide-rows -t 4
+expected expected_cluster.tsv
+check -c sete.tsv -d 1 --wide-rows -t 4
+cp sete.tsv copy.tsv
+reference -m sete.tsv copy.tsv -d 1
+check -m sete.tsv -d 1 --wide-rows
+
+# sequences inserted by the thread owning their part of the table
+
+for t in 2 3 5 8 ; do
+    expected expected_cluster.tsv
+    check -c sete.tsv -d 1 -t $t
+    check -c sete.tsv -d 1 -t $t --wide-rows
+    expected expected_d1.tsv expected_d1_pairs.tsv
+    check -m sete.tsv setd.tsv -d 1 -t $t
+    check -m sete.tsv setd.tsv -d 1 -t $t --index partition
+done
+
+# compact trie, with edges split at different depths
+
+for d in 1 2 3 ; do
+    reference -m sete.tsv setd.tsv -d $d -g
+    check -m sete.tsv setd.tsv -d $d -g --index trie
+    reference -x setd.tsv sete.tsv -d $d -i -g --index trie
+    check -x setd.tsv sete.tsv -d $d -i -g --index trie -t 4
+done
+reference -c sete.tsv -d 1 -i --index trie
+check -c sete.tsv -d 1 -i --index trie -t 4
+
+# existence of a set in itself, compared with existence in a copy
+
+cp setd.tsv copy.tsv
+for d in 0 1 2 ; do
+    reference -x setd.tsv copy.tsv -d $d
+    check -x setd.tsv setd.tsv -d $d
+    check -x setd.tsv setd.tsv -d $d -t 4
+    check -x setd.tsv setd.tsv -d $d --index masked
+    check -x setd.tsv setd.tsv -d $d --index trie
+    check -x setd.tsv setd.tsv -d $d --index join
+done
+reference -x setd.tsv copy.tsv -d 1 -a --sparse
+check -x setd.tsv setd.tsv -d 1 -a --sparse
+reference -x setd.tsv copy.tsv -d 2 -i
+check -x setd.tsv setd.tsv -d 2 -i
+reference -x setd.tsv copy.tsv -d 3
+check -x setd.tsv setd.tsv -d 3 -t 4
+
+# clusters found with the pigeonhole index, with the members in the
+# same order as CompAIRR 1.13.0
+
+for d in 3 4 ; do
+    expected expected_cluster_d$d.tsv
+    check -c sete.tsv -d $d
+    check -c sete.tsv -d $d -t 4
+done
+
+cleanup
+echo Test completed successfully.